@@ -0,0 +1,106 @@
+#pragma once
+
+// A bump allocator for AST nodes.
+//
+// Nodes (and their child arrays) are carved out of large blocks, so building a tree costs a
+// pointer bump per node rather than a heap allocation, and nodes built together sit together in
+// memory.  The arena owns everything it hands out: nothing is freed individually, and the
+// destructors of non-trivial objects are run (newest first) when the arena itself is destroyed.
+// Handles returned by Make() only track which part of the parser is holding a node while a tree
+// is assembled; dropping a handle does not free anything.
+//
+// Example usage:
+//   ASTArena arena;
+//   ASTArena::ptr_t<MyNode> node = arena.Make<MyNode>(args...);
+//   int * values = arena.AllocateArray<int>(16);
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class ASTArena {
+private:
+  static constexpr size_t BLOCK_SIZE = 256 * 1024;
+
+  // Objects with destructors are preceded by a header linking them together, newest first.
+  struct CleanupHeader {
+    CleanupHeader * prev;
+    void (*destroy)(void *);
+  };
+
+  std::vector<std::unique_ptr<std::byte[]>> blocks{};
+  std::byte * cur = nullptr;   // Next free byte in the current block.
+  std::byte * end = nullptr;   // End of the current block.
+  CleanupHeader * last_cleanup = nullptr;
+  size_t bytes_used = 0;
+
+public:
+  // Arena objects are never deleted through their handles.
+  struct NoDelete { void operator()(const void *) const { } };
+  template <typename T> using ptr_t = std::unique_ptr<T, NoDelete>;
+
+  ASTArena() = default;
+  ASTArena(const ASTArena &) = delete;
+  ASTArena & operator=(const ASTArena &) = delete;
+  ~ASTArena() { Clear(); }
+
+  size_t BytesUsed() const { return bytes_used; }
+
+  // Get raw memory; it lives until the arena is cleared.
+  void * Allocate(size_t size, size_t align) {
+    size_t padding = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+    if (!cur || static_cast<size_t>(end - cur) < padding + size) {
+      const size_t block_size = std::max(BLOCK_SIZE, size + align);
+      blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(block_size));
+      cur = blocks.back().get();
+      end = cur + block_size;
+      padding = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+    }
+    void * out = cur + padding;
+    cur += padding + size;
+    bytes_used += padding + size;
+    return out;
+  }
+
+  // Get an uninitialized array of trivial values.
+  template <typename T>
+  T * AllocateArray(size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>, "Arena arrays are never destroyed.");
+    return static_cast<T *>(Allocate(sizeof(T) * count, alignof(T)));
+  }
+
+  // Build an object in the arena; its destructor runs when the arena is cleared.
+  template <typename T, typename... ARG_Ts>
+  ptr_t<T> Make(ARG_Ts &&... args) {
+    if constexpr (std::is_trivially_destructible_v<T>) {
+      return ptr_t<T>(new (Allocate(sizeof(T), alignof(T))) T(std::forward<ARG_Ts>(args)...));
+    } else {
+      // Place the header directly in front of the object.
+      constexpr size_t align = std::max(alignof(T), alignof(CleanupHeader));
+      constexpr size_t offset = (sizeof(CleanupHeader) + align - 1) / align * align;
+      std::byte * memory = static_cast<std::byte *>(Allocate(offset + sizeof(T), align));
+      T * object = new (memory + offset) T(std::forward<ARG_Ts>(args)...);
+      last_cleanup = new (memory + offset - sizeof(CleanupHeader)) CleanupHeader{
+        last_cleanup, [](void * ptr){ static_cast<T *>(ptr)->~T(); }
+      };
+      return ptr_t<T>(object);
+    }
+  }
+
+  // Destroy every object and release all memory.
+  void Clear() {
+    while (last_cleanup) {
+      CleanupHeader * header = last_cleanup;
+      last_cleanup = header->prev;
+      header->destroy(header + 1);
+    }
+    blocks.clear();
+    cur = end = nullptr;
+    bytes_used = 0;
+  }
+};
@@ -1,36 +1,100 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
 #include <cmath>
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include "ASTArena.hpp"
 #include "Control.hpp"
 #include "lexer.hpp"
+#include "OpCode.hpp"
 #include "tools.hpp"         // For FilePos
 #include "SymbolTable.hpp"
 
+class ASTNode;
+
+// All AST nodes live in a single arena, freed together when the program exits.
+inline ASTArena & NodeArena() {
+  static ASTArena arena;
+  return arena;
+}
+
+// Concrete node classes; the tree walkers switch on these rather than making virtual calls.
+enum class NodeKind : uint8_t {
+  BLOCK, FUNCTION, IF, WHILE, RETURN, BREAK, CONTINUE, TO_DOUBLE, TO_INT, TO_STRING,
+  MATH1, MATH2, CHAR_LIT, INT_LIT, FLOAT_LIT, VAR, FUNCTION_CALL, STRING_LIT, INDEX
+};
+
+// What a node's code generator needs next.  Code generation runs as a sequence of steps per node
+// (see ASTNode::ToWAT_Step) so deeply nested trees are compiled with an explicit stack.
+struct WATNext {
+  enum Action { DONE, CHILD, ASSIGN_CHILD };
+  Action action = DONE;
+  size_t child = 0;         // CHILD / ASSIGN_CHILD: which child to generate code for next.
+  bool out_needed = false;  // CHILD: must the child leave a value? (Unneeded values are dropped.)
+  bool has_out = false;     // DONE: did this node leave a value on the stack?
+
+  static WATNext Done(bool has_out) { return WATNext{DONE, 0, false, has_out}; }
+  static WATNext Child(size_t id, bool out_needed) { return WATNext{CHILD, id, out_needed, false}; }
+  static WATNext AssignChild(size_t id) { return WATNext{ASSIGN_CHILD, id, false, false}; }
+};
+
 class ASTNode {
 protected:
   FilePos file_pos;   // What file position was this node parsed from in the original file?
 
+  // Children are held in a contiguous arena array whose size is num_children rounded up to a
+  // power of two (the array belongs to the arena, not to this node).
+  ASTNode ** children = nullptr;
+  uint32_t num_children = 0;
+
+private:
+  const NodeKind kind;
+  mutable std::optional<Type> type_memo{};  // Cached result of ReturnType().
+
 public:
-  using ptr_t = std::unique_ptr<ASTNode>;
+  using ptr_t = ASTArena::ptr_t<ASTNode>;
+  using type_inputs_t = std::array<const ASTNode *, 2>;
 
-  ASTNode() : file_pos(0,0) { }
-  ASTNode(FilePos file_pos) : file_pos(file_pos) { }
-  ASTNode(const ASTNode &) = default;
-  ASTNode(ASTNode &&) = default;
+  ASTNode(NodeKind kind, FilePos file_pos) : file_pos(file_pos), kind(kind) { }
+  ASTNode(const ASTNode &) = delete;
+  ASTNode(ASTNode &&) = delete;
   virtual ~ASTNode() { }
-  ASTNode & operator=(const ASTNode &) = default;
-  ASTNode & operator=(ASTNode &&) = default;
+  ASTNode & operator=(const ASTNode &) = delete;
+  ASTNode & operator=(ASTNode &&) = delete;
+
+  NodeKind Kind() const { return kind; }
 
   // What position in the original file was this node defined at?
   FilePos GetFilePos() const { return file_pos; }
 
   // What position in the original file was this whole code segment defined at?
-  virtual FilePos GetFirstPos() const { return file_pos; }
+  FilePos GetFirstPos() const {
+    FilePos first_pos = file_pos;
+    std::vector<const ASTNode *> pending{this};
+    while (pending.size()) {
+      const ASTNode * node = pending.back();
+      pending.pop_back();
+      if (node->file_pos < first_pos) first_pos = node->file_pos;
+      for (size_t i = 0; i < node->num_children; ++i) {
+        if (node->children[i]) pending.push_back(node->children[i]);
+      }
+    }
+    return first_pos;
+  }
+
+  // Generic access to children, for the tree walkers.
+  size_t NumChildren() const { return num_children; }
+  ASTNode * ChildPtr(size_t id) const { return id < num_children ? children[id] : nullptr; }
 
   virtual void AddChild(ptr_t &&) {
     // Cannot call AddChild on a non-parent class.
@@ -53,90 +117,140 @@ public:
   // - A while loop with a return inside.
   virtual bool MayReturn() const { return false; }
 
-  virtual Type ReturnType(const SymbolTable & /* symbols */) const {
+  // The type of value this node produces.  Results are cached; any inputs that are not cached
+  // yet are computed bottom-up first, so even very deep expressions never recurse.
+  const Type & ReturnType(const SymbolTable & symbols) const {
+    if (!type_memo) CalcTypes(symbols);
+    return *type_memo;
+  }
+
+  // Forget the cached type (e.g., because a child was replaced).
+  void ResetReturnType() { type_memo.reset(); }
+
+  // The type recorded for this node by the type annotation pass (TypeCheckTree()).
+  const Type & AnnotatedType() const {
+    assert(type_memo);  // Make sure TypeCheckTree() has run.
+    return *type_memo;
+  }
+
+  // Compute this node's type; inputs listed by TypeInputs() are already cached when called.
+  virtual Type CalcReturnType(const SymbolTable & /* symbols */) const {
     return Type();  // By default, return an empty type.
   }
 
+  // Which children does CalcReturnType() look at?
+  virtual type_inputs_t TypeInputs() const { return { nullptr, nullptr }; }
+
+  // Checks on this node alone; TypeCheckTree() runs TypeCheck() after all children are checked,
+  // and TypeCheckFirst() before any of them are.
+  virtual void TypeCheckFirst(const SymbolTable & /* symbols */) { }
   virtual void TypeCheck(const SymbolTable & /* symbols */) { }
 
   // Generate any GLOBAL code that is needed to initialize this node.
-  // (For example, place literal strings in memory.)
+  // (For example, place literal strings in memory.)  InitializeTreeWAT() visits all nodes.
   virtual void InitializeWAT(Control & /* control */) { }
 
   // Generate WAT code and return (true/false) whether a value was left on the stack.
-  virtual bool ToWAT(Control & /* control */) = 0;
+  bool ToWAT(Control & control);
+
+  // Generate code one step at a time: emit what comes before the next child, then ask for it.
+  virtual WATNext ToWAT_Step(Control & control, size_t step) = 0;
 
   virtual bool CanAssign() const { return false; }
-  virtual void ToAssignWAT(Control & /* control */) {
+  void ToAssignWAT(Control & control);
+  virtual WATNext ToAssignWAT_Step(Control & /* control */, size_t /* step */) {
     assert(false); // By default, nodes are not assignable!
+    return WATNext::Done(false);
   }
-};
 
-class ASTNode_Parent : public ASTNode {
 private:
-  std::vector< ptr_t > children{};
+  // Fill in the type cache for this node (and any uncached inputs) without recursion.
+  void CalcTypes(const SymbolTable & symbols) const;
 
+  // Run a node's code generation steps (and those of its children) on an explicit stack.
+  static bool RunWAT(ASTNode & root, Control & control, bool assign);
+};
+
+class ASTNode_Parent : public ASTNode {
 public:
   template <typename... NODE_Ts>
-  ASTNode_Parent(FilePos file_pos, NODE_Ts &&... nodes) : ASTNode(file_pos) {
-    (AddChild(std::move(nodes)), ...);
-  }
-
-  void TypeCheck(const SymbolTable & symbols) override {
-    TypeCheckChildren(symbols);
+  ASTNode_Parent(NodeKind kind, FilePos file_pos, NODE_Ts &&... nodes) : ASTNode(kind, file_pos) {
+    if constexpr (sizeof...(NODE_Ts) > 0) {
+      children = NodeArena().AllocateArray<ASTNode *>(std::bit_ceil(sizeof...(NODE_Ts)));
+      ((children[num_children++] = nodes.release()), ...);
+    }
   }
 
   // Tools to work with child nodes...
 
-  void TypeCheckChildren(const SymbolTable & symbols) {
-    for (auto & child : children) { child->TypeCheck(symbols); }
-  }
-
-  void InitializeWAT(Control & control) override {
-    for (auto & child : children) { child->InitializeWAT(control); }
-  }
-
-  size_t NumChildren() const { return children.size(); }
-  bool HasChild(size_t id) const { return id < children.size() && children[id]; }
+  bool HasChild(size_t id) const { return id < num_children && children[id]; }
 
   ASTNode & GetChild(size_t id) { assert(HasChild(id)); return *children[id]; }
   const ASTNode & GetChild(size_t id) const { assert(HasChild(id)); return *children[id]; }
-  ASTNode & LastChild() { assert(children.size()); return *children.back(); }
-  const ASTNode & LastChild() const { assert(children.size()); return *children.back(); }
-
-  FilePos GetFirstPos() const override {
-    FilePos first_pos = file_pos;
-    for (const auto & child : children) {
-      if (child->GetFirstPos() < first_pos) first_pos = child->GetFirstPos();
-    }
-    return first_pos;
-  }
+  ASTNode & LastChild() { assert(num_children); return *children[num_children-1]; }
+  const ASTNode & LastChild() const { assert(num_children); return *children[num_children-1]; }
 
   void AddChild(ptr_t && child) override {
-    children.push_back(std::move(child));
+    // Arrays are full at zero or a power of two; then move to a bigger one (the old one stays
+    // in the arena).
+    if (num_children == 0 || std::has_single_bit(num_children)) {
+      ASTNode ** new_children = NodeArena().AllocateArray<ASTNode *>(std::max(2 * num_children, 1u));
+      std::copy(children, children + num_children, new_children);
+      children = new_children;
+    }
+    children[num_children++] = child.release();
   }
 
   template <typename NODE_T, typename... ARG_Ts>
   void MakeChild(ARG_Ts &&... args) {
-    AddChild( std::make_unique<NODE_T>(std::forward<ARG_Ts>(args)...) );
+    AddChild( NodeArena().Make<NODE_T>(std::forward<ARG_Ts>(args)...) );
+  }
+
+  // Result type of an operator applied to this node's children (see OpCode.hpp)...
+  Type OpReturnType(OpCode op) const {
+    switch (GetOpCodeInfo(op).result) {
+    case OpResult::INT:    return Type::Int();
+    case OpResult::DOUBLE: return Type::Double();
+    case OpResult::LHS:    return GetChild(0).AnnotatedType();
+    case OpResult::WIDER: {
+      const Type & type0 = GetChild(0).AnnotatedType();
+      const Type & type1 = GetChild(1).AnnotatedType();
+      return (type0.BitCount() > type1.BitCount()) ? type0 : type1;
+    }
+    default: return Type();
+    }
+  }
+
+  // ...and the children that type depends on.
+  type_inputs_t OpTypeInputs(OpCode op) const {
+    switch (GetOpCodeInfo(op).result) {
+    case OpResult::LHS:   return { ChildPtr(0), nullptr };
+    case OpResult::WIDER: return { ChildPtr(0), ChildPtr(1) };
+    default:              return { nullptr, nullptr };
+    }
   }
 
   // Insert a new node between this one and a specified child.
   template <typename NODE_T>
   void AdaptChild(size_t id) {
-    assert(id < children.size()); // Make sure child is there to adapt.
-    children[id] = std::make_unique<NODE_T>(std::move(children[id]));
+    assert(id < num_children); // Make sure child is there to adapt.
+    children[id] = NodeArena().Make<NODE_T>(ptr_t(children[id])).release();
+    ResetReturnType();
   }
 
-  // Generate WAT code for a specified child.
-  // Make sure there is an 'out_value' if needed; otherwise drop any out value.
-  void ChildToWAT(size_t id, Control & control, bool out_needed) { 
-    assert(HasChild(id));
-    const bool has_out = children[id]->ToWAT(control);
-    assert(!out_needed || has_out);  // If we need an out value, make sure one is provided.
-    if (!out_needed && has_out) {    // If we don't need an out value and one is provided, drop it.
-      control.Drop();
-    }
+  // Swap in a different node for a child (the old one stays in the arena).
+  void ReplaceChild(size_t id, ptr_t && child) {
+    assert(id < num_children && child);
+    children[id] = child.release();
+    ResetReturnType();
+  }
+
+  // Take a child out, shifting any later children down (the old one stays in the arena).
+  void RemoveChild(size_t id) {
+    assert(id < num_children);
+    std::copy(children + id + 1, children + num_children, children + id);
+    --num_children;
+    ResetReturnType();
   }
 
   void Print(std::string prefix="") const override {
@@ -151,14 +265,15 @@ public:
   }
 };
 
-class ASTNode_Block : public ASTNode_Parent {
+class ASTNode_Block final : public ASTNode_Parent {
 private:
   bool is_return = false;
   bool may_return = false;
+  bool is_final_node = false;  // Was this block the final node when code generation started?
 
 public:
   template <typename... NODE_Ts>
-  ASTNode_Block(FilePos file_pos, NODE_Ts &&... nodes) : ASTNode_Parent(file_pos, nodes...) { }
+  ASTNode_Block(FilePos file_pos, NODE_Ts &&... nodes) : ASTNode_Parent(NodeKind::BLOCK, file_pos, nodes...) { }
 
   std::string GetTypeName() const override { return "BLOCK"; }
 
@@ -173,87 +288,85 @@ public:
 
   bool IsReturn() const override { return is_return; }
   bool MayReturn() const override { return may_return; }
-  Type ReturnType(const SymbolTable & symbols) const override {
-    return LastChild().ReturnType(symbols);
+  Type CalcReturnType(const SymbolTable & /* symbols */) const override {
+    return NumChildren() ? LastChild().AnnotatedType() : Type();   // Optimization can empty a block.
+  }
+  type_inputs_t TypeInputs() const override {
+    return { NumChildren() ? &LastChild() : nullptr, nullptr };
   }
 
-  bool ToWAT(Control & control) override { 
-    bool is_final_node = control.FinalNode();
-    control.FinalNode(false);
-    for (size_t i = 0; i < NumChildren(); ++i) {
+  WATNext ToWAT_Step(Control & control, size_t step) override {
+    if (step == 0) {
+      is_final_node = control.FinalNode();
+      control.FinalNode(false);
+    }
+    if (step < NumChildren()) {
       // Only the final node in the block should be marked as such.
-      if (i == NumChildren()-1) control.FinalNode(is_final_node);
-
-      bool leftover_value = GetChild(i).ToWAT(control); // Run children.
-      if (leftover_value) {
-        // If child statement left an unneeded value on the stack, remove it.
-        control.Drop();
-      }
+      if (step == NumChildren()-1) control.FinalNode(is_final_node);
+      return WATNext::Child(step, false);  // Run children; drop any value they leave behind.
     }
-
-    return false; // Value is left on the stack only if this is a return statement.
+    return WATNext::Done(false); // Value is left on the stack only if this is a return statement.
   }
 };
 
-class ASTNode_Function : public ASTNode_Parent {
+class ASTNode_Function final : public ASTNode_Parent {
 protected:
   size_t fun_id;
   std::vector<size_t> param_ids;    // The set of variables used as function parameters.
-  std::vector<size_t> var_ids;      // The set of variables used inside the function. 
+  std::vector<size_t> var_ids;      // The set of variables declared inside the function body.
 public:
   ASTNode_Function(
     const emplex::Token & name_token,
     size_t fun_id,
     std::vector<size_t> param_ids,
     ptr_t && body
-  ) : ASTNode_Parent(name_token, body)
+  ) : ASTNode_Parent(NodeKind::FUNCTION, name_token, body)
     , fun_id(fun_id)
     , param_ids(param_ids) { }
 
   std::string GetTypeName() const override { return std::string("FUNCTION: ") + std::to_string(fun_id); }
 
   void AddVar(size_t var_id) { var_ids.push_back(var_id); }
-  void SetVars(const std::vector<size_t> & in) { var_ids = in; }
+  const std::vector<size_t> & ParamIDs() const { return param_ids; }
+  const std::vector<size_t> & VarIDs() const { return var_ids; }
 
-  Type ReturnType(const SymbolTable & symbols) const override {
+  // Set all of the function's variables; the parameters come first and are skipped.
+  void SetVars(const std::vector<size_t> & in) {
+    assert(in.size() >= param_ids.size() && std::equal(param_ids.begin(), param_ids.end(), in.begin()));
+    var_ids.assign(in.begin() + param_ids.size(), in.end());
+  }
+
+  Type CalcReturnType(const SymbolTable & symbols) const override {
     return symbols.At(fun_id).type.ReturnType();
   }
 
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t step) override {
     assert(NumChildren() == 1);
+    const std::string & fun_name = control.symbols.GetName(fun_id);
 
-    std::string param_declare;
-    for (size_t id : param_ids) {
-      std::string type = control.WATType(id);
-      param_declare += ToString(" (param $var", id, " ", type, ")");
+    if (step == 0) {
+      auto fun_type = control.symbols.At(fun_id).type;
+      control.BeginFunction(fun_name, param_ids, fun_type.ReturnType().ToWAT());
+      control.Indent(2);
+      control.WATDeclareSymbols(var_ids);
+      control.FinalNode(true);     // Since there is only one node in this function, in must be the final one.
+      return WATNext::Child(0, false);
     }
 
-    auto fun_name = control.symbols.At(fun_id).name;
-    auto fun_type = control.symbols.At(fun_id).type;
-
-    std::string wat_return = fun_type.ReturnType().ToWAT();
-    control.Code("(func $", fun_name, param_declare, " (result ", wat_return, ")");
-    control.Indent(2);
-    control.WATDeclareSymbols(var_ids);
-    control.FinalNode(true);     // Since there is only one node in this function, in must be the final one.
-    ChildToWAT(0, control, false);
     control.Indent(-2);
-    control.Code(")").Comment("END '", fun_name, "' function definition.")
-           .Code("")  // Skip a line.
-           .Code("(export \"", fun_name, "\" (func $", fun_name, "))")
-           .Code("");  // Skip a line.
+    control.EndFunction(fun_name);
 
-    return false;
+    return WATNext::Done(false);
   }
 };
 
 
-class ASTNode_If : public ASTNode_Parent {
+class ASTNode_If final : public ASTNode_Parent {
 public:
   ASTNode_If(FilePos file_pos, ptr_t && test, ptr_t && action)
-    : ASTNode_Parent(file_pos, test, action) { }
+    : ASTNode_Parent(NodeKind::IF, file_pos, test, action) { }
   ASTNode_If(FilePos file_pos, ptr_t && test, ptr_t && action, ptr_t && alt_action)
-    : ASTNode_Parent(file_pos, test, action, alt_action) { }
+    : ASTNode_Parent(NodeKind::IF, file_pos, test, action, alt_action) { }
 
   std::string GetTypeName() const override { return "IF"; }
 
@@ -268,11 +381,13 @@ public:
     return (NumChildren() == 3) && GetChild(2).MayReturn();
   }
 
-  Type ReturnType(const SymbolTable & symbols) const override {
-    return GetChild(1).ReturnType(symbols);
+  Type CalcReturnType(const SymbolTable & /* symbols */) const override {
+    return GetChild(1).AnnotatedType();
   }
+  type_inputs_t TypeInputs() const override { return { ChildPtr(1), nullptr }; }
 
-  void TypeCheck(const SymbolTable & symbols) override {
+  // The condition is checked before the branches are.
+  void TypeCheckFirst(const SymbolTable & symbols) override {
     if (NumChildren() < 2 || NumChildren() > 3) {
       Error(file_pos, "Internal error: Expected 2 or 3 children in if node, found ", NumChildren());
     }
@@ -280,41 +395,49 @@ public:
       Error(file_pos, "Condition for if-statement must evaluate to type int, not ",
             GetChild(0).ReturnType(symbols).Name());
     }
-    TypeCheckChildren(symbols);
   }
 
-  bool ToWAT(Control & control) override {
-    control.CommentLine("Test condition for if.");
-    ChildToWAT(0, control, true);
-    std::string result_str;
-    if (control.FinalNode()) {
-      std::string type = ReturnType(control.symbols).ToWAT();
-      result_str = ToString("(result ", type, ")");
+  WATNext ToWAT_Step(Control & control, size_t step) override {
+    switch (step) {
+    case 0:
+      control.CommentLine("Test condition for if.");
+      return WATNext::Child(0, true);
+    case 1: {
+      std::string result_type;
+      if (control.FinalNode()) result_type = AnnotatedType().ToWAT();
+      control.If(result_type).Comment("Execute code based on result of condition.")
+             .Indent(2)
+             .Then().Comment("'then' block")
+             .Indent(2);
+      return WATNext::Child(1, false);
     }
-    control.Code("(if ", result_str, "").Comment("Execute code based on result of condition.")
-           .Indent(2)
-           .Code("(then").Comment("'then' block")
-           .Indent(2);
-    ChildToWAT(1, control, false);
-    control.Indent(-2);
-    control.Code(")").Comment("End 'then'");
-    if (NumChildren() == 3) {
-      control.Code("(else").Comment("'else' block");
-      control.Indent(2);
-      ChildToWAT(2, control, false);
+    case 2:
+      control.Indent(-2);
+      control.End().Comment("End 'then'");
+      if (NumChildren() == 3) {
+        control.Else().Comment("'else' block");
+        control.Indent(2);
+        return WATNext::Child(2, false);
+      }
+      break;
+    default:
       control.Indent(-2);
-      control.Code(")").Comment("End 'else'");
+      control.End().Comment("End 'else'");
     }
     control.Indent(-2);
-    control.Code(")").Comment("End 'if'");
-    return false;
+    control.End().Comment("End 'if'");
+    return WATNext::Done(false);
   }
 };
 
-class ASTNode_While : public ASTNode_Parent {
+class ASTNode_While final : public ASTNode_Parent {
+private:
+  std::string while_exit;  // Labels generated for this loop.
+  std::string while_loop;
+
 public:
   ASTNode_While(FilePos file_pos, ptr_t && test, ptr_t && action)
-    : ASTNode_Parent(file_pos, test, action) { }
+    : ASTNode_Parent(NodeKind::WHILE, file_pos, test, action) { }
 
   std::string GetTypeName() const override { return "WHILE"; }
 
@@ -325,312 +448,317 @@ public:
     return GetChild(1).MayReturn();
   }
 
-  Type ReturnType(const SymbolTable & symbols) const override {
-    return GetChild(1).ReturnType(symbols);
+  Type CalcReturnType(const SymbolTable & /* symbols */) const override {
+    return GetChild(1).AnnotatedType();
   }
+  type_inputs_t TypeInputs() const override { return { ChildPtr(1), nullptr }; }
 
-  void TypeCheck(const SymbolTable & symbols) override {
+  void TypeCheck(const SymbolTable & /* symbols */) override {
     if (NumChildren() != 2) {
       Error(file_pos, "Internal error: Expected 2 in while node, found ", NumChildren());
     }
-    TypeCheckChildren(symbols);
-    if (!GetChild(0).ReturnType(symbols).IsInt()) {
+    if (!GetChild(0).AnnotatedType().IsInt()) {
       Error(GetChild(0).GetFilePos(), "Condition for while-statement must evaluate to type int, not ",
-            GetChild(0).ReturnType(symbols).Name());
+            GetChild(0).AnnotatedType().Name());
     }
   }
 
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t step) override {
     assert(NumChildren() == 2);
-    // A while loop may go around again, so we cannot treat any node inside of it as final.
-    // (In practice, though programs functions should end with a while anyway)
-    control.FinalNode(false);
-    std::string while_exit = control.MakeLabel("$exit");
-    std::string while_loop = control.MakeLabel("$loop");
-
-    // Store labels in case of break or continue.
-    control.PushBreakLabel(while_exit);
-    control.PushLoopLabel(while_loop);
+    if (step == 0) {
+      // A while loop may go around again, so we cannot treat any node inside of it as final.
+      // (In practice, though programs functions should end with a while anyway)
+      control.FinalNode(false);
+      while_exit = control.MakeLabel("$exit");
+      while_loop = control.MakeLabel("$loop");
+
+      // Store labels in case of break or continue.
+      control.PushBreakLabel(while_exit);
+      control.PushLoopLabel(while_loop);
     
-    control.Code("(block ", while_exit, "").Comment("Outer block for breaking while loop.")
-           .Code("  (loop ", while_loop, "").Comment("Inner loop for continuing while.");
-    control.Indent(4);
-    control.CommentLine("WHILE Test condition...");
-
-    ChildToWAT(0, control, true);
+      control.Block(while_exit).Comment("Outer block for breaking while loop.")
+             .Indent(2)
+             .Loop(while_loop).Comment("Inner loop for continuing while.")
+             .Indent(2);
+      control.CommentLine("WHILE Test condition...");
 
-    control.Code("(i32.eqz)").Comment("Invert the result of the test condition.")
-           .Code("(br_if ", while_exit, ")").Comment("If condition is false (0), exit the loop")
-           .CommentLine("WHILE Loop body...");
+      return WATNext::Child(0, true);
+    }
+    if (step == 1) {
+      control.Op(WasmOp("i32.eqz")).Comment("Invert the result of the test condition.")
+             .Op(WasmOp("br_if"), while_exit).Comment("If condition is false (0), exit the loop")
+             .CommentLine("WHILE Loop body...");
 
-    ChildToWAT(1, control, false);
+      return WATNext::Child(1, false);
+    }
 
     control.CommentLine("WHILE start next loop.")
-           .Code("(br ", while_loop, ")").Comment("Jump back to the start of the loop");
-    control.Indent(-4);
-    control.Code("  )").Comment("End loop")
-           .Code(")").Comment("End block");
+           .Op(WasmOp("br"), while_loop).Comment("Jump back to the start of the loop");
+    control.Indent(-2)
+           .End().Comment("End loop")
+           .Indent(-2)
+           .End().Comment("End block");
 
     // Remove labels for break and continue;
     control.PopBreakLabel();
     control.PopLoopLabel();
 
-    return false;
+    return WATNext::Done(false);
   }
 };
 
-class ASTNode_Return : public ASTNode_Parent {
+class ASTNode_Return final : public ASTNode_Parent {
 public:
   ASTNode_Return(FilePos file_pos, ptr_t && expr)
-    : ASTNode_Parent(file_pos, expr) { }
+    : ASTNode_Parent(NodeKind::RETURN, file_pos, expr) { }
 
   std::string GetTypeName() const override { return "RETURN"; }
 
   bool IsReturn() const override { return true; }
   bool MayReturn() const override { return true; }
 
-  Type ReturnType(const SymbolTable & symbols) const override {
-    return GetChild(0).ReturnType(symbols);
+  Type CalcReturnType(const SymbolTable & /* symbols */) const override {
+    return GetChild(0).AnnotatedType();
   }
+  type_inputs_t TypeInputs() const override { return { ChildPtr(0), nullptr }; }
 
-  void TypeCheck(const SymbolTable & symbols) override {
+  void TypeCheck(const SymbolTable & /* symbols */) override {
     if (NumChildren() != 1) {
       Error(file_pos, "Internal error: Expected one arg in return node, found ", NumChildren());
     }
-    TypeCheckChildren(symbols);
     // @CAO - SHOULD CHECK RETURN TYPE.
   }
 
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t step) override {
     // Simply leave the return value on the stack.
-    ChildToWAT(0, control, true);
+    if (step == 0) return WATNext::Child(0, true);
     // If this is not a final node, we should set up a break.
     if (!control.FinalNode()) {
-      control.Code("(return)").Comment("Halt and return value.");
+      control.Op(WasmOp("return")).Comment("Halt and return value.");
     }
-    return false;
+    return WATNext::Done(false);
   }
 };
 
-class ASTNode_Break : public ASTNode {
+class ASTNode_Break final : public ASTNode {
 public:
-  ASTNode_Break(FilePos file_pos) : ASTNode(file_pos) { }
+  ASTNode_Break(FilePos file_pos) : ASTNode(NodeKind::BREAK, file_pos) { }
   std::string GetTypeName() const override { return "BREAK"; }
 
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t /* step */) override {
     if (!control.HasLoopLabel()) Error(file_pos, "No loop for `break` to exit.");
     std::string loop_exit = control.GetBreakLabel();
-    control.Code("(br ", loop_exit, ")").Comment("'break' command.");
-    return false;
+    control.Op(WasmOp("br"), loop_exit).Comment("'break' command.");
+    return WATNext::Done(false);
   }
 };
 
-class ASTNode_Continue : public ASTNode {
+class ASTNode_Continue final : public ASTNode {
 public:
-  ASTNode_Continue(FilePos file_pos) : ASTNode(file_pos) { }
+  ASTNode_Continue(FilePos file_pos) : ASTNode(NodeKind::CONTINUE, file_pos) { }
   std::string GetTypeName() const override { return "CONTINUE"; }
 
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t /* step */) override {
     if (!control.HasLoopLabel()) Error(file_pos, "No loop for `continue` to operate on.");
     std::string loop_label = control.GetLoopLabel();
-    control.Code("(br ", loop_label, ")").Comment("'continue' command.");
-    return false;
+    control.Op(WasmOp("br"), loop_label).Comment("'continue' command.");
+    return WATNext::Done(false);
   }
 };
 
-class ASTNode_ToDouble : public ASTNode_Parent {
+class ASTNode_ToDouble final : public ASTNode_Parent {
 public:
-  ASTNode_ToDouble(ptr_t && child) : ASTNode_Parent(child->GetFilePos(), child) { }
+  ASTNode_ToDouble(ptr_t && child) : ASTNode_Parent(NodeKind::TO_DOUBLE, child->GetFilePos(), child) { }
   std::string GetTypeName() const override { return "ToDouble"; }
-  Type ReturnType(const SymbolTable &) const override { return Type{"double"}; }
+  Type CalcReturnType(const SymbolTable &) const override { return Type::Double(); }
 
-  void TypeCheck(const SymbolTable & symbols) override {
+  void TypeCheck(const SymbolTable & /* symbols */) override {
     if (NumChildren() != 1) {
       Error(file_pos, "Internal error: Expected child in ToDouble node, found ", NumChildren());
     }
-    TypeCheckChildren(symbols);
-    const Type & child_type = GetChild(0).ReturnType(symbols);
-    if (!child_type.CastToOK(Type("double"))) {
+    const Type & child_type = GetChild(0).AnnotatedType();
+    if (!child_type.CastToOK(Type::Double())) {
       Error(file_pos, "Cannot convert type ", child_type.Name(), " to double.");
     }
   }
 
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t step) override {
     assert(NumChildren() == 1);
-    ChildToWAT(0, control, true);
-    if (!GetChild(0).ReturnType(control.symbols).IsDouble()) {
-      control.Code("(f64.convert_i32_s)").Comment("Convert to double.");
+    if (step == 0) return WATNext::Child(0, true);
+    if (!GetChild(0).AnnotatedType().IsDouble()) {
+      control.Op(WasmOp("f64.convert_i32_s")).Comment("Convert to double.");
     }
-    return true;
+    return WATNext::Done(true);
   }
 };
 
-class ASTNode_ToInt : public ASTNode_Parent {
+class ASTNode_ToInt final : public ASTNode_Parent {
 public:
-  ASTNode_ToInt(ptr_t && child) : ASTNode_Parent(child->GetFilePos(), child) { }
+  ASTNode_ToInt(ptr_t && child) : ASTNode_Parent(NodeKind::TO_INT, child->GetFilePos(), child) { }
   std::string GetTypeName() const override { return "ToInt"; }
-  Type ReturnType(const SymbolTable &) const override { return Type("int"); }
+  Type CalcReturnType(const SymbolTable &) const override { return Type::Int(); }
 
-  void TypeCheck(const SymbolTable & symbols) override {
+  void TypeCheck(const SymbolTable & /* symbols */) override {
     if (NumChildren() != 1) {
       Error(file_pos, "Internal error: Expected child in ToInt node, found ", NumChildren());
     }
-    TypeCheckChildren(symbols);
-    const Type & child_type = GetChild(0).ReturnType(symbols);
-    if (!child_type.CastToOK(Type("int"))) {
+    const Type & child_type = GetChild(0).AnnotatedType();
+    if (!child_type.CastToOK(Type::Int())) {
       Error(file_pos, "Cannot convert type ", child_type.Name(), " to int.");
     }
   }
 
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t step) override {
     assert(NumChildren() == 1);
-    ChildToWAT(0, control, true);
-    if (GetChild(0).ReturnType(control.symbols).IsDouble()) {
-      control.Code("(i32.trunc_f64_s)").Comment("Convert to int.");
+    if (step == 0) return WATNext::Child(0, true);
+    if (GetChild(0).AnnotatedType().IsDouble()) {
+      control.Op(WasmOp("i32.trunc_f64_s")).Comment("Convert to int.");
     }
-    return true;
+    return WATNext::Done(true);
   }
 };
 
-class ASTNode_ToString : public ASTNode_Parent {
+class ASTNode_ToString final : public ASTNode_Parent {
 public:
-  ASTNode_ToString(ptr_t && child) : ASTNode_Parent(child->GetFilePos(), child) { }
+  ASTNode_ToString(ptr_t && child) : ASTNode_Parent(NodeKind::TO_STRING, child->GetFilePos(), child) { }
   std::string GetTypeName() const override { return "ToString"; }
-  Type ReturnType(const SymbolTable &) const override { return Type("string"); }
+  Type CalcReturnType(const SymbolTable &) const override { return Type::String(); }
 
-  void TypeCheck(const SymbolTable & symbols) override {
+  void TypeCheck(const SymbolTable & /* symbols */) override {
     if (NumChildren() != 1) {
       Error(file_pos, "Internal error: Expected child in ToString node, found ", NumChildren());
     }
-    TypeCheckChildren(symbols);
-    const Type & child_type = GetChild(0).ReturnType(symbols);
-    if (!child_type.CastToOK(Type("string"))) {
+    const Type & child_type = GetChild(0).AnnotatedType();
+    if (!child_type.CastToOK(Type::String())) {
       Error(file_pos, "Cannot convert type ", child_type.Name(), " to string.");
     }
   }
 
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t step) override {
     assert(NumChildren() == 1);
-    ChildToWAT(0, control, true);
-    if (GetChild(0).ReturnType(control.symbols).IsChar()) {
-      control.Code("(call $_char_to_string)").Comment("Convert to string.");
+    if (step == 0) return WATNext::Child(0, true);
+    if (GetChild(0).AnnotatedType().IsChar()) {
+      control.CallHelper("_char_to_string").Comment("Convert to string.");
     }
-    return true;
+    return WATNext::Done(true);
   }
 };
 
 
-class ASTNode_Math1 : public ASTNode_Parent {
+class ASTNode_Math1 final : public ASTNode_Parent {
 protected:
-  std::string op;
+  OpCode op;
 public:
-  ASTNode_Math1(FilePos file_pos, std::string op, ptr_t && child)
-    : ASTNode_Parent(file_pos, child), op(op) { }
+  ASTNode_Math1(FilePos file_pos, OpCode op, ptr_t && child)
+    : ASTNode_Parent(NodeKind::MATH1, file_pos, child), op(op) { }
   ASTNode_Math1(const emplex::Token & token, ptr_t && child)
-    : ASTNode_Math1(token, token.lexeme, std::move(child)) { }
+    : ASTNode_Math1(token, ToOpCode(token.Lexeme(), true), std::move(child)) { }
 
-  std::string GetTypeName() const override { return std::string("MATH1: ") + op; }
+  std::string GetTypeName() const override {
+    return std::string("MATH1: ") + std::string(GetOpCodeInfo(op).symbol);
+  }
 
-  Type ReturnType(const SymbolTable & symbols) const override {
-    if (op == "!") return Type("int");
-    if (op == "sqrt") return Type("double");
+  OpCode Op() const { return op; }
 
-    // Negation does not change the return type.
-    return GetChild(0).ReturnType(symbols);
+  Type CalcReturnType(const SymbolTable & /* symbols */) const override {
+    return OpReturnType(op);
   }
+  type_inputs_t TypeInputs() const override { return OpTypeInputs(op); }
 
-  void TypeCheck(const SymbolTable & symbols) override {
+  void TypeCheck(const SymbolTable & /* symbols */) override {
+    const std::string_view symbol = GetOpCodeInfo(op).symbol;
     if (NumChildren() != 1) {
-      Error(file_pos, "Internal error: Expected one child in Math1 node (", op, "), found ", NumChildren());
+      Error(file_pos, "Internal error: Expected one child in Math1 node (", symbol, "), found ", NumChildren());
     }
-    TypeCheckChildren(symbols);
 
-    const Type & child_type = GetChild(0).ReturnType(symbols);
-    if (op == "-") {
+    const Type & child_type = GetChild(0).AnnotatedType();
+    switch (GetOpCodeInfo(op).rule) {
+    case OpRule::NEGATE:
       if (child_type.IsChar() || !child_type.IsNumeric()) Error(file_pos, "Unary operator NEGATE (-) cannot be used on type '", child_type.Name(),"'.");
-    }
-    else if (op == "!") {
+      break;
+    case OpRule::NOT:
       if (!child_type.IsInt()) Error(file_pos, "Unary operator NOT (!) can only be used on 'int' types.");
-    }
-    else if (op == "sqrt") {
+      break;
+    case OpRule::SQRT:
       if (!child_type.IsNumeric()) Error(file_pos, "Square root (sqrt) must have a numeric argument.");
       if (!child_type.IsDouble()) AdaptChild<ASTNode_ToDouble>(0);
-    }
-    else if (!child_type.IsNumeric()) {
-      Error(file_pos, "In unary operator '", op, "', cannot convert type ",
-            child_type.Name(), " to a numerical value.");
+      break;
+    default:
+      if (!child_type.IsNumeric()) {
+        Error(file_pos, "In unary operator '", symbol, "', cannot convert type ",
+              child_type.Name(), " to a numerical value.");
+      }
     }
   }
 
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t step) override {
     assert(NumChildren() == 1);
 
-    if (op == "!") {
-      ChildToWAT(0, control, true);
-      control.Code("i32.eqz").Comment("Boolean NOT.");
-    }
-    else if (op == "-") {
-      std::string type = ReturnType(control.symbols).ToWAT();
-      control.Code("(", type, ".const 0)").Comment("Setup unary negation");
-      ChildToWAT(0, control, true);
-      control.Code("(", type, ".sub)").Comment("Unary negation.");
+    switch (op) {
+    case OpCode::NOT:
+      if (step == 0) return WATNext::Child(0, true);
+      control.Op(WasmOp("i32.eqz")).Comment("Boolean NOT.");
+      break;
+    case OpCode::NEGATE: {
+      const bool is_double = AnnotatedType().IsDouble();
+      if (step == 0) {
+        if (is_double) control.Op(WasmOp("f64.const"), 0.0);
+        else control.Op(WasmOp("i32.const"), 0);
+        control.Comment("Setup unary negation");
+        return WATNext::Child(0, true);
+      }
+      control.Op(is_double ? WasmOp("f64.sub") : WasmOp("i32.sub")).Comment("Unary negation.");
+      break;
     }
-    else if (op == "sqrt") {
-      ChildToWAT(0, control, true);
-      control.Code("(f64.sqrt)").Comment("Square Root");
+    case OpCode::SQRT:
+      if (step == 0) return WATNext::Child(0, true);
+      control.Op(WasmOp("f64.sqrt")).Comment("Square Root");
+      break;
+    default:
+      break;
     }
 
-    return true;
+    return WATNext::Done(true);
   }
 };
 
-class ASTNode_Math2 : public ASTNode_Parent {
+class ASTNode_Math2 final : public ASTNode_Parent {
 protected:
-  std::string op;
+  OpCode op;
 public:
-  ASTNode_Math2(FilePos file_pos, std::string op, ptr_t && child1, ptr_t && child2)
-    : ASTNode_Parent(file_pos, child1, child2), op(op) { }
+  ASTNode_Math2(FilePos file_pos, OpCode op, ptr_t && child1, ptr_t && child2)
+    : ASTNode_Parent(NodeKind::MATH2, file_pos, child1, child2), op(op) { }
   ASTNode_Math2(const emplex::Token & token, ptr_t && child1, ptr_t && child2)
-    : ASTNode_Parent(token, std::move(child1), std::move(child2)), op(token.lexeme) { }
-
-  std::string GetTypeName() const override { return std::string("MATH2: " + op); }
+    : ASTNode_Math2(token, ToOpCode(token.Lexeme()), std::move(child1), std::move(child2)) { }
 
-  Type ReturnType(const SymbolTable & symbols) const override {
-    // Assignments use the type of the variable being assigned.
-    if (op == "=") return GetChild(0).ReturnType(symbols);
-
-    // Comparisons and Boolean operations always return type int.
-    if (op == "<" || op == "<=" || op == ">" || op == ">=" || op == "==" || op == "!=" ||
-        op == "&&" || op == "||"|| op == "%") return Type("int");
+  std::string GetTypeName() const override {
+    return std::string("MATH2: ") + std::string(GetOpCodeInfo(op).symbol);
+  }
 
-    // Binary math scales to the higher precision of inputs.
-    if (op == "*" || op == "/" || op == "+" || op == "-")  {
-      if (GetChild(0).ReturnType(symbols).BitCount() > GetChild(1).ReturnType(symbols).BitCount()) {
-        return GetChild(0).ReturnType(symbols);
-      } else {
-        return GetChild(1).ReturnType(symbols);
-      }
-    }
+  OpCode Op() const { return op; }
 
-    return Type();
+  // Assignments use the type of the variable being assigned; comparisons and Boolean operations
+  // always return type int; binary math scales to the higher precision of inputs.
+  Type CalcReturnType(const SymbolTable & /* symbols */) const override {
+    return OpReturnType(op);
   }
+  type_inputs_t TypeInputs() const override { return OpTypeInputs(op); }
 
 
-  void TypeCheck(const SymbolTable & symbols) override {
+  void TypeCheck(const SymbolTable & /* symbols */) override {
     constexpr bool DEBUG = false;
+    const std::string_view symbol = GetOpCodeInfo(op).symbol;
 
     if (NumChildren() != 2) {
       Error(file_pos, "Internal error: Expected two children in ToDouble node, found ", NumChildren());
     }
 
-    // Resolve types of children before checking this node.
-    TypeCheckChildren(symbols);
-
-    const Type & type0 = GetChild(0).ReturnType(symbols);
-    const Type & type1 = GetChild(1).ReturnType(symbols);
+    // (Children have already been checked, so their types are resolved.)
+    const Type & type0 = GetChild(0).AnnotatedType();
+    const Type & type1 = GetChild(1).AnnotatedType();
 
     if constexpr (DEBUG) {
-      std::cerr << "TESTING OP '" << op << "' with types " << type0.Name() << " and " << type1.Name() << "." << std::endl;
+      std::cerr << "TESTING OP '" << symbol << "' with types " << type0.Name() << " and " << type1.Name() << "." << std::endl;
     }
 
     // Conduct tests based on the type of operator:
@@ -640,33 +768,33 @@ public:
                   PROMOTE0_STRING, PROMOTE1_STRING };
     Status status = INVALID;
     bool align_numeric = false;
-    if (op == "*") {
+    switch (GetOpCodeInfo(op).rule) {
+    case OpRule::MUL:
       if ((type0.IsInt()    && type1.IsInt()) ||
-          (type0.IsDouble() && type1.IsDouble() ||
-          (type0.IsString() && type1.IsInt()))) {
+          (type0.IsDouble() && type1.IsDouble()) ||
+          (type0.IsString() && type1.IsInt())) {
         status = OK;
       }
       else if (type0.IsInt() && type1.IsDouble()) status = PROMOTE0_DOUBLE;
       else if (type0.IsDouble() && type1.IsInt()) status = PROMOTE1_DOUBLE;
       else if (type0.IsChar() && type1.IsInt()) status = PROMOTE0_STRING;
-    }
-    else if (op == "/") {
+      break;
+    case OpRule::DIV:
       if ((type0.IsInt() && type1.IsInt()) ||
           (type0.IsDouble() && type1.IsDouble()) ) {
         status = OK;
       }
       else if (type0.IsInt() && type1.IsDouble()) status = PROMOTE0_DOUBLE;
       else if (type0.IsDouble() && type1.IsInt()) status = PROMOTE1_DOUBLE;
-    }
-    else if (op == "%" || op == "&&" || op == "||") {
+      break;
+    case OpRule::INT_ONLY:
       if (type0.IsInt() && type1.IsInt()) status = OK;
-    }
-    else if (op == "+" || op == "-" || 
-             op == "<" || op == "<=" || op == ">" || op == ">=" ||
-             op == "==" || op == "!=") {
+      break;
+    case OpRule::NUMERIC:
+    case OpRule::ADD:
       align_numeric = true;
-    }
-    else if (op == "=") {
+      break;
+    case OpRule::ASSIGN:
       // If both sides already match we're good.
       if (type0 == type1 && !type0.IsFunction())      status = OK;
 
@@ -674,10 +802,10 @@ public:
       else if (type0.IsDouble() && type1.IsNumeric()) status = PROMOTE1_DOUBLE;
       else if (type0.IsInt() && type1.IsChar())       status = PROMOTE1_INT;
       else if (type0.IsString() && type1.IsAlpha())     status = PROMOTE1_STRING;
-    }
-    else {
+      break;
+    default:
       // Internal error
-      Error(file_pos, "Unknown binary operator in AST: ", op);
+      Error(file_pos, "Unknown binary operator in AST: ", symbol);
     }
 
     // If we deferred aligning numeric types above, handle it now.
@@ -690,7 +818,7 @@ public:
     }
 
     // If we are adding characters or strings
-    if (op == "+" && type0.IsAlpha()) {
+    if (GetOpCodeInfo(op).rule == OpRule::ADD && type0.IsAlpha()) {
       if (type0 == type1)
         status = OK;
       else if (type0.IsString() && type1.IsChar())
@@ -715,7 +843,7 @@ public:
     // Resolve the current status.
     switch (status) {
     case INVALID: 
-      Error(file_pos, "Cannot use operator '", op, "' on types ", type0.Name(), " and ", type1.Name());
+      Error(file_pos, "Cannot use operator '", symbol, "' on types ", type0.Name(), " and ", type1.Name());
       break;
     case OK:              break;
     case PROMOTE0_INT:    AdaptChild<ASTNode_ToInt>(0);    break;
@@ -727,231 +855,256 @@ public:
     }
   }
 
-  void ToWAT_Assign(Control & control) {
-    if (!GetChild(0).CanAssign()) {
-      Error(file_pos, "Left-hand-side of assignment must be assignable.");
+  WATNext ToWAT_Assign(Control & /* control */, size_t step) {
+    switch (step) {
+    case 0:
+      if (!GetChild(0).CanAssign()) {
+        Error(file_pos, "Left-hand-side of assignment must be assignable.");
+      }
+      return WATNext::Child(1, true);      // Generate the value to assign
+    case 1: return WATNext::AssignChild(0);  // Do the assignment
+    case 2: return WATNext::Child(0, true);  // Place the current value of var on the stack.
     }
-    
-    ChildToWAT(1, control, true);      // Generate the value to assign
-    GetChild(0).ToAssignWAT(control);  // Do the assignment
-    ChildToWAT(0, control, true);      // Place the current value of var on the stack.
-  }
-
-  void ToWAT_AND(Control & control) {
-    control.CommentLine("Setup the && operation");
-    ChildToWAT(0, control, true); // First value sets the condition.
-    control.Code("(if (result i32)").Comment("Setup for && operator")
-           .Code("  (then").Indent(4);
-    ChildToWAT(1, control, true); // If first value was true, result is second value.
-    control.Code("(i32.const 0)").Comment("Put a zero on the stack for comparison)")
-           .Code("(i32.ne)").Comment("Set any non-zero value to one.)")
-           .Indent(-4)
-           .Code("  )")
-           .Code("  (else ")
-           .Code("    (i32.const 0)").Comment("First clause of && was false.")
-           .Code("  )")
-           .Code(")")
+    return WATNext::Done(true);
+  }
+
+  // The instruction for an operator, given whether its operands are doubles (or else i32s).
+  static const WasmOpInfo & GetWasmOp(OpCode op, bool is_double) {
+    static const auto table = [](){
+      std::array<std::array<const WasmOpInfo *, 2>, OP_CODE_TABLE.size()> out{};
+      for (size_t id = 0; id < OP_CODE_TABLE.size(); ++id) {
+        const OpCodeInfo & info = OP_CODE_TABLE[id];
+        if (info.wat.empty()) continue;
+        const std::string suffix = std::string(".") + std::string(info.wat);
+        out[id][0] = FindWasmOp("i32" + suffix + (info.sign_suffix ? "_s" : ""));
+        out[id][1] = FindWasmOp("f64" + suffix);
+      }
+      return out;
+    }();
+    const WasmOpInfo * wasm_op = table[static_cast<size_t>(op)][is_double];
+    assert(wasm_op);
+    return *wasm_op;
+  }
+
+  WATNext ToWAT_AND(Control & control, size_t step) {
+    if (step == 0) {
+      control.CommentLine("Setup the && operation");
+      return WATNext::Child(0, true); // First value sets the condition.
+    }
+    if (step == 1) {
+      control.If("i32").Comment("Setup for && operator")
+             .Indent(2).Then().Indent(2);
+      return WATNext::Child(1, true); // If first value was true, result is second value.
+    }
+    control.Op(WasmOp("i32.const"), 0).Comment("Put a zero on the stack for comparison)")
+           .Op(WasmOp("i32.ne")).Comment("Set any non-zero value to one.)")
+           .Indent(-2)
+           .End()
+           .Else()
+           .Indent(2)
+           .Op(WasmOp("i32.const"), 0).Comment("First clause of && was false.")
+           .Indent(-2)
+           .End()
+           .Indent(-2)
+           .End()
            .CommentLine("End of && operation");
+    return WATNext::Done(true);
   }
 
-  void ToWAT_OR(Control & control) {
-    control.CommentLine("Setup the || operation");
-    ChildToWAT(0, control, true); // First value sets the condition.
-    control.Code("(if (result i32)").Comment("Setup for || operator")
-           .Code("  (then")
-           .Code("    (i32.const 1)").Comment("First clause of || was true.")
-           .Code("  )")
-           .Code("  (else ")
-           .Indent(4);
-    ChildToWAT(1, control, true); // If first value was true, result is true.
-    control.Code("(i32.const 0)").Comment("Put a zero on the stack for comparison)")
-           .Code("(i32.ne)").Comment("Set any non-zero value to one.)")
-           .Indent(-4)
-           .Code("  )")
-           .Code(")")
+  WATNext ToWAT_OR(Control & control, size_t step) {
+    if (step == 0) {
+      control.CommentLine("Setup the || operation");
+      return WATNext::Child(0, true); // First value sets the condition.
+    }
+    if (step == 1) {
+      control.If("i32").Comment("Setup for || operator")
+             .Indent(2)
+             .Then()
+             .Indent(2)
+             .Op(WasmOp("i32.const"), 1).Comment("First clause of || was true.")
+             .Indent(-2)
+             .End()
+             .Else()
+             .Indent(2);
+      return WATNext::Child(1, true); // If first value was true, result is true.
+    }
+    control.Op(WasmOp("i32.const"), 0).Comment("Put a zero on the stack for comparison)")
+           .Op(WasmOp("i32.ne")).Comment("Set any non-zero value to one.)")
+           .Indent(-2)
+           .End()
+           .Indent(-2)
+           .End()
            .CommentLine("End of || operation");
+    return WATNext::Done(true);
   }
 
   void ToWAT_Multiply(Control & control) {
-    Type type = GetChild(0).ReturnType(control.symbols);
+    const Type & type = GetChild(0).AnnotatedType();
     if (type.IsNumeric()) {
       // Standard mathematical multiple.
-      control.Code("(", type.ToWAT(), ".mul)").Comment("Stack2 * Stack1");
+      control.Op(type.IsDouble() ? WasmOp("f64.mul") : WasmOp("i32.mul")).Comment("Stack2 * Stack1");
     }
     else if (type.IsString())
     {
       control.CommentLine("Setup string mult")
-        .Code("(call $_dupe_mem)");
+        .CallHelper("_dupe_mem");
     }
   }
 
   void ToWAT_Add(Control & control) {
-    Type type = GetChild(0).ReturnType(control.symbols);
+    const Type & type = GetChild(0).AnnotatedType();
     if (type.IsNumeric()) {
       // Standard mathematical addition.
-      control.Code("(", type.ToWAT(), ".add)").Comment("Stack2 + Stack1");
+      control.Op(type.IsDouble() ? WasmOp("f64.add") : WasmOp("i32.add")).Comment("Stack2 + Stack1");
     }
     else if (type.IsString())
     {
-      control.Code("(call $_str_concat)")
+      control.CallHelper("_str_concat")
         .Comment("concat new strings and return the newPosition");
     }
   }
 
-  /* For keepsake
-  void ToWAT_String(Control& control)
-  {
-    auto const& symbols = control.symbols;
-
-    if (op == "+")  // Expect only char or string
-    {
-      if (GetChild(1).ReturnType(symbols).IsAlpha()) // String concat
-      {
-        control.CommentLine("Setup String concatenation");
-        // Tell children to put themselves the stack
-        ChildToWAT(0, control, true);
-        ChildToWAT(1, control, true);
-        control.Code("(call $_str_concat)")
-        .Comment("concat new strings and return the newPosition");
-      }
-
-    }
-
-  }
-  */
-
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t step) override {
     assert(NumChildren() == 2);
 
     // If we are doing an assignment or boolean logic, we need to handle it specially.
-    if (op == "=") { ToWAT_Assign(control); return true; }
-    if (op == "&&") { ToWAT_AND(control); return true; }
-    if (op == "||") { ToWAT_OR(control); return true; }
-
-    ChildToWAT(0, control, true); // Calculate the first arg (so it's top of the stack)
-    ChildToWAT(1, control, true); // Calculate the second arg (so it's one down on the stack)
-
-    std::string type = GetChild(0).ReturnType(control.symbols).ToWAT();
-    std::string extra = (type == "i32") ? "_s" : "";
-
-    if (op == "*")  { ToWAT_Multiply(control); return true; }
-    if (op == "/")  { control.Code("(", type, ".div", extra, ")").Comment("Stack2 / Stack1"); return true; }
-    if (op == "%")  { control.Code("(", type, ".rem", extra, ")").Comment("Stack2 % Stack1"); return true; }
-    if (op == "+")  { ToWAT_Add(control); return true; }
-    if (op == "-")  { control.Code("(", type, ".sub)").Comment("Stack2 - Stack1"); return true; }
-
-    if (op == "<")  { control.Code("(", type, ".lt", extra, ")").Comment("Stack2 < Stack1"); return true; }
-    if (op == "<=") { control.Code("(", type, ".le", extra, ")").Comment("Stack2 <= Stack1"); return true; }
-    if (op == ">")  { control.Code("(", type, ".gt", extra, ")").Comment("Stack2 > Stack1"); return true; }
-    if (op == ">=") { control.Code("(", type, ".ge", extra, ")").Comment("Stack2 >= Stack1"); return true; }
-    if (op == "==") { control.Code("(", type, ".eq)").Comment("Stack2 == Stack1"); return true; }
-    if (op == "!=") { control.Code("(", type, ".ne)").Comment("Stack2 != Stack1"); return true; }
-
+    if (op == OpCode::ASSIGN) return ToWAT_Assign(control, step);
+    if (op == OpCode::AND) return ToWAT_AND(control, step);
+    if (op == OpCode::OR) return ToWAT_OR(control, step);
+
+    if (step == 0) return WATNext::Child(0, true); // Calculate the first arg (so it's top of the stack)
+    if (step == 1) return WATNext::Child(1, true); // Calculate the second arg (so it's one down on the stack)
+
+    switch (op) {
+    case OpCode::MUL: ToWAT_Multiply(control); return WATNext::Done(true);
+    case OpCode::ADD: ToWAT_Add(control);      return WATNext::Done(true);
+    case OpCode::DIV: case OpCode::MOD: case OpCode::SUB:
+    case OpCode::LESS: case OpCode::LESS_EQ: case OpCode::GREATER: case OpCode::GREATER_EQ:
+    case OpCode::EQUAL: case OpCode::NOT_EQUAL: {
+      const OpCodeInfo & info = GetOpCodeInfo(op);
+      control.Op(GetWasmOp(op, GetChild(0).AnnotatedType().IsDouble()))
+             .Comment("Stack2 ", info.symbol, " Stack1");
+      return WATNext::Done(true);
+    }
+    default:
+      break;
+    }
 
-    return false;
+    return WATNext::Done(false);
   }
 };
 
-class ASTNode_CharLit : public ASTNode {
+class ASTNode_CharLit final : public ASTNode {
 protected:
   int value = '\0';
 
 public:
   ASTNode_CharLit(FilePos file_pos, int value)
-    : ASTNode(file_pos), value(value) { }
+    : ASTNode(NodeKind::CHAR_LIT, file_pos), value(value) { }
 
   std::string GetTypeName() const override { return std::string("CHAR_LIT: ") + std::to_string(((int) value)); }
 
-  Type ReturnType(const SymbolTable & /* symbols */) const override {
+  int Value() const { return value; }
+
+  Type CalcReturnType(const SymbolTable & /* symbols */) const override {
     // For now, ops do not change the return type.
-    return Type("char");
+    return Type::Char();
   }
 
-  bool ToWAT(Control & control) override {
-    control.Code("(i32.const ", value, ")").Comment("Put a char \\", value, " on the stack");
-    return true;
+  WATNext ToWAT_Step(Control & control, size_t /* step */) override {
+    control.Op(WasmOp("i32.const"), value).Comment("Put a char \\", value, " on the stack");
+    return WATNext::Done(true);
   }
 };
 
-class ASTNode_IntLit : public ASTNode {
+class ASTNode_IntLit final : public ASTNode {
 protected:
   int value = 0.0;
 
 public:
   ASTNode_IntLit(FilePos file_pos, int value)
-    : ASTNode(file_pos), value(value) { }
+    : ASTNode(NodeKind::INT_LIT, file_pos), value(value) { }
 
   std::string GetTypeName() const override { return std::string("INT_LIT:") + std::to_string(value); }
 
-  Type ReturnType(const SymbolTable & /* symbols */) const override {
+  int Value() const { return value; }
+
+  Type CalcReturnType(const SymbolTable & /* symbols */) const override {
     // For now, ops do not change the return type.
-    return Type("int");
+    return Type::Int();
   }
 
-  bool ToWAT(Control & control) override {
-    control.Code("(i32.const ", value, ")").Comment("Put a ", value, " on the stack");
-    return true;
+  WATNext ToWAT_Step(Control & control, size_t /* step */) override {
+    control.Op(WasmOp("i32.const"), value).Comment("Put a ", value, " on the stack");
+    return WATNext::Done(true);
   }
 };
 
-class ASTNode_FloatLit : public ASTNode {
+class ASTNode_FloatLit final : public ASTNode {
 protected:
   double value = 0.0;
 
 public:
   ASTNode_FloatLit(FilePos file_pos, double value)
-    : ASTNode(file_pos), value(value) { }
+    : ASTNode(NodeKind::FLOAT_LIT, file_pos), value(value) { }
 
   std::string GetTypeName() const override { return "FLOAT_LIT"; }
 
-  Type ReturnType(const SymbolTable & /* symbols */) const override {
+  double Value() const { return value; }
+
+  Type CalcReturnType(const SymbolTable & /* symbols */) const override {
     // For now, ops do not change the return type.
-    return Type("double");
+    return Type::Double();
   }
 
-  bool ToWAT(Control & control) override {
-    control.Code("(f64.const ", value, ")").Comment("Put a ", value, " on the stack");
-    return true;
+  WATNext ToWAT_Step(Control & control, size_t /* step */) override {
+    // Show the shortest text that reads back as exactly this value (as the WAT does).
+    char buffer[32];
+    const std::string_view text(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+    control.Op(WasmOp("f64.const"), value).Comment("Put a ", text, " on the stack");
+    return WATNext::Done(true);
   }
 };
 
-class ASTNode_Var : public ASTNode {
+class ASTNode_Var final : public ASTNode {
 protected:
-  static constexpr size_t MAX_ID = 1000000;
-  size_t var_id = MAX_ID;
+  size_t var_id = SymbolTable::NO_ID;
 
-  void TestOK() const { assert(var_id < MAX_ID); }
+  void TestOK() const { assert(var_id != SymbolTable::NO_ID); }
 public:
-  ASTNode_Var(FilePos file_pos, size_t id) : ASTNode(file_pos), var_id(id) { TestOK(); }
+  ASTNode_Var(FilePos file_pos, size_t id) : ASTNode(NodeKind::VAR, file_pos), var_id(id) { TestOK(); }
   ASTNode_Var(const emplex::Token & token, SymbolTable & symbols)
-    : ASTNode(token), var_id(symbols.GetVarID(token.lexeme)) { TestOK(); }
+    : ASTNode(NodeKind::VAR, token), var_id(symbols.GetVarID(token)) { TestOK(); }
 
   std::string GetTypeName() const override { return std::string("VAR: ") + std::to_string(var_id); }
 
+  size_t VarID() const { return var_id; }
+
   bool CanAssign() const override { return true; }
-  void ToAssignWAT(Control & control) override {
+  WATNext ToAssignWAT_Step(Control & control, size_t /* step */) override {
     TestOK();
-    const std::string var_name = control.symbols.GetName(var_id);
-    control.Code("(local.set $var", var_id, ")").Comment("Set var '", var_name, "' from stack");
+    const std::string & var_name = control.symbols.GetName(var_id);
+    control.Local(WasmOp("local.set"), var_id).Comment("Set var '", var_name, "' from stack");
+    return WATNext::Done(false);
   }
 
-  Type ReturnType(const SymbolTable & symbols) const override {
+  Type CalcReturnType(const SymbolTable & symbols) const override {
     // For now, ops do not change the return type.
     TestOK();
     return symbols.GetType(var_id);
   }
 
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t /* step */) override {
     TestOK();
-    const std::string var_name = control.symbols.GetName(var_id);
+    const std::string & var_name = control.symbols.GetName(var_id);
 
-    control.Code("(local.get $var", var_id, ")").Comment("Place var '", var_name, "' onto stack");
-    return true;
+    control.Local(WasmOp("local.get"), var_id).Comment("Place var '", var_name, "' onto stack");
+    return WATNext::Done(true);
   }
 
 };
 
-class ASTNode_Function_Call : public ASTNode_Parent {
+class ASTNode_Function_Call final : public ASTNode_Parent {
   emplex::Token fun_token;
   size_t fun_id;
 
@@ -959,7 +1112,7 @@ class ASTNode_Function_Call : public ASTNode_Parent {
 public:
   
   ASTNode_Function_Call(emplex::Token fun_info, size_t fun_id)
-    : ASTNode_Parent(fun_info), fun_token(fun_info), fun_id(fun_id) {}
+    : ASTNode_Parent(NodeKind::FUNCTION_CALL, fun_info), fun_token(fun_info), fun_id(fun_id) {}
 
   // Function call guarantees a return. 
   // Might not terminate owning function though
@@ -969,47 +1122,56 @@ public:
     return "Function Call";
   }
 
-  bool ToWAT(Control& control) {
-    control.CommentLine("Function call: ", fun_token.lexeme, "() setup");
-    
-    Type fun_type = control.symbols.GetType(fun_id);
+  size_t FunID() const { return fun_id; }
 
-    for (size_t i = 0; i < NumChildren(); ++i) {
+  WATNext ToWAT_Step(Control & control, size_t step) override {
+    if (step == 0) control.CommentLine("Function call: ", fun_token.Lexeme(), "() setup");
+
+    if (step < NumChildren()) {
       // Error check that the correct type was passed into the function
-      if (GetChild(i).ReturnType(control.symbols) != fun_type.ParamType(i)) {
-        Error(fun_token, "Invalid type for param", i);
+      if (GetChild(step).AnnotatedType() != control.symbols.GetType(fun_id).ParamType(step)) {
+        Error(fun_token, "Invalid type for param", step);
       }
 
       // Put the argument on the stack for use
-      ChildToWAT(i, control, true);
+      return WATNext::Child(step, true);
     }
 
-    control.Code("(call $", fun_token.lexeme, ")")
-      .Comment("Call the function");
+    if (control.symbols.IsInbuilt(fun_id)) control.CallHelper(control.symbols.GetName(fun_id));
+    else control.Call(fun_token.Lexeme());
+    control.Comment("Call the function");
 
-    return true;  // Function calls always return a value
+    return WATNext::Done(true);  // Function calls always return a value
   }
 
-  Type ReturnType(const SymbolTable & symbols) const override {
+  Type CalcReturnType(const SymbolTable & symbols) const override {
     return symbols.GetType(fun_id).ReturnType();
   }
 
 };
 
-class ASTNode_StringLit : public ASTNode {
+class ASTNode_StringLit final : public ASTNode {
   std::string str;
   size_t pos;
+  bool fresh = false;   // Evaluate to a new copy each time (it stands in for a built string)?
 
 public:
 
-  ASTNode_StringLit(emplex::Token token) : ASTNode(token), str(token.lexeme) {
+  ASTNode_StringLit(emplex::Token token) : ASTNode(NodeKind::STRING_LIT, token), str(token.Lexeme()) {
     ReplaceAll(str, "\"", "");
   }
+  // Build from string contents as they appear in WAT (with any escapes already applied).
+  ASTNode_StringLit(FilePos file_pos, std::string str, bool fresh=false)
+    : ASTNode(NodeKind::STRING_LIT, file_pos), str(std::move(str)), fresh(fresh) { }
 
   std::string GetTypeName() const override { return "STRING_LIT"; }
 
-  Type ReturnType(const SymbolTable&) const override {
-    return Type("string");
+  const std::string & Value() const { return str; }
+  bool IsFresh() const { return fresh; }
+  void SetFresh(bool in) { fresh = in; }
+
+  Type CalcReturnType(const SymbolTable&) const override {
+    return Type::String();
   }
 
   void InitializeWAT(Control & control) override {
@@ -1017,50 +1179,59 @@ public:
   }
   
   
-  bool ToWAT(Control & control) override {
-    control.Code("(i32.const ", pos, ")")
+  WATNext ToWAT_Step(Control & control, size_t /* step */) override {
+    control.Op(WasmOp("i32.const"), static_cast<int32_t>(pos))
       .Comment("put the starting address of ", str, " on stack");
-    return true;
+    if (fresh) {   // Strings can be changed by index, so the data itself must not be shared.
+      control.Op(WasmOp("i32.const"), 1)
+        .CallHelper("_dupe_mem").Comment("copy the string");
+    }
+    return WATNext::Done(true);
   }
 
 };
 
-class ASTNode_Index : public ASTNode_Parent {
+class ASTNode_Index final : public ASTNode_Parent {
 public:
-  ASTNode_Index(ptr_t && child, ptr_t index) : ASTNode_Parent(child->GetFilePos(), child, index) { }
+  ASTNode_Index(ptr_t && child, ptr_t index) : ASTNode_Parent(NodeKind::INDEX, child->GetFilePos(), child, index) { }
 
   std::string GetTypeName() const override { return "Index"; }
 
-  Type ReturnType(const SymbolTable & symbols) const override {
-    auto child_type = GetChild(0).ReturnType(symbols);
-    if (child_type.IsString()) {return Type("char"); }
+  Type CalcReturnType(const SymbolTable & /* symbols */) const override {
+    const Type & child_type = GetChild(0).AnnotatedType();
+    if (child_type.IsString()) {return Type::Char(); }
 
     // You need to support that type
     Error(file_pos, "Unsupported indexable type");
 
     return Type(); // Unreached code
   }
+  type_inputs_t TypeInputs() const override { return { ChildPtr(0), nullptr }; }
 
   bool CanAssign() const override { return true; }
 
-  void ToAssignWAT(Control & control) override
+  WATNext ToAssignWAT_Step(Control & control, size_t step) override
   {
     assert(NumChildren() == 2);
-    control.CommentLine("Setup index assign operation");
-    ChildToWAT(0, control, true); // Put the variable's memory address on the stack
-    ChildToWAT(1, control, true); // Put the index number on the stack
-    control.Code("(i32.add)").Comment("Offset initial memory address")
-      .Code("(call $_i32swap)").Comment("Swap addr and item to store")
-      .Code("(i32.store8)").Comment("Assign");
+    switch (step) {
+    case 0:
+      control.CommentLine("Setup index assign operation");
+      return WATNext::Child(0, true); // Put the variable's memory address on the stack
+    case 1:
+      return WATNext::Child(1, true); // Put the index number on the stack
+    }
+    control.Op(WasmOp("i32.add")).Comment("Offset initial memory address")
+      .CallHelper("_i32swap").Comment("Swap addr and item to store")
+      .Op(WasmOp("i32.store8")).Comment("Assign");
+    return WATNext::Done(false);
   }
 
-  void TypeCheck(const SymbolTable & symbols) override {
+  void TypeCheck(const SymbolTable & /* symbols */) override {
     if (NumChildren() != 2) {
       Error(file_pos, "Internal error: Expected two children in Index node, found ", NumChildren());
     }
-    TypeCheckChildren(symbols);
-    const Type & var_type = GetChild(0).ReturnType(symbols);
-    const Type & index_type = GetChild(1).ReturnType(symbols);
+    const Type & var_type = GetChild(0).AnnotatedType();
+    const Type & index_type = GetChild(1).AnnotatedType();
     if (!var_type.IsIndexable()) {  // Maybe check that it's a variable?
       Error(file_pos, var_type.Name(), " is not indexable");
     }
@@ -1069,13 +1240,159 @@ public:
     }
   }
 
-  bool ToWAT(Control & control) override {
+  WATNext ToWAT_Step(Control & control, size_t step) override {
     assert(NumChildren() == 2);
-    control.CommentLine("Setup index operation");
-    ChildToWAT(0, control, true); // Put the variable's memory address on the stack
-    ChildToWAT(1, control, true); // Put the index number on the stack
-    control.Code("(i32.add)").Comment("Offset initial memory address")
-      .Code("(i32.load8_u)").Comment("now load the item");
-    return true;
+    switch (step) {
+    case 0:
+      control.CommentLine("Setup index operation");
+      return WATNext::Child(0, true); // Put the variable's memory address on the stack
+    case 1:
+      return WATNext::Child(1, true); // Put the index number on the stack
+    }
+    control.Op(WasmOp("i32.add")).Comment("Offset initial memory address")
+      .Op(WasmOp("i32.load8_u")).Comment("now load the item");
+    return WATNext::Done(true);
   }
 };
+
+// ---------- Tree walkers ----------
+
+// Call 'fun' on a node cast to its concrete class.  Every node class is final, so the calls that
+// 'fun' makes on it are resolved statically instead of through the vtable.
+template <typename NODE_T, typename FUN_T>
+decltype(auto) VisitNode(NODE_T & node, FUN_T && fun) {
+  static_assert(std::is_same_v<std::remove_const_t<NODE_T>, ASTNode>);
+  auto as = [&node](auto * type_ptr) -> auto & {
+    using cast_t = std::remove_pointer_t<decltype(type_ptr)>;
+    if constexpr (std::is_const_v<NODE_T>) return static_cast<const cast_t &>(node);
+    else return static_cast<cast_t &>(node);
+  };
+  switch (node.Kind()) {
+  case NodeKind::BLOCK:         return fun(as((ASTNode_Block *) nullptr));
+  case NodeKind::FUNCTION:      return fun(as((ASTNode_Function *) nullptr));
+  case NodeKind::IF:            return fun(as((ASTNode_If *) nullptr));
+  case NodeKind::WHILE:         return fun(as((ASTNode_While *) nullptr));
+  case NodeKind::RETURN:        return fun(as((ASTNode_Return *) nullptr));
+  case NodeKind::BREAK:         return fun(as((ASTNode_Break *) nullptr));
+  case NodeKind::CONTINUE:      return fun(as((ASTNode_Continue *) nullptr));
+  case NodeKind::TO_DOUBLE:     return fun(as((ASTNode_ToDouble *) nullptr));
+  case NodeKind::TO_INT:        return fun(as((ASTNode_ToInt *) nullptr));
+  case NodeKind::TO_STRING:     return fun(as((ASTNode_ToString *) nullptr));
+  case NodeKind::MATH1:         return fun(as((ASTNode_Math1 *) nullptr));
+  case NodeKind::MATH2:         return fun(as((ASTNode_Math2 *) nullptr));
+  case NodeKind::CHAR_LIT:      return fun(as((ASTNode_CharLit *) nullptr));
+  case NodeKind::INT_LIT:       return fun(as((ASTNode_IntLit *) nullptr));
+  case NodeKind::FLOAT_LIT:     return fun(as((ASTNode_FloatLit *) nullptr));
+  case NodeKind::VAR:           return fun(as((ASTNode_Var *) nullptr));
+  case NodeKind::FUNCTION_CALL: return fun(as((ASTNode_Function_Call *) nullptr));
+  case NodeKind::STRING_LIT:    return fun(as((ASTNode_StringLit *) nullptr));
+  case NodeKind::INDEX:         return fun(as((ASTNode_Index *) nullptr));
+  }
+  __builtin_unreachable();
+}
+
+inline void ASTNode::CalcTypes(const SymbolTable & symbols) const {
+  auto calc = [&symbols](const auto & n) { return n.CalcReturnType(symbols); };
+
+  // Usually the inputs are cached already (children are checked first), so no stack is needed.
+  const type_inputs_t inputs = VisitNode(*this, [](const auto & n) { return n.TypeInputs(); });
+  if ((!inputs[0] || inputs[0]->type_memo) && (!inputs[1] || inputs[1]->type_memo)) {
+    type_memo.emplace(VisitNode(*this, calc));
+    return;
+  }
+
+  std::vector<const ASTNode *> pending{this};
+  while (pending.size()) {
+    const ASTNode * node = pending.back();
+    if (node->type_memo) { pending.pop_back(); continue; }
+    bool inputs_ready = true;
+    const type_inputs_t inputs = VisitNode(*node, [](const auto & n) { return n.TypeInputs(); });
+    for (const ASTNode * input : inputs) {
+      if (input && !input->type_memo) { pending.push_back(input); inputs_ready = false; }
+    }
+    if (!inputs_ready) continue;
+    node->type_memo.emplace(VisitNode(*node, calc));
+    pending.pop_back();
+  }
+}
+
+// Type check a whole tree, annotating each node with its type.  This is a single bottom-up pass:
+// each node's children are checked (and annotated) before the node itself, so later passes can
+// simply read AnnotatedType().
+inline void TypeCheckTree(ASTNode & root, const SymbolTable & symbols) {
+  struct Frame { ASTNode * node; size_t next_child; };
+  auto check_first = [&symbols](auto & n) { n.TypeCheckFirst(symbols); };
+  std::vector<Frame> stack{{&root, 0}};
+  VisitNode(root, check_first);
+  while (stack.size()) {
+    Frame & frame = stack.back();
+    if (frame.next_child < frame.node->NumChildren()) {
+      ASTNode * child = frame.node->ChildPtr(frame.next_child++);
+      if (child) {
+        VisitNode(*child, check_first);
+        stack.push_back(Frame{child, 0});
+      }
+      continue;
+    }
+    frame.node->ResetReturnType();  // Children may have changed since any earlier type queries.
+    VisitNode(*frame.node, [&symbols](auto & n) { n.TypeCheck(symbols); });
+
+    // Annotate the node (and any conversion nodes its check inserted above its children).
+    for (size_t i = 0; i < frame.node->NumChildren(); ++i) {
+      if (frame.node->ChildPtr(i)) frame.node->ChildPtr(i)->ReturnType(symbols);
+    }
+    frame.node->ReturnType(symbols);
+    stack.pop_back();
+  }
+}
+
+// Run InitializeWAT() on every node of a tree, in order.
+inline void InitializeTreeWAT(ASTNode & root, Control & control) {
+  std::vector<ASTNode *> pending{&root};
+  while (pending.size()) {
+    ASTNode * node = pending.back();
+    pending.pop_back();
+    VisitNode(*node, [&control](auto & n) { n.InitializeWAT(control); });
+    for (size_t i = node->NumChildren(); i > 0; --i) {
+      if (node->ChildPtr(i-1)) pending.push_back(node->ChildPtr(i-1));
+    }
+  }
+}
+
+inline bool ASTNode::RunWAT(ASTNode & root, Control & control, bool assign) {
+  struct Frame {
+    ASTNode * node;
+    size_t step;
+    bool assign;      // Generating code to assign to this node (rather than read it)?
+    bool out_needed;  // Does the parent need a value from this node?
+  };
+  std::vector<Frame> stack{{&root, 0, assign, true}};
+  bool has_out = false;
+  while (stack.size()) {
+    Frame & frame = stack.back();
+    const size_t step = frame.step++;
+    const WATNext next = frame.assign
+      ? VisitNode(*frame.node, [&control, step](auto & n) { return n.ToAssignWAT_Step(control, step); })
+      : VisitNode(*frame.node, [&control, step](auto & n) { return n.ToWAT_Step(control, step); });
+    if (next.action != WATNext::DONE) {
+      assert(frame.node->ChildPtr(next.child));
+      stack.push_back(Frame{frame.node->ChildPtr(next.child), 0,
+                            next.action == WATNext::ASSIGN_CHILD, next.out_needed});
+      continue;
+    }
+
+    // This node is finished; make sure any value it left is one its parent wanted.
+    has_out = next.has_out;
+    const Frame done = frame;
+    stack.pop_back();
+    if (stack.empty() || done.assign) continue;
+    assert(!done.out_needed || has_out);  // If we need an out value, make sure one is provided.
+    if (!done.out_needed && has_out) {     // If we don't need an out value and one is provided, drop it.
+      control.Drop();
+    }
+  }
+  return has_out;
+}
+
+inline bool ASTNode::ToWAT(Control & control) { return RunWAT(*this, control, false); }
+inline void ASTNode::ToAssignWAT(Control & control) { RunWAT(*this, control, true); }
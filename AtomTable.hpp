@@ -0,0 +1,56 @@
+#pragma once
+
+// Identifier interning.
+//
+// Every distinct identifier is given a small integer "atom" the first time it is seen, so later
+// stages (such as the symbol table) can look names up by index instead of hashing strings.  The
+// lexer assigns atoms to identifier tokens as it hands them out; names are copied into the table,
+// so atoms stay valid after their source text is gone.
+//
+// Example usage:
+//   uint32_t atom = Atoms().Intern("count");
+//   Atoms().Intern("count") == atom;   // true
+//   Atoms().Name(atom);                // "count"
+
+#include <assert.h>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+class AtomTable {
+private:
+  std::deque<std::string> names{};                           // Deque, so names never move.
+  std::unordered_map<std::string_view, uint32_t> atom_map{};  // Keys view into 'names'.
+
+public:
+  static constexpr uint32_t NO_ATOM = static_cast<uint32_t>(-1);
+
+  size_t size() const { return names.size(); }
+
+  // Get the atom for a name, creating it if needed.
+  uint32_t Intern(std::string_view name) {
+    if (auto it = atom_map.find(name); it != atom_map.end()) return it->second;
+    const uint32_t atom = static_cast<uint32_t>(names.size());
+    atom_map.emplace(names.emplace_back(name), atom);
+    return atom;
+  }
+
+  // Get the atom for a name only if one already exists.
+  uint32_t Find(std::string_view name) const {
+    auto it = atom_map.find(name);
+    return (it == atom_map.end()) ? NO_ATOM : it->second;
+  }
+
+  const std::string & Name(uint32_t atom) const {
+    assert(atom < names.size());
+    return names[atom];
+  }
+};
+
+// All identifiers share a single table for the life of the program.
+inline AtomTable & Atoms() {
+  static AtomTable atoms;
+  return atoms;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+// Sharing of local slots between variables (an AST pass; see PassManager.hpp).
+//
+// Every declaration gets its own variable, so a function with many blocks and loops can end up
+// with hundreds of locals even though only a few are in use at any one time.  Liveness (see
+// Liveness.hpp) shows which variables interfere: a variable written while another is still live
+// cannot share that one's slot.  Parameters hold their arguments from the start, so they also
+// interfere with each other and with any variable that is read before it is written (which relies
+// on a local starting at zero).  Variables are then given the first slot of the same WAT type
+// that none of their interfering variables use, and only the slots in use are declared.
+//
+// Example usage:
+//   passes.Add("coalesce-locals", OPT_FULL, CoalesceLocals);
+
+#include <string>
+#include <vector>
+
+#include "ASTNode.hpp"
+#include "Liveness.hpp"
+#include "PassManager.hpp"
+#include "SymbolTable.hpp"
+
+// The pass itself.
+inline void CoalesceLocals(ASTNode_Function & fun, PassContext & context) {
+  SymbolTable & symbols = context.symbols;
+  if (fun.VarIDs().empty()) return;
+
+  const Liveness liveness(fun, symbols);
+  const size_t num_locals = liveness.NumVars();
+
+  // Which variables interfere with each one (by local id)?
+  std::vector<VarSet> interferes(num_locals, VarSet(num_locals));
+  auto Interfere = [&interferes](uint32_t var1, uint32_t var2) {
+    if (var1 == var2) return;
+    interferes[var1].Set(var2);
+    interferes[var2].Set(var1);
+  };
+  liveness.ForEachWrite([&Interfere](const Liveness::Event & write, const VarSet & live_after) {
+    live_after.ForEach([&](uint32_t var) { Interfere(write.var, var); });
+  });
+  for (size_t param_id : fun.ParamIDs()) {
+    const uint32_t param = symbols.GetLocalID(param_id);
+    liveness.LiveAtEntry().ForEach([&](uint32_t var) { Interfere(param, var); });
+    for (size_t other_id : fun.ParamIDs()) Interfere(param, symbols.GetLocalID(other_id));
+  }
+
+  // Slots in use so far: each one's type, and all of the variables in it.
+  struct Slot {
+    std::string type;
+    uint32_t local_id;
+    std::vector<uint32_t> members;
+  };
+  std::vector<Slot> slots;
+  for (size_t param_id : fun.ParamIDs()) {
+    const uint32_t param = symbols.GetLocalID(param_id);
+    slots.push_back(Slot{symbols.GetType(param_id).ToWAT(), param, {param}});
+  }
+
+  std::vector<size_t> vars = fun.ParamIDs();
+  for (size_t var_id : fun.VarIDs()) {
+    const uint32_t var = symbols.GetLocalID(var_id);
+    const std::string type = symbols.GetType(var_id).ToWAT();
+    Slot * found = nullptr;
+    for (Slot & slot : slots) {
+      if (slot.type != type) continue;
+      bool free = true;
+      for (uint32_t member : slot.members) free &= !interferes[var].Has(member);
+      if (free) { found = &slot; break; }
+    }
+    if (found) {
+      found->members.push_back(var);
+      symbols.SetLocalID(var_id, found->local_id);
+      context.Count("locals merged");
+    }
+    else {
+      slots.push_back(Slot{type, var, {var}});
+      vars.push_back(var_id);
+    }
+  }
+  fun.SetVars(vars);
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+// Buffered storage for generated WAT code.
+//
+// Lines are formatted straight into one growing character buffer (numbers with std::to_chars),
+// with only a small record of where each line's code and comment sit.  A line may instead hold an
+// instruction (see WasmInstr.hpp), which stays a record, open to rewriting, until its section is
+// finished; only then is its text printed.  When a section (such as a function) is finished, its
+// comments are aligned to the widest commented line in that section and the lines are laid out
+// into the final output, which is written with a single call.
+//
+// In compact mode, indentation and empty lines are left out of the output.  (Comments are never
+// requested in compact mode; see Control::Comment().)
+//
+// Example usage:
+//   CodeBuffer code;
+//   code.AddInstr(2, WasmInstr::Op(WasmOp("i32.const"), 5));
+//   code.SetComment("Put a ", 5, " on the stack");
+//   code.EndSection();
+//   code.Write(std::cout);
+
+#include <assert.h>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "WasmInstr.hpp"
+
+class CodeBuffer {
+private:
+  struct Line {
+    uint32_t indent;
+    size_t code_start;            // Text of the line; for an instruction, only its name (if any).
+    size_t code_size;
+    size_t comment_start = 0;
+    size_t comment_size = 0;
+    WasmInstr instr{};
+  };
+
+  std::string pending{};        // Code and comment text of the lines not yet laid out.
+  std::vector<Line> lines{};    // Lines not yet laid out.
+  std::string out{};            // Text that has been laid out.
+  bool compact = false;         // Leave out indentation and empty lines?
+
+  template <typename T>
+  void Append(const T & value) {
+    if constexpr (std::is_same_v<T, char>) pending.push_back(value);
+    else if constexpr (std::is_same_v<T, bool>) pending.push_back(value ? '1' : '0');
+    else if constexpr (std::is_arithmetic_v<T>) {
+      char buffer[32];
+      std::to_chars_result result;
+      if constexpr (std::is_integral_v<T>) result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+      else { // Match the default ostream format ("%g").
+        result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::general, 6);
+      }
+      pending.append(buffer, result.ptr);
+    }
+    else pending.append(std::string_view(value));
+  }
+
+  // Print an instruction's text at the end of the pending text.
+  void AppendInstr(const WasmInstr & instr, std::string_view name) {
+    switch (instr.kind) {
+    case WasmInstr::NONE: break;
+    case WasmInstr::OP:
+      Append('(');
+      Append(instr.op->name);
+      if (instr.HasName()) { Append(' '); Append(name); }
+      else if (instr.op->imm == WasmImm::I32) { Append(' '); Append(instr.value); }
+      else if (instr.op->imm == WasmImm::F64) {
+        // The shortest text that reads back as exactly this value.
+        char buffer[32];
+        Append(' ');
+        pending.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), instr.f64).ptr);
+      }
+      Append(')');
+      break;
+    case WasmInstr::BLOCK: Append("(block "); Append(name); break;
+    case WasmInstr::LOOP:  Append("(loop "); Append(name); break;
+    case WasmInstr::IF:
+      Append("(if");
+      if (instr.result) { Append(" (result "); Append(WasmValTypeName(instr.result)); Append(')'); }
+      break;
+    case WasmInstr::THEN: Append("(then"); break;
+    case WasmInstr::ELSE: Append("(else"); break;
+    case WasmInstr::END:  Append(')'); break;
+    }
+  }
+
+  // Replace each pending instruction with its text.
+  void PrintInstrs() {
+    std::string name;
+    for (Line & line : lines) {
+      if (line.instr.kind == WasmInstr::NONE) continue;
+      name.assign(pending, line.code_start, line.code_size);
+      line.code_start = pending.size();
+      AppendInstr(line.instr, name);
+      line.code_size = pending.size() - line.code_start;
+      line.instr = WasmInstr{};
+    }
+  }
+
+public:
+  size_t NumPendingLines() const { return lines.size(); }
+
+  bool IsCompact() const { return compact; }
+  void SetCompact(bool in=true) { compact = in; }
+
+  // Add a new line made of the provided values.
+  template <typename... Ts>
+  void AddLine(int indent, const Ts &... args) {
+    assert(indent >= 0);
+    const size_t start = pending.size();
+    (Append(args), ...);
+    lines.push_back(Line{static_cast<uint32_t>(indent), start, pending.size() - start});
+  }
+
+  // Add a new line holding an instruction; any name it uses (such as "$var2") is made of 'name'.
+  template <typename... Ts>
+  void AddInstr(int indent, const WasmInstr & instr, const Ts &... name) {
+    assert(instr.kind != WasmInstr::NONE);
+    assert(instr.HasName() == (sizeof...(Ts) > 0));
+    AddLine(indent, name...);
+    lines.back().instr = instr;
+  }
+
+  // Set the comment on a line that has not been laid out yet (replacing any it already had).
+  template <typename... Ts>
+  void SetLineComment(size_t id, const Ts &... args) {
+    assert(id < lines.size());
+    const size_t start = pending.size();
+    (Append(args), ...);
+    lines[id].comment_start = start;
+    lines[id].comment_size = pending.size() - start;
+  }
+
+  // Set the comment on the most recent line (replacing any it already had).
+  template <typename... Ts>
+  void SetComment(const Ts &... args) {
+    assert(lines.size());
+    SetLineComment(lines.size() - 1, args...);
+  }
+
+  // Instruction on a line that has not been laid out yet (kind NONE if there is none).
+  const WasmInstr & Instr(size_t id) const {
+    assert(id < lines.size());
+    return lines[id].instr;
+  }
+
+  // Instruction on the most recent line that has not been laid out yet.
+  const WasmInstr & LastInstr() const {
+    static const WasmInstr none{};
+    return lines.empty() ? none : lines.back().instr;
+  }
+
+  // Text on a line that has not been laid out yet (for an instruction, its name).
+  std::string_view LineCode(size_t id) const {
+    assert(id < lines.size());
+    return std::string_view(pending).substr(lines[id].code_start, lines[id].code_size);
+  }
+
+  // Give a line that has not been laid out yet a new instruction, using the same name (if any).
+  void SetInstr(size_t id, const WasmInstr & instr) {
+    assert(id < lines.size());
+    assert(lines[id].instr.kind != WasmInstr::NONE && instr.HasName() == lines[id].instr.HasName());
+    lines[id].instr = instr;
+  }
+
+  // Remove the lines not laid out yet that are marked in 'remove'.
+  void RemoveLines(const std::vector<bool> & remove) {
+    assert(remove.size() == lines.size());
+    size_t kept = 0;
+    for (size_t id = 0; id < lines.size(); ++id) {
+      if (!remove[id]) lines[kept++] = lines[id];
+    }
+    lines.resize(kept);
+  }
+
+  // Remove the most recent line; nothing is written after it, so its text is at the end.
+  void PopLine() {
+    assert(lines.size());
+    pending.resize(lines.back().code_start);
+    lines.pop_back();
+  }
+
+  // Position in the output where laid-out text can be inserted later (see InsertText).
+  size_t Mark() {
+    EndSection();
+    return out.size();
+  }
+
+  // Insert laid-out text at a position returned by Mark().
+  void InsertText(size_t mark, std::string_view text) {
+    EndSection();
+    assert(mark <= out.size());
+    out.insert(mark, text);
+  }
+
+  // Drop all pending lines without laying them out (when only their instructions are needed).
+  void DiscardSection() {
+    lines.clear();
+    pending.clear();
+  }
+
+  // Lay out all pending lines, aligning comments to the widest commented line among them.
+  void EndSection() {
+    PrintInstrs();
+    if (compact) {
+      for (const Line & line : lines) {
+        std::string_view code = std::string_view(pending).substr(line.code_start, line.code_size);
+        code.remove_prefix(std::min(code.find_first_not_of(' '), code.size()));
+        if (code.empty()) continue;
+        out.append(code);
+        out.push_back('\n');
+      }
+      lines.clear();
+      pending.clear();
+      return;
+    }
+
+    size_t max_width = 0;
+    for (const Line & line : lines) {
+      if (line.comment_size && line.code_size > max_width) max_width = line.code_size;
+    }
+
+    for (const Line & line : lines) {
+      out.append(line.indent, ' ');
+      out.append(pending, line.code_start, line.code_size);
+      if (line.comment_size) {
+        if (line.code_size) out.append(max_width - line.code_size + 2, ' ');
+        out.append(";; ");
+        out.append(pending, line.comment_start, line.comment_size);
+      }
+      out.push_back('\n');
+    }
+    lines.clear();
+    pending.clear();
+  }
+
+  // All code generated so far.
+  const std::string & Text() {
+    EndSection();
+    return out;
+  }
+
+  // Write out all code generated so far.
+  void Write(std::ostream & os) {
+    EndSection();
+    os.write(out.data(), static_cast<std::streamsize>(out.size()));
+    os.flush();
+  }
+};
@@ -1,9 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "CodeBuffer.hpp"
+#include "Peephole.hpp"
 #include "SymbolTable.hpp"
+#include "WasmEncoder.hpp"
 
 // A struct that contains all of the state information to control compilation.
 
@@ -19,15 +25,29 @@ struct Control {
   // Labels are made unique by adding a number to their end; track of what number we are up to!
   std::unordered_map<std::string, size_t> label_ids;
 
-  struct WAT_Line {
-    int indent;
-    std::string code;
-    std::string comment;
-  };
-  std::vector<WAT_Line> code;
+  // Runtime helpers (see Prelude.hpp) called by the generated code, without their '$'.
+  std::vector<std::string_view> used_helpers;
+
+  CodeBuffer code;
+  Peephole peephole;
+  bool use_peephole = false; // Rewrite each finished function with the peephole rules?
+  bool binary = false;       // Encode each function as it is finished, rather than printing it?
+  WasmEncoder wasm;          // The binary module (if binary is set).
 
 public:  // Member functions.
 
+  // Produce minimal WAT: no comments, indentation, or blank lines.
+  void Compact(bool in=true) { code.SetCompact(in); }
+
+  // Produce a binary module (see PrintWasm); WAT text is not needed, so it is kept compact.
+  void Binary(bool in=true) {
+    binary = in;
+    if (in) Compact();
+  }
+
+  // Clean up the instructions of each function as it is finished (see Peephole.hpp).
+  void UsePeephole(bool in=true) { use_peephole = in; }
+
   bool FinalNode() const { return final_node; }
   void FinalNode(bool in) { final_node = in; }
 
@@ -39,16 +59,67 @@ public:  // Member functions.
 
   // Provide code that should be printed.
   template <typename... Ts>
-  Control & Code(Ts &&... args) {
-    std::stringstream ss;
-    (ss << ... << std::forward<Ts>(args));
-    code.emplace_back(indent, ss.str(), "");
+  Control & Code(const Ts &... args) {
+    code.AddLine(indent, args...);
     return *this;
   }
 
+  // Provide an instruction (see WasmInstr.hpp); 'name' is made of any name it uses.
+  template <typename... Ts>
+  Control & Instr(const WasmInstr & instr, const Ts &... name) {
+    code.AddInstr(indent, instr, name...);
+    return *this;
+  }
+
+  Control & Op(const WasmOpInfo & op) {
+    assert(op.imm == WasmImm::NONE || op.imm == WasmImm::MEMARG);
+    return Instr(WasmInstr::Op(op));
+  }
+  Control & Op(const WasmOpInfo & op, int32_t value) {
+    assert(op.imm == WasmImm::I32);
+    return Instr(WasmInstr::Op(op, value));
+  }
+  Control & Op(const WasmOpInfo & op, double value) {
+    assert(op.imm == WasmImm::F64);
+    return Instr(WasmInstr::Op(op, value));
+  }
+  // An instruction that uses a label (such as "$exit3").
+  Control & Op(const WasmOpInfo & op, std::string_view label) {
+    assert(op.imm == WasmImm::LABEL);
+    return Instr(WasmInstr::Op(op), label);
+  }
+
+  // An instruction that uses a local variable, given its symbol id.
+  Control & Local(const WasmOpInfo & op, size_t var_id) {
+    assert(op.imm == WasmImm::LOCAL);
+    const uint32_t local_id = symbols.GetLocalID(var_id);
+    return Instr(WasmInstr::Op(op, static_cast<int32_t>(local_id)), "$var", local_id);
+  }
+
+  Control & Call(std::string_view name) { return Instr(WasmInstr::Op(WasmOp("call")), "$", name); }
+
+  // Structure: blocks and loops have labels; an if may leave a value (given its WAT type).
+  Control & Block(std::string_view label) { return Instr(WasmInstr::Structure(WasmInstr::BLOCK), label); }
+  Control & Loop(std::string_view label) { return Instr(WasmInstr::Structure(WasmInstr::LOOP), label); }
+  Control & If(std::string_view result="") {
+    return Instr(WasmInstr::Structure(WasmInstr::IF, result.size() ? WasmValType(result) : 0));
+  }
+  Control & Then() { return Instr(WasmInstr::Structure(WasmInstr::THEN)); }
+  Control & Else() { return Instr(WasmInstr::Structure(WasmInstr::ELSE)); }
+  Control & End() { return Instr(WasmInstr::Structure(WasmInstr::END)); }
+
+  // Call a runtime helper, noting that the module must include it.
+  Control & CallHelper(std::string_view name) {
+    if (std::find(used_helpers.begin(), used_helpers.end(), name) == used_helpers.end()) {
+      used_helpers.push_back(name);
+    }
+    return Call(name);
+  }
+
   // Add code for string data and return its memory position.
   size_t Data(std::string str) {
     Code("(data (i32.const ", wat_mem_pos ,") \"", str, "\\00\")");
+    if (binary) wasm.AddData(static_cast<uint32_t>(wat_mem_pos), str + "\\00");
     size_t out = wat_mem_pos;
     wat_mem_pos += str.size() + 1;
     return out;
@@ -57,53 +128,72 @@ public:  // Member functions.
   // Drop the top value on the stack.
   // Either remove the last instruction (if no side effects) or add a "(drop)"
   Control & Drop() {
-    if (code.back().code.starts_with("(local.get")) {
-      code.pop_back();
+    if (code.LastInstr().Is(WasmOp("local.get").code)) {
+      code.PopLine();
     } else {
-      code.emplace_back(indent, "(drop)", "Remove unneeded value from stack.");
+      Op(WasmOp("drop")).Comment("Remove unneeded value from stack.");
     }
     return *this;
   }
 
-  // Append a comment after the current line of code.
+  // Append a comment after the current line of code.  (Ignored when producing compact code.)
   template <typename... Ts>
-  Control & Comment(Ts &&... args) {
-    std::stringstream ss;
-    (ss << ... << std::forward<Ts>(args));
-    code.back().comment = ss.str();
+  Control & Comment(const Ts &... args) {
+    if (!code.IsCompact()) code.SetComment(args...);
     return *this;
   }
 
   // Special command for a whole-line comment that should indent with the code.
   template <typename... Ts>
-  Control & CommentLine(Ts &&... args) {
-    code.emplace_back(indent, "", "");
-    return Comment(std::forward<Ts>(args)...);
+  Control & CommentLine(const Ts &... args) {
+    if (code.IsCompact()) return *this;
+    code.AddLine(indent);
+    return Comment(args...);
   }
 
-  // Generate code to the provided output stream (cout by default)
-  void PrintCode(std::ostream & os=std::cout) const {
-    // First, process code to identify the widest line with a comment.
-    size_t max_width = 0;
-    for (const auto & line : code) {
-      if (line.comment.size() && line.code.size() > max_width) {
-        max_width = line.code.size();
-      }
+  // Start a function (whose code must end with EndFunction()), declaring its parameters.
+  void BeginFunction(std::string_view name, const std::vector<size_t> & param_ids,
+                     std::string_view result) {
+    std::string param_declare;
+    if (binary) wasm.BeginFunction(ToString("$", name), WasmValType(result));
+    for (size_t id : param_ids) {
+      param_declare += ToString(" (param $var", symbols.GetLocalID(id), " ", WATType(id), ")");
+      if (binary) wasm.AddParam(symbols.GetLocalID(id), WasmValType(WATType(id)));
     }
+    Code("(func $", name, param_declare, " (result ", result, ")");
+  }
+
+  // Finish the current function, exporting it under its own name.
+  Control & EndFunction(std::string_view name) {
+    Code(")").Comment("END '", name, "' function definition.")
+      .Code("")  // Skip a line.
+      .Code("(export \"", name, "\" (func $", name, "))")
+      .Code("");  // Skip a line.
+    if (use_peephole) peephole.Run(code);
+    if (binary) wasm.EndFunction(code, name);
+    return EndSection();
+  }
 
-    // Print code, line by line.
-    for (const auto & line : code) {
-      os << std::string(line.indent, ' '); // Tabbing
-      os << line.code;
-      if (line.comment.size()) {
-        if (line.code.size()) { // If there is code on this line, align comments.
-          size_t gap = max_width - line.code.size() + 2;
-          os << std::string(gap, ' ');
-        }
-        os << ";; " << line.comment;
-      }
-      os << std::endl;
+  // Finish a section of code (such as a function); comments are aligned within each section.
+  Control & EndSection() {
+    if (binary) {   // Only the encoded functions are needed.
+      code.DiscardSection();
+      return *this;
     }
+    code.EndSection();
+    return *this;
+  }
+
+  // Generate code to the provided output stream (cout by default)
+  void PrintCode(std::ostream & os=std::cout) { code.Write(os); }
+
+  // Write the binary WebAssembly module to the provided output stream; prelude functions are
+  // placed ahead of those in the code.
+  void PrintWasm(std::ostream & os=std::cout, std::span<const WasmFunction> prelude={}) {
+    assert(binary);
+    const std::string bytes = wasm.Link(prelude, static_cast<int32_t>(wat_mem_pos));
+    os.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    os.flush();
   }
 
   // Add a unique number to the end of any label base provided.
@@ -143,7 +233,8 @@ public:  // Member functions.
     // All local symbols must be declared at the beginning of the function.
     CommentLine("Variables");
     for (size_t i : var_ids) {
-      Code("(local $var", i, " ", WATType(i), ")").Comment("Variable: ", symbols.GetName(i));
+      Code("(local $var", symbols.GetLocalID(i), " ", WATType(i), ")").Comment("Variable: ", symbols.GetName(i));
+      if (binary) wasm.AddLocal(symbols.GetLocalID(i), WasmValType(WATType(i)));
     }
     Code("");
   }
@@ -0,0 +1,213 @@
+#pragma once
+
+// Dead code elimination (an AST pass; see PassManager.hpp).
+//
+// Branches that can never run are removed: an if with a literal condition is replaced by the
+// branch it takes, and while (0) disappears.  Statements that cannot run (after a break, continue,
+// or return) or that do nothing (expressions with no side effects, and ifs with only empty
+// branches) are dropped.  Liveness (see Liveness.hpp) then finds stores to variables that are
+// never read again; each becomes just its value, which is dropped in turn if nothing else needs
+// it.  Finally, locals that no code refers to are left out of the function header.
+//
+// Example usage:
+//   passes.Add("dead-code", OPT_ALL, EliminateDeadCode);
+
+#include <optional>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "ASTNode.hpp"
+#include "Liveness.hpp"
+#include "PassManager.hpp"
+#include "SymbolTable.hpp"
+
+class DeadCodeEliminator {
+private:
+  PassContext & context;
+  std::unordered_set<const ASTNode *> dead_stores{};
+  size_t num_changes = 0;     // Changes made during the current walk over the tree.
+
+  void Count(std::string_view counter) {
+    context.Count(counter);
+    ++num_changes;
+  }
+
+  // Can this statement be left out without changing what the program does?  Unlike
+  // HasSideEffects(), control flow counts too: a loop may never end, and jumps go elsewhere.
+  static bool IsRemovable(const ASTNode & root) {
+    if (HasSideEffects(root)) return false;
+    std::vector<const ASTNode *> pending{&root};
+    while (pending.size()) {
+      const ASTNode * node = pending.back();
+      pending.pop_back();
+      switch (node->Kind()) {
+      case NodeKind::WHILE:
+      case NodeKind::BREAK:
+      case NodeKind::CONTINUE:
+      case NodeKind::RETURN:
+        return false;
+      default:
+        break;
+      }
+      for (size_t i = 0; i < node->NumChildren(); ++i) {
+        if (node->ChildPtr(i)) pending.push_back(node->ChildPtr(i));
+      }
+    }
+    return true;
+  }
+
+  static bool IsEmptyBlock(const ASTNode & node) {
+    return node.Kind() == NodeKind::BLOCK && node.NumChildren() == 0;
+  }
+
+  // Does nothing after this statement in the same block run?
+  static bool EndsBlock(const ASTNode & node) {
+    return node.Kind() == NodeKind::BREAK || node.Kind() == NodeKind::CONTINUE || node.IsReturn();
+  }
+
+  static std::optional<int> GetCondition(const ASTNode & node) {
+    if (node.Kind() == NodeKind::INT_LIT) return static_cast<const ASTNode_IntLit &>(node).Value();
+    if (node.Kind() == NodeKind::CHAR_LIT) return static_cast<const ASTNode_CharLit &>(node).Value();
+    return std::nullopt;
+  }
+
+  ASTNode::ptr_t MakeEmptyBlock(const ASTNode & old_node) {
+    return context.Make<ASTNode_Block>(old_node.GetFilePos());
+  }
+
+  // A node changed in place; returning it makes its parent refresh its type as well.
+  ASTNode::ptr_t Changed(ASTNode & node) {
+    node.ResetReturnType();
+    node.ReturnType(context.symbols);
+    return ASTNode::ptr_t(&node);
+  }
+
+  // Replace a statement that does nothing, held by an if or a while, with an empty block.
+  bool ClearStatement(ASTNode_Parent & parent, size_t id) {
+    ASTNode & child = parent.GetChild(id);
+    if (IsEmptyBlock(child) || !IsRemovable(child)) return false;
+    parent.ReplaceChild(id, MakeEmptyBlock(child));
+    Count("statements removed");
+    return true;
+  }
+
+  ASTNode::ptr_t SimplifyBlock(ASTNode_Block & block) {
+    bool changed = false;
+    for (size_t i = 0; i < block.NumChildren(); ++i) {
+      if (EndsBlock(block.GetChild(i))) {
+        while (block.NumChildren() > i + 1) {
+          block.RemoveChild(i + 1);
+          Count("statements removed");
+          changed = true;
+        }
+      }
+      else if (IsRemovable(block.GetChild(i))) {
+        block.RemoveChild(i--);
+        Count("statements removed");
+        changed = true;
+      }
+    }
+    return changed ? Changed(block) : nullptr;
+  }
+
+  ASTNode::ptr_t SimplifyIf(ASTNode_If & node) {
+    if (auto condition = GetCondition(node.GetChild(0))) {
+      Count("branches removed");
+      if (*condition) return ASTNode::ptr_t(&node.GetChild(1));
+      if (node.NumChildren() == 3) return ASTNode::ptr_t(&node.GetChild(2));
+      return MakeEmptyBlock(node);
+    }
+
+    bool changed = ClearStatement(node, 1);
+    if (node.NumChildren() == 3) {
+      changed |= ClearStatement(node, 2);
+      if (IsEmptyBlock(node.GetChild(2))) {
+        node.RemoveChild(2);
+        changed = true;
+      }
+    }
+    if (IsEmptyBlock(node.GetChild(1)) && node.NumChildren() == 2 && IsRemovable(node.GetChild(0))) {
+      Count("branches removed");
+      return MakeEmptyBlock(node);
+    }
+    return changed ? Changed(node) : nullptr;
+  }
+
+  ASTNode::ptr_t SimplifyWhile(ASTNode_While & node) {
+    auto condition = GetCondition(node.GetChild(0));
+    if (condition && *condition == 0) {
+      Count("branches removed");
+      return MakeEmptyBlock(node);
+    }
+    return ClearStatement(node, 1) ? Changed(node) : nullptr;
+  }
+
+  // A store nobody reads only needs its value (which may still be used, as in y = (x = 5)).
+  ASTNode::ptr_t RemoveStore(ASTNode & node) {
+    ASTNode & value = *node.ChildPtr(1);
+    if (value.AnnotatedType() != node.AnnotatedType()) return nullptr;
+    Count("dead stores removed");
+    return ASTNode::ptr_t(&value);
+  }
+
+  // Find assignments whose variable is not live right after them.
+  void FindDeadStores(const ASTNode_Function & fun) {
+    dead_stores.clear();
+    Liveness liveness(fun, context.symbols);
+    liveness.ForEachWrite([this](const Liveness::Event & write, const VarSet & live_after) {
+      if (!live_after.Has(write.var)) dead_stores.insert(write.node);
+    });
+  }
+
+  // Leave out any local variables (but not parameters) that are never mentioned.
+  void RemoveUnusedLocals(ASTNode_Function & fun) {
+    std::unordered_set<size_t> used;
+    std::vector<const ASTNode *> pending{&fun};
+    while (pending.size()) {
+      const ASTNode * node = pending.back();
+      pending.pop_back();
+      if (node->Kind() == NodeKind::VAR) used.insert(static_cast<const ASTNode_Var *>(node)->VarID());
+      for (size_t i = 0; i < node->NumChildren(); ++i) {
+        if (node->ChildPtr(i)) pending.push_back(node->ChildPtr(i));
+      }
+    }
+
+    std::vector<size_t> vars = fun.ParamIDs();
+    for (size_t id : fun.VarIDs()) {
+      if (used.count(id)) vars.push_back(id);
+      else context.Count("locals removed");
+    }
+    fun.SetVars(vars);
+  }
+
+public:
+  DeadCodeEliminator(PassContext & context) : context(context) { }
+
+  // Return a replacement for a node, or nullptr to keep it.
+  ASTNode::ptr_t Simplify(ASTNode & node) {
+    switch (node.Kind()) {
+    case NodeKind::BLOCK: return SimplifyBlock(static_cast<ASTNode_Block &>(node));
+    case NodeKind::IF:    return SimplifyIf(static_cast<ASTNode_If &>(node));
+    case NodeKind::WHILE: return SimplifyWhile(static_cast<ASTNode_While &>(node));
+    case NodeKind::MATH2: return dead_stores.count(&node) ? RemoveStore(node) : nullptr;
+    default:              return nullptr;
+    }
+  }
+
+  void Run(ASTNode_Function & fun) {
+    // Removing a store or a statement can leave an earlier store dead, so repeat until stable.
+    do {
+      FindDeadStores(fun);
+      num_changes = 0;
+      RewriteTree(fun, context.symbols, [this](ASTNode & node) { return Simplify(node); });
+    } while (num_changes);
+    RemoveUnusedLocals(fun);
+  }
+};
+
+// The pass itself.
+inline void EliminateDeadCode(ASTNode_Function & fun, PassContext & context) {
+  DeadCodeEliminator eliminator(context);
+  eliminator.Run(fun);
+}
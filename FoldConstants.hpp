@@ -0,0 +1,235 @@
+#pragma once
+
+// Constant folding and algebraic simplification (an AST pass; see PassManager.hpp).
+//
+// Operators and conversions whose operands are all literals are evaluated at compile time, with
+// the same results WebAssembly would produce at run time: i32 math wraps around, comparisons and
+// division are signed, and f64 math rounds identically (a C++ double is an IEEE-754 binary64).
+// Anything that would trap (an i32 division by zero, INT_MIN / -1, or truncating an out-of-range
+// double to an int) is left in place so it still traps.  Identities such as x*1, x+0, x-0, x/1,
+// and x&&1 are then reduced to their operand.
+//
+// Example usage:
+//   passes.Add("fold-constants", OPT_ALL, FoldConstants);
+
+#include <cmath>
+#include <cstdint>
+#include <optional>
+
+#include "ASTNode.hpp"
+#include "PassManager.hpp"
+#include "SymbolTable.hpp"
+#include "Type.hpp"
+
+class ConstantFolder {
+private:
+  // The value of a literal; chars and ints both live in 'i', as they do in an i32.
+  struct Value {
+    int32_t i = 0;
+    double d = 0.0;
+  };
+
+  PassContext & context;
+
+  static std::optional<Value> GetValue(const ASTNode & node) {
+    switch (node.Kind()) {
+    case NodeKind::CHAR_LIT:  return Value{static_cast<const ASTNode_CharLit &>(node).Value(), 0.0};
+    case NodeKind::INT_LIT:   return Value{static_cast<const ASTNode_IntLit &>(node).Value(), 0.0};
+    case NodeKind::FLOAT_LIT: return Value{0, static_cast<const ASTNode_FloatLit &>(node).Value()};
+    default:                  return std::nullopt;
+    }
+  }
+
+  static bool IsIntValue(const ASTNode & node, int32_t value) {
+    auto in = GetValue(node);
+    return in && !node.AnnotatedType().IsDouble() && in->i == value;
+  }
+  // The sign counts too: x - 0.0 is x, but x - -0.0 is +0.0 when x is -0.0.
+  static bool IsDoubleValue(const ASTNode & node, double value) {
+    auto in = GetValue(node);
+    return in && node.AnnotatedType().IsDouble() && in->d == value
+      && std::signbit(in->d) == std::signbit(value);
+  }
+
+  // i32 arithmetic wraps around.
+  static int32_t Wrap(uint32_t value) { return static_cast<int32_t>(value); }
+
+  ASTNode::ptr_t MakeLiteral(const ASTNode & old_node, Value value) {
+    const Type & type = old_node.AnnotatedType();
+    context.Count("constants folded");
+    if (type.IsDouble()) return context.Make<ASTNode_FloatLit>(old_node.GetFilePos(), value.d);
+    if (type.IsChar())   return context.Make<ASTNode_CharLit>(old_node.GetFilePos(), value.i);
+    return context.Make<ASTNode_IntLit>(old_node.GetFilePos(), value.i);
+  }
+
+  // Replace a node with one of its own operands.
+  ASTNode::ptr_t Simplify(const ASTNode & old_node, ASTNode & operand) {
+    if (operand.AnnotatedType() != old_node.AnnotatedType()) return nullptr;
+    context.Count("identities simplified");
+    return ASTNode::ptr_t(&operand);
+  }
+
+  // Is this int already 0 or 1?
+  static bool IsBoolean(const ASTNode & node) {
+    if (node.Kind() == NodeKind::MATH1) return static_cast<const ASTNode_Math1 &>(node).Op() == OpCode::NOT;
+    if (node.Kind() == NodeKind::MATH2) {
+      const OpCode op = static_cast<const ASTNode_Math2 &>(node).Op();
+      return op >= OpCode::LESS && op <= OpCode::OR;
+    }
+    return IsIntValue(node, 0) || IsIntValue(node, 1);
+  }
+
+  // Reduce an int to 0 or 1, as && and || do.
+  ASTNode::ptr_t MakeBoolean(const ASTNode & old_node, ASTNode & operand) {
+    context.Count("identities simplified");
+    if (IsBoolean(operand)) return ASTNode::ptr_t(&operand);
+    return context.Make<ASTNode_Math2>(old_node.GetFilePos(), OpCode::NOT_EQUAL, ASTNode::ptr_t(&operand),
+                                       context.Make<ASTNode_IntLit>(operand.GetFilePos(), 0));
+  }
+
+  std::optional<Value> FoldMath1(OpCode op, const Type & type, Value in) {
+    switch (op) {
+    case OpCode::NOT:    return Value{in.i == 0, 0.0};
+    case OpCode::NEGATE: // Emitted as 0 - x, so -(0.0) is +0.0.
+      if (type.IsDouble()) return Value{0, 0.0 - in.d};
+      return Value{Wrap(0u - static_cast<uint32_t>(in.i)), 0.0};
+    case OpCode::SQRT:   return Value{0, std::sqrt(in.d)};
+    default:             return std::nullopt;
+    }
+  }
+
+  std::optional<Value> FoldMath2(OpCode op, const Type & type, Value in0, Value in1) {
+    if (type.IsDouble()) {
+      const double a = in0.d, b = in1.d;
+      switch (op) {
+      case OpCode::ADD:        return Value{0, a + b};
+      case OpCode::SUB:        return Value{0, a - b};
+      case OpCode::MUL:        return Value{0, a * b};
+      case OpCode::DIV:        return Value{0, a / b};
+      case OpCode::LESS:       return Value{a < b, 0.0};
+      case OpCode::LESS_EQ:    return Value{a <= b, 0.0};
+      case OpCode::GREATER:    return Value{a > b, 0.0};
+      case OpCode::GREATER_EQ: return Value{a >= b, 0.0};
+      case OpCode::EQUAL:      return Value{a == b, 0.0};
+      case OpCode::NOT_EQUAL:  return Value{a != b, 0.0};
+      default:                 return std::nullopt;
+      }
+    }
+
+    const int32_t a = in0.i, b = in1.i;
+    const uint32_t ua = static_cast<uint32_t>(a), ub = static_cast<uint32_t>(b);
+    const bool overflow = (a == INT32_MIN && b == -1);
+    switch (op) {
+    case OpCode::ADD:        return Value{Wrap(ua + ub), 0.0};
+    case OpCode::SUB:        return Value{Wrap(ua - ub), 0.0};
+    case OpCode::MUL:        return Value{Wrap(ua * ub), 0.0};
+    case OpCode::DIV:        // i32.div_s traps on both.
+      if (b == 0 || overflow) return std::nullopt;
+      return Value{a / b, 0.0};
+    case OpCode::MOD:        // i32.rem_s only traps on zero.
+      if (b == 0) return std::nullopt;
+      return Value{overflow ? 0 : a % b, 0.0};
+    case OpCode::LESS:       return Value{a < b, 0.0};
+    case OpCode::LESS_EQ:    return Value{a <= b, 0.0};
+    case OpCode::GREATER:    return Value{a > b, 0.0};
+    case OpCode::GREATER_EQ: return Value{a >= b, 0.0};
+    case OpCode::EQUAL:      return Value{a == b, 0.0};
+    case OpCode::NOT_EQUAL:  return Value{a != b, 0.0};
+    case OpCode::AND:        return Value{a != 0 && b != 0, 0.0};
+    case OpCode::OR:         return Value{a != 0 || b != 0, 0.0};
+    default:                 return std::nullopt;
+    }
+  }
+
+  // Simplify an operator with exactly one literal operand.
+  ASTNode::ptr_t Reduce(ASTNode_Math2 & node) {
+    ASTNode & lhs = node.GetChild(0);
+    ASTNode & rhs = node.GetChild(1);
+    const bool is_double = lhs.AnnotatedType().IsDouble();
+    switch (node.Op()) {
+    case OpCode::ADD:   // x + 0.0 is not x when x is -0.0, so only i32 qualifies.
+      if (is_double) break;
+      if (IsIntValue(rhs, 0)) return Simplify(node, lhs);
+      if (IsIntValue(lhs, 0)) return Simplify(node, rhs);
+      break;
+    case OpCode::SUB:
+      if (IsIntValue(rhs, 0) || IsDoubleValue(rhs, 0.0)) return Simplify(node, lhs);
+      break;
+    case OpCode::MUL:
+      if (IsIntValue(rhs, 1) || IsDoubleValue(rhs, 1.0)) return Simplify(node, lhs);
+      if (IsIntValue(lhs, 1) || IsDoubleValue(lhs, 1.0)) return Simplify(node, rhs);
+      if (IsIntValue(rhs, 0) && !HasSideEffects(lhs)) return Simplify(node, rhs);
+      if (IsIntValue(lhs, 0) && !HasSideEffects(rhs)) return Simplify(node, lhs);
+      break;
+    case OpCode::DIV:
+      if (IsIntValue(rhs, 1) || IsDoubleValue(rhs, 1.0)) return Simplify(node, lhs);
+      break;
+    case OpCode::AND:   // The right side only runs if the left is true.
+      if (IsIntValue(lhs, 0)) return Simplify(node, lhs);
+      if (GetValue(lhs)) return MakeBoolean(node, rhs);
+      if (IsIntValue(rhs, 0) && !HasSideEffects(lhs)) return Simplify(node, rhs);
+      if (GetValue(rhs) && !IsIntValue(rhs, 0)) return MakeBoolean(node, lhs);
+      break;
+    case OpCode::OR:
+      if (IsIntValue(lhs, 0)) return MakeBoolean(node, rhs);
+      if (GetValue(lhs)) return MakeLiteral(node, Value{1, 0.0});
+      if (IsIntValue(rhs, 0)) return MakeBoolean(node, lhs);
+      if (GetValue(rhs) && !HasSideEffects(lhs)) return MakeLiteral(node, Value{1, 0.0});
+      break;
+    default:
+      break;
+    }
+    return nullptr;
+  }
+
+public:
+  ConstantFolder(PassContext & context) : context(context) { }
+
+  // Return a replacement for a node, or nullptr to keep it.
+  ASTNode::ptr_t Fold(ASTNode & node) {
+    switch (node.Kind()) {
+    case NodeKind::MATH1: {
+      auto & math = static_cast<ASTNode_Math1 &>(node);
+      auto in = GetValue(math.GetChild(0));
+      if (!in) return nullptr;
+      auto out = FoldMath1(math.Op(), math.GetChild(0).AnnotatedType(), *in);
+      return out ? MakeLiteral(node, *out) : nullptr;
+    }
+    case NodeKind::MATH2: {
+      auto & math = static_cast<ASTNode_Math2 &>(node);
+      const Type & type = math.GetChild(0).AnnotatedType();
+      if (math.Op() == OpCode::ASSIGN || !type.IsNumeric()) return nullptr;
+      auto in0 = GetValue(math.GetChild(0));
+      auto in1 = GetValue(math.GetChild(1));
+      if (!in0 && !in1) return nullptr;
+      if (!in0 || !in1) return Reduce(math);
+      auto out = FoldMath2(math.Op(), type, *in0, *in1);
+      return out ? MakeLiteral(node, *out) : nullptr;
+    }
+    case NodeKind::TO_DOUBLE: {
+      ASTNode & child = *node.ChildPtr(0);
+      auto in = GetValue(child);
+      if (!in) return nullptr;
+      if (child.AnnotatedType().IsDouble()) return Simplify(node, child);
+      return MakeLiteral(node, Value{0, static_cast<double>(in->i)});
+    }
+    case NodeKind::TO_INT: {
+      ASTNode & child = *node.ChildPtr(0);
+      auto in = GetValue(child);
+      if (!in) return nullptr;
+      if (!child.AnnotatedType().IsDouble()) return MakeLiteral(node, *in);
+      // i32.trunc_f64_s traps on NaN and on anything that does not fit.
+      if (!(in->d > -2147483649.0 && in->d < 2147483648.0)) return nullptr;
+      return MakeLiteral(node, Value{static_cast<int32_t>(std::trunc(in->d)), 0.0});
+    }
+    default:
+      return nullptr;
+    }
+  }
+};
+
+// The pass itself.
+inline void FoldConstants(ASTNode_Function & fun, PassContext & context) {
+  ConstantFolder folder(context);
+  RewriteTree(fun, context.symbols, [&folder](ASTNode & node) { return folder.Fold(node); });
+}
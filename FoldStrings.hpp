@@ -0,0 +1,141 @@
+#pragma once
+
+// Compile-time folding of string expressions (an AST pass; see PassManager.hpp).
+//
+// Concatenations of string and char literals ("abc" + "def", 'x' + "yz"), repetition of a
+// literal ("-" * 40), and size() of a literal are computed here, so the result is a single data
+// segment (or an i32.const) instead of runtime calls to $_str_concat, $_char_to_string,
+// $_dupe_mem, or $size, each of which allocates or loops.  A built string is new each time it is
+// evaluated and may be changed by index (s[0] = 'x'), so a folded string is still copied out of
+// its data segment on every evaluation; only the work of building it is saved.  Repetitions are
+// only folded while the result stays small, so a large count does not bloat the data section.
+//
+// Example usage:
+//   passes.Add("fold-strings", OPT_ALL, FoldStrings);
+
+#include <cctype>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "ASTNode.hpp"
+#include "PassManager.hpp"
+#include "SymbolTable.hpp"
+
+class StringFolder {
+private:
+  static constexpr size_t MAX_REPEAT_SIZE = 1024;   // Longest string "s" * n is folded into.
+
+  PassContext & context;
+
+  // Literal text (in WAT form) for a string or char literal.
+  static std::optional<std::string> GetText(const ASTNode & node) {
+    if (node.Kind() == NodeKind::STRING_LIT) return static_cast<const ASTNode_StringLit &>(node).Value();
+    if (node.Kind() != NodeKind::TO_STRING || node.ChildPtr(0)->Kind() != NodeKind::CHAR_LIT) {
+      return std::nullopt;
+    }
+    // $_char_to_string stores the low byte; a null would end the string early, so leave it be.
+    const int value = static_cast<const ASTNode_CharLit *>(node.ChildPtr(0))->Value() & 0xFF;
+    if (value == 0) return std::nullopt;
+    if (value >= ' ' && value <= '~' && value != '"' && value != '\\') return std::string(1, value);
+    constexpr const char * HEX = "0123456789abcdef";
+    return std::string{'\\', HEX[value >> 4], HEX[value & 15]};
+  }
+
+  // Number of bytes a WAT string holds, if it can be worked out.
+  static std::optional<size_t> TextSize(const std::string & text) {
+    auto IsHex = [](char c) { return std::isxdigit(static_cast<unsigned char>(c)); };
+    size_t size = 0;
+    for (size_t i = 0; i < text.size(); ++i, ++size) {
+      if (text[i] != '\\') continue;
+      if (i + 1 >= text.size()) return std::nullopt;
+      const char next = text[++i];
+      if (IsHex(next) && i + 1 < text.size() && IsHex(text[i+1])) {
+        if (next == '0' && text[i+1] == '0') return std::nullopt;   // Embedded null.
+        ++i;
+      }
+      else if (next != 'n' && next != 't' && next != '\\' && next != '"' && next != '\'') {
+        return std::nullopt;
+      }
+    }
+    return size;
+  }
+
+  // A folded string is copied each time it is evaluated, unless 'fresh' is false.
+  ASTNode::ptr_t MakeString(const ASTNode & old_node, std::string text, bool fresh=true) {
+    context.Count("string expressions folded");
+    return context.Make<ASTNode_StringLit>(old_node.GetFilePos(), std::move(text), fresh);
+  }
+
+  // Concatenation and repetition only read their operands, so a folded operand needs no copy.
+  static void Share(ASTNode & node) {
+    if (node.Kind() == NodeKind::STRING_LIT) static_cast<ASTNode_StringLit &>(node).SetFresh(false);
+  }
+
+  // Concatenation is associative, so (x + "a") + "b" can become x + "ab".
+  ASTNode::ptr_t Reassociate(ASTNode_Math2 & node) {
+    ASTNode & lhs = node.GetChild(0);
+    if (lhs.Kind() != NodeKind::MATH2 || static_cast<ASTNode_Math2 &>(lhs).Op() != OpCode::ADD) return nullptr;
+    if (!lhs.AnnotatedType().IsString()) return nullptr;
+    auto & inner = static_cast<ASTNode_Math2 &>(lhs);
+    auto text1 = GetText(inner.GetChild(1));
+    auto text2 = GetText(node.GetChild(1));
+    if (!text1 || !text2) return nullptr;
+    inner.ReplaceChild(1, MakeString(inner.GetChild(1), *text1 + *text2, false));
+    inner.ReturnType(context.symbols);
+    return ASTNode::ptr_t(&inner);
+  }
+
+public:
+  StringFolder(PassContext & context) : context(context) { }
+
+  // Return a replacement for a node, or nullptr to keep it.
+  ASTNode::ptr_t Fold(ASTNode & node) {
+    switch (node.Kind()) {
+    case NodeKind::MATH2: {
+      auto & math = static_cast<ASTNode_Math2 &>(node);
+      if (!math.AnnotatedType().IsString()) return nullptr;
+      if (math.Op() == OpCode::ADD || math.Op() == OpCode::MUL) {
+        Share(math.GetChild(0));
+        Share(math.GetChild(1));
+      }
+      auto lhs = GetText(math.GetChild(0));
+      if (!lhs) return (math.Op() == OpCode::ADD) ? Reassociate(math) : nullptr;
+      if (math.Op() == OpCode::ADD) {
+        auto rhs = GetText(math.GetChild(1));
+        return rhs ? MakeString(node, *lhs + *rhs) : nullptr;
+      }
+      if (math.Op() == OpCode::MUL && math.GetChild(1).Kind() == NodeKind::INT_LIT) {
+        const int count = static_cast<const ASTNode_IntLit &>(math.GetChild(1)).Value();
+        if (count < 0 || (count > 0 && lhs->size() > MAX_REPEAT_SIZE / count)) return nullptr;
+        std::string text;
+        for (int i = 0; i < count; ++i) text += *lhs;
+        return MakeString(node, std::move(text));
+      }
+      return nullptr;
+    }
+    case NodeKind::TO_STRING: {   // A lone char becomes a one-character string.
+      auto text = GetText(node);
+      return text ? MakeString(node, std::move(*text)) : nullptr;
+    }
+    case NodeKind::FUNCTION_CALL: {
+      const size_t fun_id = static_cast<const ASTNode_Function_Call &>(node).FunID();
+      if (!context.symbols.IsInbuilt(fun_id) || context.symbols.GetName(fun_id) != "size") return nullptr;
+      if (node.NumChildren() != 1) return nullptr;
+      auto text = GetText(*node.ChildPtr(0));
+      auto size = text ? TextSize(*text) : std::nullopt;
+      if (!size) return nullptr;
+      context.Count("string expressions folded");
+      return context.Make<ASTNode_IntLit>(node.GetFilePos(), static_cast<int>(*size));
+    }
+    default:
+      return nullptr;
+    }
+  }
+};
+
+// The pass itself.
+inline void FoldStrings(ASTNode_Function & fun, PassContext & context) {
+  StringFolder folder(context);
+  RewriteTree(fun, context.symbols, [&folder](ASTNode & node) { return folder.Fold(node); });
+}
@@ -44,12 +44,29 @@ void GenerateFunctionHeader(Control& control, std::string func_name, std::string
         .CommentLine("Variables");
 }
 
+void GenerateAllocStr(Control& control)
+{
+    control.CommentLine("Function to allocate a string; add one to size and places null there.")
+        .Code("(func $_alloc_str (param $size i32) (result i32)")
+        .Code("  (local $null_pos i32)").Comment("Local variable to place null terminator.")
+        .Code("  (global.get $free_mem)").Comment("Old free mem is alloc start.")
+        .Code("  (global.get $free_mem)").Comment("Adjust new free mem.")
+        .Code("  (local.get $size)")
+        .Code("  (i32.add)")
+        .Code("  (local.set $null_pos)")
+        .Code("  (i32.store8 (local.get $null_pos) (i32.const 0))").Comment("Place null terminator.")
+        .Code("  (i32.add (i32.const 1) (local.get $null_pos))")
+        .Code("  (global.set $free_mem)").Comment("Update free memory start.")
+        .Code(")")
+        .Code("");
+}
+
 void GenerateSizeFunction(Control& control)
 {
     int original = control.indent;
 
     // emplex::Token size_function{emplex::Lexer::ID_SIZE, "size", 0,0};
-    // control.symbols.AddFunction(size_function, {Type("string")}, Type("int"));
+    // control.symbols.AddFunction(size_function, {Type::String()}, Type::Int());
 
     control.CommentLine("Function to get the size of a string")
         .Code("(func $size (param $str i32) (result i32)")
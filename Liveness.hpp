@@ -0,0 +1,267 @@
+#pragma once
+
+// Variable liveness for a single function.
+//
+// The function body is flattened into a control-flow graph whose blocks hold the reads and
+// writes of local variables in evaluation order, with edges for if/else, loops, short-circuit
+// && and ||, break, continue, and return.  A standard backward dataflow pass then finds, for
+// each block, which variables may still be read later.  Variables are identified by their local
+// id (parameters first), so a function's sets are small, dense bitsets.
+//
+// Example usage:
+//   Liveness liveness(fun_node, symbols);
+//   liveness.ForEachWrite([](const Liveness::Event & write, const VarSet & live_after) { ... });
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include "ASTNode.hpp"
+#include "SymbolTable.hpp"
+
+// A set of local ids.
+class VarSet {
+private:
+  std::vector<uint64_t> words{};
+
+public:
+  VarSet() = default;
+  explicit VarSet(size_t size) : words((size + 63) / 64, 0) { }
+
+  bool Has(uint32_t id) const { return words[id / 64] >> (id % 64) & 1; }
+  void Set(uint32_t id) { words[id / 64] |= uint64_t{1} << (id % 64); }
+  void Clear(uint32_t id) { words[id / 64] &= ~(uint64_t{1} << (id % 64)); }
+
+  // Add everything in another set; return whether anything was new.
+  bool Merge(const VarSet & in) {
+    bool changed = false;
+    for (size_t i = 0; i < words.size(); ++i) {
+      const uint64_t merged = words[i] | in.words[i];
+      changed |= (merged != words[i]);
+      words[i] = merged;
+    }
+    return changed;
+  }
+
+  template <typename FUN_T>
+  void ForEach(FUN_T && fun) const {
+    for (size_t i = 0; i < words.size(); ++i) {
+      for (uint64_t bits = words[i]; bits; bits &= bits - 1) {
+        fun(static_cast<uint32_t>(i * 64 + std::countr_zero(bits)));
+      }
+    }
+  }
+};
+
+class Liveness {
+public:
+  struct Event {
+    bool write;
+    uint32_t var;           // Local id.
+    const ASTNode * node;   // The variable (for a read) or assignment (for a write).
+  };
+
+private:
+  struct Block {
+    std::vector<Event> events{};
+    std::vector<uint32_t> succs{};
+    VarSet live_in{};
+    VarSet live_out{};
+  };
+
+  std::vector<Block> blocks{};
+  size_t num_vars;
+
+  uint32_t NewBlock() {
+    blocks.emplace_back();
+    return static_cast<uint32_t>(blocks.size() - 1);
+  }
+  void Edge(uint32_t from, uint32_t to) { blocks[from].succs.push_back(to); }
+
+  // Flatten the tree into blocks, following the order the generated code evaluates it in.
+  void Build(const ASTNode & root, const SymbolTable & symbols) {
+    struct Frame {
+      const ASTNode * node;
+      size_t step;
+      uint32_t block1 = 0;    // Blocks to come back to (such as a loop head and exit).
+      uint32_t block2 = 0;
+    };
+    struct Loop { uint32_t head, exit; };
+    std::vector<Frame> stack{{&root, 0}};
+    std::vector<Loop> loops;
+    uint32_t cur = NewBlock();
+    auto LocalID = [&symbols](const ASTNode * var) {
+      return symbols.GetLocalID(static_cast<const ASTNode_Var *>(var)->VarID());
+    };
+
+    while (stack.size()) {
+      Frame & frame = stack.back();
+      const ASTNode & node = *frame.node;
+      const size_t step = frame.step++;
+      const ASTNode * next = nullptr;   // Child to visit next...
+      bool done = false;                // ...or is this node finished?
+
+      switch (node.Kind()) {
+      case NodeKind::VAR:
+        blocks[cur].events.push_back(Event{false, LocalID(&node), &node});
+        done = true;
+        break;
+      case NodeKind::MATH2: {
+        const OpCode op = static_cast<const ASTNode_Math2 &>(node).Op();
+        if (op == OpCode::ASSIGN) {           // Value first, then the target.
+          if (step == 0) next = node.ChildPtr(1);
+          else if (step == 1 && node.ChildPtr(0)->Kind() != NodeKind::VAR) {
+            next = node.ChildPtr(0);          // Indexing reads its operands.
+          }
+          else {
+            if (step == 1) blocks[cur].events.push_back(Event{true, LocalID(node.ChildPtr(0)), &node});
+            done = true;
+          }
+        }
+        else if (op == OpCode::AND || op == OpCode::OR) {   // The right side may be skipped.
+          if (step == 0) next = node.ChildPtr(0);
+          else if (step == 1) {
+            const uint32_t rhs = NewBlock();
+            frame.block1 = NewBlock();
+            Edge(cur, rhs);
+            Edge(cur, frame.block1);
+            cur = rhs;
+            next = node.ChildPtr(1);
+          }
+          else {
+            Edge(cur, frame.block1);
+            cur = frame.block1;
+            done = true;
+          }
+        }
+        else if (step < 2) next = node.ChildPtr(step);
+        else done = true;
+        break;
+      }
+      case NodeKind::IF:
+        if (step == 0) next = node.ChildPtr(0);
+        else if (step == 1) {
+          const uint32_t then_block = NewBlock();
+          frame.block1 = NewBlock();                                 // After the if.
+          frame.block2 = node.NumChildren() == 3 ? NewBlock() : frame.block1;   // Else branch.
+          Edge(cur, then_block);
+          Edge(cur, frame.block2);
+          cur = then_block;
+          next = node.ChildPtr(1);
+        }
+        else if (step == 2 && node.NumChildren() == 3) {
+          Edge(cur, frame.block1);
+          cur = frame.block2;
+          next = node.ChildPtr(2);
+        }
+        else {
+          Edge(cur, frame.block1);
+          cur = frame.block1;
+          done = true;
+        }
+        break;
+      case NodeKind::WHILE:
+        if (step == 0) {
+          frame.block1 = NewBlock();    // Loop head (the test).
+          frame.block2 = NewBlock();    // Loop exit.
+          Edge(cur, frame.block1);
+          cur = frame.block1;
+          loops.push_back(Loop{frame.block1, frame.block2});
+          next = node.ChildPtr(0);
+        }
+        else if (step == 1) {
+          const uint32_t body = NewBlock();
+          Edge(cur, body);
+          Edge(cur, frame.block2);
+          cur = body;
+          next = node.ChildPtr(1);
+        }
+        else {
+          Edge(cur, frame.block1);
+          loops.pop_back();
+          cur = frame.block2;
+          done = true;
+        }
+        break;
+      case NodeKind::RETURN:
+        if (step == 0) next = node.ChildPtr(0);
+        else {
+          cur = NewBlock();             // Anything after a return is unreachable.
+          done = true;
+        }
+        break;
+      case NodeKind::BREAK:
+      case NodeKind::CONTINUE:
+        if (loops.size()) {             // (Code generation reports a jump outside of a loop.)
+          Edge(cur, node.Kind() == NodeKind::BREAK ? loops.back().exit : loops.back().head);
+        }
+        cur = NewBlock();
+        done = true;
+        break;
+      default:
+        if (step < node.NumChildren()) next = node.ChildPtr(step);
+        else done = true;
+      }
+
+      if (next) stack.push_back(Frame{next, 0});
+      else if (done) stack.pop_back();
+    }
+  }
+
+  // Local ids run from zero, but some may already have been removed from the function.
+  static size_t CountLocals(const ASTNode_Function & fun, const SymbolTable & symbols) {
+    size_t count = 0;
+    for (size_t id : fun.ParamIDs()) count = std::max<size_t>(count, symbols.GetLocalID(id) + 1);
+    for (size_t id : fun.VarIDs()) count = std::max<size_t>(count, symbols.GetLocalID(id) + 1);
+    return count;
+  }
+
+  // Backward dataflow until nothing changes.
+  void Solve() {
+    for (Block & block : blocks) block.live_in = block.live_out = VarSet(num_vars);
+    for (bool changed = true; changed; ) {
+      changed = false;
+      for (size_t id = blocks.size(); id-- > 0; ) {
+        Block & block = blocks[id];
+        for (uint32_t succ : block.succs) block.live_out.Merge(blocks[succ].live_in);
+        VarSet live = block.live_out;
+        for (size_t i = block.events.size(); i-- > 0; ) {
+          const Event & event = block.events[i];
+          if (event.write) live.Clear(event.var);
+          else live.Set(event.var);
+        }
+        changed |= block.live_in.Merge(live);
+      }
+    }
+  }
+
+public:
+  Liveness(const ASTNode_Function & fun, const SymbolTable & symbols)
+    : num_vars(CountLocals(fun, symbols))
+  {
+    Build(fun, symbols);
+    Solve();
+  }
+
+  size_t NumVars() const { return num_vars; }
+
+  // Variables that may be read before they are written (their initial values are used).
+  const VarSet & LiveAtEntry() const { return blocks[0].live_in; }
+
+  // Call fun(write_event, live_after) for each write, with the variables live just after it.
+  template <typename FUN_T>
+  void ForEachWrite(FUN_T && fun) const {
+    for (const Block & block : blocks) {
+      VarSet live = block.live_out;
+      for (size_t i = block.events.size(); i-- > 0; ) {
+        const Event & event = block.events[i];
+        if (event.write) {
+          fun(event, live);
+          live.Clear(event.var);
+        }
+        else live.Set(event.var);
+      }
+    }
+  }
+};
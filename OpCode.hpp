@@ -0,0 +1,92 @@
+#pragma once
+
+// Operators used by the Math1 and Math2 AST nodes.
+//
+// Each operator is resolved from its lexeme once, when its node is built; after that, type
+// checking and code generation look everything up in a constexpr table rather than comparing
+// operator strings.
+//
+// Example usage:
+//   OpCode op = ToOpCode("<=");
+//   std::string_view wat = GetOpCodeInfo(op).wat;   // "le"
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+enum class OpCode : uint8_t {
+  NEGATE=0, NOT, SQRT,                                          // Unary
+  MUL, DIV, MOD, ADD, SUB,                                      // Math
+  LESS, LESS_EQ, GREATER, GREATER_EQ, EQUAL, NOT_EQUAL,         // Comparisons
+  AND, OR,                                                      // Boolean logic
+  ASSIGN,
+  UNKNOWN
+};
+
+// How the result type is found.
+enum class OpResult : uint8_t {
+  NONE,     // Unknown operator
+  INT,      // Always int (comparisons, Boolean logic, modulus)
+  DOUBLE,   // Always double
+  LHS,      // Type of the first operand
+  WIDER     // Whichever operand type has more bits
+};
+
+// Which operand types are accepted, and which promotions are made to fit them.
+enum class OpRule : uint8_t {
+  NONE,
+  NEGATE,   // Non-char numeric.
+  NOT,      // int only.
+  SQRT,     // Numeric, promoted to double.
+  MUL,      // Matching int/double (promoting int to double), string * int, or char * int.
+  DIV,      // Matching int/double (promoting int to double).
+  INT_ONLY, // Both int.
+  NUMERIC,  // Numeric types aligned to the wider type.
+  ADD,      // Numeric aligned, or strings and chars concatenated.
+  ASSIGN    // Right-hand side promoted to the variable's type.
+};
+
+struct OpCodeInfo {
+  std::string_view symbol = "";   // Operator as written in the source.
+  OpResult result = OpResult::NONE;
+  OpRule rule = OpRule::NONE;
+  std::string_view wat = "";      // WAT instruction suffix (e.g., "lt" for "i32.lt_s").
+  bool sign_suffix = false;       // Does the i32 version need a "_s" suffix?
+};
+
+constexpr std::array<OpCodeInfo, static_cast<size_t>(OpCode::UNKNOWN) + 1> OP_CODE_TABLE{{
+  { "-",    OpResult::LHS,    OpRule::NEGATE,   "sub", false },
+  { "!",    OpResult::INT,    OpRule::NOT,      "eqz", false },
+  { "sqrt", OpResult::DOUBLE, OpRule::SQRT,     "sqrt", false },
+  { "*",    OpResult::WIDER,  OpRule::MUL,      "mul", false },
+  { "/",    OpResult::WIDER,  OpRule::DIV,      "div", true  },
+  { "%",    OpResult::INT,    OpRule::INT_ONLY, "rem", true  },
+  { "+",    OpResult::WIDER,  OpRule::ADD,      "add", false },
+  { "-",    OpResult::WIDER,  OpRule::NUMERIC,  "sub", false },
+  { "<",    OpResult::INT,    OpRule::NUMERIC,  "lt",  true  },
+  { "<=",   OpResult::INT,    OpRule::NUMERIC,  "le",  true  },
+  { ">",    OpResult::INT,    OpRule::NUMERIC,  "gt",  true  },
+  { ">=",   OpResult::INT,    OpRule::NUMERIC,  "ge",  true  },
+  { "==",   OpResult::INT,    OpRule::NUMERIC,  "eq",  false },
+  { "!=",   OpResult::INT,    OpRule::NUMERIC,  "ne",  false },
+  { "&&",   OpResult::INT,    OpRule::INT_ONLY, "",    false },
+  { "||",   OpResult::INT,    OpRule::INT_ONLY, "",    false },
+  { "=",    OpResult::LHS,    OpRule::ASSIGN,   "",    false },
+  { "?",    OpResult::NONE,   OpRule::NONE,     "",    false }
+}};
+
+constexpr const OpCodeInfo & GetOpCodeInfo(OpCode op) { return OP_CODE_TABLE[static_cast<size_t>(op)]; }
+
+// Find the operator for a lexeme; '-' is subtraction unless 'unary' is set.
+constexpr OpCode ToOpCode(std::string_view symbol, bool unary=false) {
+  const size_t first = unary ? 0 : static_cast<size_t>(OpCode::MUL);
+  const size_t last = unary ? static_cast<size_t>(OpCode::MUL) : static_cast<size_t>(OpCode::UNKNOWN);
+  for (size_t i = first; i < last; ++i) {
+    if (OP_CODE_TABLE[i].symbol == symbol) return static_cast<OpCode>(i);
+  }
+  return OpCode::UNKNOWN;
+}
+
+static_assert(ToOpCode("-", true) == OpCode::NEGATE && ToOpCode("-") == OpCode::SUB);
+static_assert(ToOpCode("=") == OpCode::ASSIGN && ToOpCode("sqrt") == OpCode::UNKNOWN);
+static_assert(GetOpCodeInfo(OpCode::NOT_EQUAL).symbol == "!=" && GetOpCodeInfo(OpCode::UNKNOWN).symbol == "?");
@@ -0,0 +1,132 @@
+#pragma once
+
+// Multi-threaded tokenizing for large sources.
+//
+// Tubular programs are flat lists of functions, so a large source is split just before lines that
+// begin with "function" and the pieces are lexed on a small pool of threads.  Each piece is lexed
+// (with line numbers starting over at 1) until the lexer reaches or passes the next cut.  If it
+// lands exactly on the cut, that cut is a real token boundary and the next piece's tokens are
+// exactly what a sequential lexer would produce there; only their line numbers need shifting.  If
+// a token crosses the cut instead (e.g., the "function" line was inside a block comment), lexing
+// simply continues sequentially until it lands on a later cut.  The result is always identical
+// to emplex::Lexer::Tokenize().
+//
+// Example usage:
+//   std::vector<emplex::Token> tokens = TokenizeParallel(source.View(), 4);
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "lexer.hpp"
+
+namespace parallel_lexer {
+
+  // Sources smaller than this are not worth starting threads for.
+  static constexpr size_t MIN_PARALLEL_SIZE = 1 << 20;
+
+  // Aim for a few pieces per thread so uneven pieces still balance out.
+  static constexpr size_t PIECES_PER_THREAD = 4;
+
+  struct Piece {
+    size_t begin = 0;                  // Offset of the first line of this piece.
+    size_t end = 0;                    // Offset of the next piece (or the end of the source).
+    std::vector<emplex::Token> tokens{};
+    emplex::Lexer lexer{};             // Lexer state where this piece stopped.
+  };
+
+  // Choose cut points: starts of lines that begin with the keyword "function", spaced roughly
+  // evenly through the source.  Cuts are only candidates; lexing verifies each of them.
+  inline std::vector<size_t> FindCuts(std::string_view in, size_t num_pieces) {
+    std::vector<size_t> cuts{0};
+    const std::string_view keyword = "\nfunction";
+    for (size_t piece = 1; piece < num_pieces; ++piece) {
+      size_t pos = std::max(in.size() * piece / num_pieces, cuts.back());
+      while ((pos = in.find(keyword, pos)) != std::string_view::npos) {
+        const size_t after = pos + keyword.size();
+        if (after == in.size()) break;
+        const unsigned char next_char = static_cast<unsigned char>(in[after]);
+        if (!std::isalnum(next_char) && next_char != '_') break;  // Not just a longer identifier.
+        pos = after;
+      }
+      if (pos == std::string_view::npos) break;
+      if (pos + 1 > cuts.back()) cuts.push_back(pos + 1);  // Cut after the newline.
+    }
+    return cuts;
+  }
+
+  // Continue lexing until the next token would start at or beyond 'stop'.
+  inline void LexUntil(emplex::Lexer & lexer, std::string_view in, size_t stop,
+                       std::vector<emplex::Token> & out) {
+    while (lexer.CurPos() < stop) {
+      const emplex::Token token = lexer.NextToken(in);
+      if (!token) break;
+      if (!emplex::Lexer::IgnoreToken(token.id)) out.push_back(token);
+    }
+  }
+
+  // Shift the line numbers of tokens lexed as though their piece started on line 1, and give
+  // identifiers their atoms (in source order, as the sequential lexer would).
+  inline void AppendShifted(std::vector<emplex::Token> & out, const std::vector<emplex::Token> & in,
+                            size_t line_offset) {
+    const uint64_t shift = static_cast<uint64_t>(line_offset) << emplex::Token::COL_BITS;
+    for (emplex::Token token : in) {
+      token.pos += shift;
+      emplex::Lexer::AssignAtom(token);
+      out.push_back(token);
+    }
+  }
+
+} // End of namespace parallel_lexer
+
+// Tokenize 'in' using up to 'num_threads' threads; identical to emplex::Lexer().Tokenize(in).
+inline std::vector<emplex::Token> TokenizeParallel(std::string_view in, size_t num_threads) {
+  using namespace parallel_lexer;
+  if (num_threads < 2 || in.size() < MIN_PARALLEL_SIZE) return emplex::Lexer().Tokenize(in);
+
+  const std::vector<size_t> cuts = FindCuts(in, num_threads * PIECES_PER_THREAD);
+  std::vector<Piece> pieces(cuts.size());
+  for (size_t i = 0; i < cuts.size(); ++i) {
+    pieces[i].begin = cuts[i];
+    pieces[i].end = (i+1 < cuts.size()) ? cuts[i+1] : in.size();
+  }
+
+  // Lex the pieces on a pool of threads that each claim the next unlexed piece.
+  std::atomic<size_t> next_piece{0};
+  auto worker = [&]() {
+    for (size_t i = next_piece++; i < pieces.size(); i = next_piece++) {
+      pieces[i].lexer.Restart(pieces[i].begin);
+      LexUntil(pieces[i].lexer, in, pieces[i].end, pieces[i].tokens);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < std::min(num_threads, pieces.size()); ++i) pool.emplace_back(worker);
+  worker();
+  for (auto & thread : pool) thread.join();
+
+  // Stitch the pieces together, relexing across any cut that was not a token boundary.
+  std::vector<emplex::Token> out;
+  size_t total = 0;
+  for (const auto & piece : pieces) total += piece.tokens.size();
+  out.reserve(total);
+
+  size_t line_offset = 0;  // Lines before the current piece.
+  for (size_t i = 0; i < pieces.size(); ) {
+    AppendShifted(out, pieces[i].tokens, line_offset);
+    emplex::Lexer & lexer = pieces[i].lexer;
+    size_t next = i + 1;
+    std::vector<emplex::Token> extra;
+    while (next < pieces.size() && lexer.CurPos() != pieces[next].begin) {
+      LexUntil(lexer, in, pieces[next].end, extra);  // A token crossed the cut; keep going.
+      ++next;
+    }
+    if (next == pieces.size()) LexUntil(lexer, in, in.size(), extra);
+    AppendShifted(out, extra, line_offset);
+    line_offset += lexer.CurLine() - 1;
+    i = next;
+  }
+  return out;
+}
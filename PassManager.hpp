@@ -0,0 +1,226 @@
+#pragma once
+
+// Optimization passes over the AST.
+//
+// Passes run on each function after it has been type checked and before any code is generated.
+// Each pass is registered with the optimization levels it runs at (-O0 runs none), and passes
+// run in the order they were registered.  When statistics are requested, every pass is timed and
+// the manager reports how many nodes it removed, along with any counters the pass keeps itself
+// (such as the number of constants folded).
+//
+// Example usage:
+//   PassManager passes(OptLevel::O2);
+//   passes.Add("fold-constants", OPT_ALL, FoldConstants);
+//   passes.Run(fun_node, symbols);
+//   passes.PrintStats(std::cerr);
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ASTNode.hpp"
+#include "SymbolTable.hpp"
+
+// Optimization levels are bits, so a pass can list the set of levels it runs at.
+enum class OptLevel : uint8_t { O0 = 1, O1 = 2, O2 = 4, Os = 8 };
+
+constexpr uint8_t OptBit(OptLevel level) { return static_cast<uint8_t>(level); }
+
+inline constexpr uint8_t OPT_ALL = OptBit(OptLevel::O1) | OptBit(OptLevel::O2) | OptBit(OptLevel::Os);
+inline constexpr uint8_t OPT_FULL = OptBit(OptLevel::O2) | OptBit(OptLevel::Os);   // Beyond -O1.
+
+inline std::optional<OptLevel> ToOptLevel(std::string_view flag) {
+  if (flag == "-O0") return OptLevel::O0;
+  if (flag == "-O1") return OptLevel::O1;
+  if (flag == "-O2") return OptLevel::O2;
+  if (flag == "-Os") return OptLevel::Os;
+  return std::nullopt;
+}
+
+inline std::string_view OptLevelName(OptLevel level) {
+  switch (level) {
+  case OptLevel::O0: return "-O0";
+  case OptLevel::O1: return "-O1";
+  case OptLevel::O2: return "-O2";
+  case OptLevel::Os: return "-Os";
+  }
+  return "";
+}
+
+// Count the nodes in a tree.
+inline size_t CountNodes(const ASTNode & root) {
+  size_t count = 0;
+  std::vector<const ASTNode *> pending{&root};
+  while (pending.size()) {
+    const ASTNode * node = pending.back();
+    pending.pop_back();
+    ++count;
+    for (size_t i = 0; i < node->NumChildren(); ++i) {
+      if (node->ChildPtr(i)) pending.push_back(node->ChildPtr(i));
+    }
+  }
+  return count;
+}
+
+// Could evaluating this tree do anything besides produce its value?  Calls, assignments, string
+// building (which allocates), and anything that might trap all count.
+inline bool HasSideEffects(const ASTNode & root) {
+  std::vector<const ASTNode *> pending{&root};
+  while (pending.size()) {
+    const ASTNode * node = pending.back();
+    pending.pop_back();
+    switch (node->Kind()) {
+    case NodeKind::FUNCTION_CALL:
+    case NodeKind::INDEX:          // Loads may be out of bounds.
+    case NodeKind::TO_STRING:
+      return true;
+    case NodeKind::STRING_LIT:
+      if (static_cast<const ASTNode_StringLit *>(node)->IsFresh()) return true;
+      break;
+    case NodeKind::TO_INT:         // Truncating a double traps if it is out of range.
+      if (node->ChildPtr(0)->AnnotatedType().IsDouble()) return true;
+      break;
+    case NodeKind::MATH2: {
+      const OpCode op = static_cast<const ASTNode_Math2 *>(node)->Op();
+      const Type & type = node->ChildPtr(0)->AnnotatedType();
+      if (op == OpCode::ASSIGN || !type.IsNumeric()) return true;
+      if ((op == OpCode::DIV || op == OpCode::MOD) && !type.IsDouble()) return true;
+      break;
+    }
+    default:
+      break;
+    }
+    for (size_t i = 0; i < node->NumChildren(); ++i) {
+      if (node->ChildPtr(i)) pending.push_back(node->ChildPtr(i));
+    }
+  }
+  return false;
+}
+
+// Rewrite a tree bottom-up: 'rewrite' is called on each node after all of its children, and may
+// return a replacement (with its type already annotated), or an empty pointer to keep the node.
+template <typename FUN_T>
+void RewriteTree(ASTNode & root, const SymbolTable & symbols, FUN_T && rewrite) {
+  struct Frame { ASTNode * node; size_t next_child; };
+  std::vector<Frame> stack{{&root, 0}};
+  while (stack.size()) {
+    Frame & frame = stack.back();
+    if (frame.next_child < frame.node->NumChildren()) {
+      ASTNode * child = frame.node->ChildPtr(frame.next_child++);
+      if (child) stack.push_back(Frame{child, 0});
+      continue;
+    }
+    ASTNode & node = *frame.node;
+    stack.pop_back();
+    node.ReturnType(symbols);          // Restore the type if a child was replaced.
+    if (stack.empty()) break;          // The root stays.
+    if (ASTNode::ptr_t replacement = rewrite(node)) {
+      Frame & parent = stack.back();
+      static_cast<ASTNode_Parent *>(parent.node)->ReplaceChild(parent.next_child - 1, std::move(replacement));
+    }
+  }
+}
+
+// What a pass is given while it runs.
+class PassContext {
+private:
+  std::vector<std::pair<std::string_view, size_t>> & counters;
+
+public:
+  SymbolTable & symbols;
+  const OptLevel level;
+
+  PassContext(std::vector<std::pair<std::string_view, size_t>> & counters,
+              SymbolTable & symbols, OptLevel level)
+    : counters(counters), symbols(symbols), level(level) { }
+
+  // Add to one of this pass's counters (such as "constants folded").
+  void Count(std::string_view counter, size_t amount=1) {
+    for (auto & [name, count] : counters) {
+      if (name == counter) { count += amount; return; }
+    }
+    counters.emplace_back(counter, amount);
+  }
+
+  // Build a new node (in the node arena) with its type annotated.
+  template <typename NODE_T, typename... ARG_Ts>
+  ASTNode::ptr_t Make(ARG_Ts &&... args) {
+    ASTNode::ptr_t node = NodeArena().Make<NODE_T>(std::forward<ARG_Ts>(args)...);
+    node->ReturnType(symbols);
+    return node;
+  }
+};
+
+class PassManager {
+public:
+  using pass_fun_t = void (*)(ASTNode_Function &, PassContext &);
+
+private:
+  struct Pass {
+    std::string_view name;
+    uint8_t levels;               // Bit mask of OptLevel values that this pass runs at.
+    pass_fun_t fun;
+
+    // Statistics, kept only if requested.
+    double seconds = 0.0;
+    int64_t nodes_removed = 0;
+    std::vector<std::pair<std::string_view, size_t>> counters{};
+  };
+
+  OptLevel level;
+  bool keep_stats = false;
+  std::vector<Pass> passes{};
+  size_t num_functions = 0;
+
+  bool IsActive(const Pass & pass) const { return pass.levels & OptBit(level); }
+
+public:
+  explicit PassManager(OptLevel level=OptLevel::O0) : level(level) { }
+
+  OptLevel Level() const { return level; }
+  void SetLevel(OptLevel in) { level = in; }
+  void KeepStats(bool in=true) { keep_stats = in; }
+
+  // Register a pass to run at the provided levels (a bit mask, such as OPT_ALL).
+  void Add(std::string_view name, uint8_t levels, pass_fun_t fun) {
+    passes.push_back(Pass{name, levels, fun});
+  }
+
+  // Run every active pass on a type-checked function.
+  void Run(ASTNode_Function & fun, SymbolTable & symbols) {
+    ++num_functions;
+    for (Pass & pass : passes) {
+      if (!IsActive(pass)) continue;
+      PassContext context(pass.counters, symbols, level);
+      if (!keep_stats) { pass.fun(fun, context); continue; }
+
+      const size_t start_nodes = CountNodes(fun);
+      const auto start_time = std::chrono::steady_clock::now();
+      pass.fun(fun, context);
+      const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start_time;
+      pass.seconds += time.count();
+      pass.nodes_removed += static_cast<int64_t>(start_nodes) - static_cast<int64_t>(CountNodes(fun));
+    }
+  }
+
+  void PrintStats(std::ostream & os) const {
+    os << "Optimization passes (" << OptLevelName(level) << ", " << num_functions << " functions):\n";
+    bool any = false;
+    for (const Pass & pass : passes) {
+      if (!IsActive(pass)) continue;
+      any = true;
+      os << "  " << std::left << std::setw(24) << pass.name << std::right << std::fixed
+         << std::setprecision(3) << std::setw(10) << pass.seconds * 1000.0 << " ms  "
+         << pass.nodes_removed << " nodes removed";
+      for (const auto & [name, count] : pass.counters) os << ", " << count << " " << name;
+      os << '\n';
+    }
+    if (!any) os << "  (none)\n";
+    os.flush();
+  }
+};
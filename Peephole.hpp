@@ -0,0 +1,320 @@
+#pragma once
+
+// Peephole optimization of generated code.
+//
+// When a function's code is finished (see Control::EndFunction()), the instructions recorded on
+// its lines (see WasmInstr.hpp) are rewritten before any text or binary is produced from them.
+// Each plain instruction is its opcode (from WASM_OP_TABLE) and immediate, while structure (block,
+// loop, if, then, else, or the end of one) and any other code, such as a declaration, is a barrier
+// that no rule looks across.  Instructions are moved to an output list one at a time, and after
+// each the rules in the table below are tried on the end of that list until none fires, so one
+// rewrite can enable the next (a comparison followed by two i32.eqz collapses back into the
+// comparison).  Lines that only hold a comment are left alone, and each changed line is commented
+// with the rule that changed it.
+//
+// Example usage:
+//   Peephole peephole;
+//   peephole.Run(code_buffer);     // Rewrite the lines that have not been laid out yet.
+//   peephole.PrintStats(std::cerr);
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "CodeBuffer.hpp"
+#include "WasmInstr.hpp"
+
+class Peephole {
+private:
+  // Opcodes the rules look for (see WASM_OP_TABLE).
+  static constexpr uint8_t BR_IF = 0x0D, DROP = 0x1A, LOCAL_GET = 0x20, LOCAL_SET = 0x21,
+    LOCAL_TEE = 0x22, GLOBAL_GET = 0x23, I32_CONST = 0x41, F64_CONST = 0x44, I32_EQZ = 0x45,
+    I32_EQ = 0x46, I32_NE = 0x47, I32_GE_U = 0x4F, F64_EQ = 0x61, F64_NE = 0x62, F64_GE = 0x66,
+    F64_ABS = 0x99, F64_NEG = 0x9A, F64_SUB = 0xA1, I32_TRUNC_F64_S = 0xAA, F64_CONVERT_I32_S = 0xB7;
+
+  struct Instr {
+    WasmInstr instr{};                  // A plain instruction (kind OP), or else a barrier.
+    uint32_t line = 0;                  // Line of code this instruction is on.
+    std::string_view rule{};            // Rule that changed this instruction (if any).
+
+    bool IsOp() const { return instr.kind == WasmInstr::OP; }
+    bool Is(uint8_t code) const { return instr.Is(code); }
+  };
+
+  struct StackEffect { int pops, pushes; };
+
+  using rule_fun_t = bool (Peephole::*)();
+  struct Rule {
+    std::string_view name;
+    rule_fun_t apply;
+  };
+
+  std::vector<Instr> out{};             // Instructions kept so far in the current section.
+  std::vector<size_t> fired{};          // Times each rule has fired, by position in Rules().
+  std::string_view cur_rule{};          // Rule being tried.
+
+  static const WasmOpInfo * OpByCode(uint8_t code) {
+    static const auto by_code = [](){
+      std::array<const WasmOpInfo *, 256> out{};
+      for (const WasmOpInfo & op : WASM_OP_TABLE) out[op.code] = &op;
+      return out;
+    }();
+    assert(by_code[code]);
+    return by_code[code];
+  }
+
+  // Values taken from and left on the stack, for instructions that only affect the stack.
+  static std::optional<StackEffect> GetStackEffect(const Instr & instr) {
+    if (!instr.IsOp()) return std::nullopt;
+    const uint8_t code = instr.instr.op->code;
+    if (code == LOCAL_GET || code == GLOBAL_GET || code == I32_CONST || code == F64_CONST) return StackEffect{0, 1};
+    if (code == LOCAL_SET || code == 0x24 || code == DROP) return StackEffect{1, 0};   // 0x24: global.set
+    if (code == LOCAL_TEE) return StackEffect{1, 1};
+    if (code == 0x01) return StackEffect{0, 0};                          // nop
+    if (code == 0x1B) return StackEffect{3, 1};                          // select
+    if (code >= 0x28 && code <= 0x35) return StackEffect{1, 1};          // Loads.
+    if (code >= 0x36 && code <= 0x3E) return StackEffect{2, 0};          // Stores.
+    if (code == 0x3F) return StackEffect{0, 1};                          // memory.size
+    if (code == 0x40 || code == I32_EQZ) return StackEffect{1, 1};       // memory.grow
+    if (code > I32_EQZ && code <= F64_GE) return StackEffect{2, 1};      // Comparisons.
+    if (code >= 0x67 && code <= 0x69) return StackEffect{1, 1};          // i32 bit counts.
+    if (code >= 0x6A && code <= 0x78) return StackEffect{2, 1};          // i32 math.
+    if (code >= F64_ABS && code <= 0x9F) return StackEffect{1, 1};       // f64 unary math.
+    if (code >= 0xA0 && code <= 0xA6) return StackEffect{2, 1};          // f64 math.
+    if (code >= I32_TRUNC_F64_S && code <= 0xB8) return StackEffect{1, 1};   // Conversions.
+    return std::nullopt;                     // Calls and branches.
+  }
+
+  // Does this instruction always leave 0 or 1?
+  static bool IsBoolean(const Instr & instr) {
+    if (!instr.IsOp()) return false;
+    const uint8_t code = instr.instr.op->code;
+    return (code >= I32_EQZ && code <= I32_GE_U) || (code >= F64_EQ && code <= F64_GE);
+  }
+
+  static bool IsConst(const Instr & instr, uint8_t code, double value) {
+    if (!instr.Is(code)) return false;
+    if (code == I32_CONST) return instr.instr.value == value;
+    return instr.instr.f64 == value && !std::signbit(instr.instr.f64);
+  }
+
+  // Where does the one value used by out[end] start?  (nullopt if there is no clean start.)
+  std::optional<size_t> OperandStart(size_t end) const {
+    int needed = 1;
+    for (size_t i = end; i-- > 0; ) {
+      auto effect = GetStackEffect(out[i]);
+      if (!effect || effect->pushes > needed) return std::nullopt;
+      needed += effect->pops - effect->pushes;
+      if (needed == 0) return i;
+    }
+    return std::nullopt;
+  }
+
+  // Tools for the rules to work on the end of the output.
+  bool Tail(size_t count) const { return out.size() >= count && out[out.size() - count].IsOp(); }
+  Instr & Back(size_t pos=0) { return out[out.size() - 1 - pos]; }
+  void Change(Instr & instr, uint8_t code) {   // Any immediate is kept.
+    instr.instr.op = OpByCode(code);
+    instr.rule = cur_rule;
+  }
+  void Pop(size_t count=1) { out.resize(out.size() - count); }
+
+  // ----- The rules -----
+
+  // (local.set $x) (local.get $x)  =>  (local.tee $x)
+  bool SetGetToTee() {
+    if (!Tail(2) || !Back(1).Is(LOCAL_SET) || !Back().Is(LOCAL_GET) || Back(1).instr.value != Back().instr.value) return false;
+    Pop();
+    Change(Back(), LOCAL_TEE);
+    return true;
+  }
+
+  // (local.tee $x) (drop)  =>  (local.set $x)
+  bool TeeDropToSet() {
+    if (!Tail(2) || !Back(1).Is(LOCAL_TEE) || !Back().Is(DROP)) return false;
+    Pop();
+    Change(Back(), LOCAL_SET);
+    return true;
+  }
+
+  // A constant or variable that is dropped right away need not be pushed at all.
+  bool PushDrop() {
+    if (!Tail(2) || !Back().Is(DROP)) return false;
+    const Instr & push = Back(1);
+    if (!push.Is(LOCAL_GET) && !push.Is(GLOBAL_GET) && !push.Is(I32_CONST) && !push.Is(F64_CONST)) return false;
+    Pop(2);
+    return true;
+  }
+
+  // A comparison followed by i32.eqz is the opposite comparison.  (For f64, only == and != can
+  // be swapped, since a comparison with NaN is false both ways.)
+  bool InvertCompare() {
+    if (!Tail(2) || !Back().Is(I32_EQZ)) return false;
+    static constexpr std::array<std::pair<uint8_t, uint8_t>, 6> INVERSE{{
+      {0x46, 0x47}, {0x48, 0x4E}, {0x49, 0x4F}, {0x4A, 0x4C}, {0x4B, 0x4D}, {F64_EQ, F64_NE}
+    }};
+    const uint8_t code = Back(1).instr.op->code;
+    for (auto [op1, op2] : INVERSE) {
+      if (code != op1 && code != op2) continue;
+      Pop();
+      Change(Back(), code == op1 ? op2 : op1);
+      return true;
+    }
+    return false;
+  }
+
+  // Two i32.eqz in a row leave a 0 or 1 unchanged, and a branch only cares about non-zero.
+  bool DoubleEqz() {
+    if (Tail(3) && IsBoolean(Back(2)) && Back(1).Is(I32_EQZ) && Back().Is(I32_EQZ)) {
+      Pop(2);
+      return true;
+    }
+    if (Tail(3) && Back(2).Is(I32_EQZ) && Back(1).Is(I32_EQZ) && Back().Is(BR_IF)) {
+      std::swap(Back(2), Back());
+      Pop(2);
+      return true;
+    }
+    return false;
+  }
+
+  // (i32.const 0) (i32.ne) turns any value into 0 or 1; that is not needed when the value is
+  // already 0 or 1, or when a branch or an i32.eqz uses it next.
+  bool NotEqualZero() {
+    if (Tail(3) && IsBoolean(Back(2)) && IsConst(Back(1), I32_CONST, 0) && Back().Is(I32_NE)) {
+      Pop(2);
+      return true;
+    }
+    if (Tail(3) && IsConst(Back(2), I32_CONST, 0) && Back(1).Is(I32_NE) && (Back().Is(BR_IF) || Back().Is(I32_EQZ))) {
+      std::swap(Back(2), Back());
+      Pop(2);
+      return true;
+    }
+    return false;
+  }
+
+  // (i32.const 0) (i32.eq)  =>  (i32.eqz)
+  bool EqualZero() {
+    if (!Tail(2) || !IsConst(Back(1), I32_CONST, 0) || !Back().Is(I32_EQ)) return false;
+    Pop();
+    Change(Back(), I32_EQZ);
+    return true;
+  }
+
+  // An int converted to a double converts back exactly; a constant int converts right away.
+  bool Conversions() {
+    if (Tail(2) && Back(1).Is(F64_CONVERT_I32_S) && Back().Is(I32_TRUNC_F64_S)) {
+      Pop(2);
+      return true;
+    }
+    if (Tail(2) && Back(1).Is(I32_CONST) && Back().Is(F64_CONVERT_I32_S)) {
+      Pop();
+      Change(Back(), F64_CONST);
+      Back().instr.f64 = Back().instr.value;    // Every int32 is exactly a double.
+      Back().instr.value = 0;
+      return true;
+    }
+    return false;
+  }
+
+  // Unary minus is generated as 0 - x, which differs from f64.neg only in the sign of a zero
+  // result; when that result is only compared, truncated, or made absolute, f64.neg is the same.
+  bool Negate() {
+    if (out.empty()) return false;
+    const Instr & user = Back();
+    int operands = 0;
+    if (user.Is(F64_ABS) || user.Is(I32_TRUNC_F64_S)) operands = 1;
+    else if (user.IsOp() && user.instr.op->code >= F64_EQ && user.instr.op->code <= F64_GE) operands = 2;
+
+    size_t end = out.size() - 1;
+    for (int i = 0; i < operands; ++i) {
+      auto start = OperandStart(end);
+      if (!start) return false;
+      if (out[end - 1].Is(F64_SUB) && *start + 1 < end - 1 && IsConst(out[*start], F64_CONST, 0.0)) {
+        auto rhs_start = OperandStart(end - 1);
+        if (rhs_start && *rhs_start == *start + 1) {
+          Change(out[end - 1], F64_NEG);
+          out.erase(out.begin() + *start);
+          return true;
+        }
+      }
+      end = *start;
+    }
+    return false;
+  }
+
+  static const std::vector<Rule> & Rules() {
+    static const std::vector<Rule> rules{
+      {"set-get-to-tee",  &Peephole::SetGetToTee},
+      {"tee-drop-to-set", &Peephole::TeeDropToSet},
+      {"push-drop",       &Peephole::PushDrop},
+      {"invert-compare",  &Peephole::InvertCompare},
+      {"double-eqz",      &Peephole::DoubleEqz},
+      {"not-equal-zero",  &Peephole::NotEqualZero},
+      {"equal-zero",      &Peephole::EqualZero},
+      {"conversions",     &Peephole::Conversions},
+      {"negate",          &Peephole::Negate},
+    };
+    return rules;
+  }
+
+  void ApplyRules() {
+    const auto & rules = Rules();
+    for (bool again = true; again; ) {
+      again = false;
+      for (size_t id = 0; id < rules.size() && !again; ++id) {
+        cur_rule = rules[id].name;
+        if ((this->*rules[id].apply)()) {
+          ++fired[id];
+          again = true;
+        }
+      }
+    }
+  }
+
+public:
+  Peephole() : fired(Rules().size(), 0) { }
+
+  size_t NumFired() const {
+    size_t total = 0;
+    for (size_t count : fired) total += count;
+    return total;
+  }
+
+  // Rewrite the instructions on the lines of code that have not been laid out yet.
+  void Run(CodeBuffer & code) {
+    std::vector<bool> remove(code.NumPendingLines(), false);
+    out.clear();
+    for (uint32_t line = 0; line < code.NumPendingLines(); ++line) {
+      const WasmInstr & instr = code.Instr(line);
+      if (instr.kind == WasmInstr::NONE && code.LineCode(line).empty()) continue;   // Only a comment.
+      remove[line] = true;        // Kept only if it is still in the output at the end.
+      out.push_back(Instr{instr, line});
+      ApplyRules();
+    }
+
+    for (const Instr & instr : out) {
+      remove[instr.line] = false;
+      if (instr.rule.size()) {
+        code.SetInstr(instr.line, instr.instr);
+        if (!code.IsCompact()) code.SetLineComment(instr.line, "Peephole: ", instr.rule);
+      }
+    }
+    code.RemoveLines(remove);
+    out.clear();
+  }
+
+  void PrintStats(std::ostream & os) const {
+    os << "Peephole rules (" << NumFired() << " fired):\n";
+    const auto & rules = Rules();
+    for (size_t id = 0; id < rules.size(); ++id) {
+      if (fired[id]) os << "  " << std::left << std::setw(24) << rules[id].name << std::right << fired[id] << '\n';
+    }
+    if (NumFired() == 0) os << "  (none)\n";
+    os.flush();
+  }
+};
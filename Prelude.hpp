@@ -0,0 +1,351 @@
+#pragma once
+
+// The runtime prelude: helper functions called by generated code.  The helpers a program
+// uses (and any helpers those call) are spliced into its module; the rest are left out.
+//
+// GENERATED by prelude/MakePrelude from GenerateHelperWAT.hpp; do not edit.
+
+#include <cstdint>
+#include <string_view>
+
+#include "WasmEncoder.hpp"
+
+struct PreludeFunction {
+  std::string_view wat;           // Regular WAT, with comments and indentation.
+  std::string_view compact_wat;   // WAT as output by --compact.
+  WasmFunction binary;
+  uint32_t needs;                 // Bit mask of prelude functions required (itself included).
+};
+
+inline constexpr WasmCall PRELUDE_CALLS_3[] = { {6, std::string_view{"$size", 5}}, {12, std::string_view{"$size", 5}}, {24, std::string_view{"$_alloc_str", 11}}, {34, std::string_view{"$_strcpy", 8}}, {41, std::string_view{"$_i32swap", 9}}, {45, std::string_view{"$_strcpy", 8}}, };
+inline constexpr WasmCall PRELUDE_CALLS_4[] = { {6, std::string_view{"$_alloc_str", 11}}, };
+inline constexpr WasmCall PRELUDE_CALLS_6[] = { {6, std::string_view{"$size", 5}}, {22, std::string_view{"$_alloc_str", 11}}, {53, std::string_view{"$_strcpy", 8}}, };
+
+inline constexpr PreludeFunction PRELUDE_FUNCTIONS[] = {
+  { // $_alloc_str
+    std::string_view{"  ;; Function to allocate a string; add one to size and places null there.\n"
+    "  (func $_alloc_str (param $size i32) (result i32)\n"
+    "    (local $null_pos i32)                             ;; Local variable to place null terminator.\n"
+    "    (global.get $free_mem)                            ;; Old free mem is alloc start.\n"
+    "    (global.get $free_mem)                            ;; Adjust new free mem.\n"
+    "    (local.get $size)\n"
+    "    (i32.add)\n"
+    "    (local.set $null_pos)\n"
+    "    (i32.store8 (local.get $null_pos) (i32.const 0))  ;; Place null terminator.\n"
+    "    (i32.add (i32.const 1) (local.get $null_pos))\n"
+    "    (global.set $free_mem)                            ;; Update free memory start.\n"
+    "  )\n"
+    "  \n", 670},
+    std::string_view{"(func $_alloc_str (param $size i32) (result i32)\n"
+    "(local $null_pos i32)\n"
+    "(global.get $free_mem)\n"
+    "(global.get $free_mem)\n"
+    "(local.get $size)\n"
+    "(i32.add)\n"
+    "(local.set $null_pos)\n"
+    "(i32.store8 (local.get $null_pos) (i32.const 0))\n"
+    "(i32.add (i32.const 1) (local.get $null_pos))\n"
+    "(global.set $free_mem)\n"
+    ")\n", 287},
+    { std::string_view{"$_alloc_str", 11}, std::string_view{"\x60\x01\x7F\x01\x7F", 5}, std::string_view{"", 0},
+      std::string_view{"\x01\x01\x7F\x23\x00\x23\x00\x20\x00\x6A\x21\x01\x20\x01\x41\x00\x3A\x00\x00\x41\x01\x20\x01\x6A\x24\x00\x0B", 27},
+      {} },
+    1
+  },
+  { // $size
+    std::string_view{"  ;; Function to get the size of a string\n"
+    "  (func $size (param $str i32) (result i32)\n"
+    "    ;; Variables\n"
+    "    (local $len i32)\n"
+    "    (local $i i32)\n"
+    "    \n"
+    "    ;; Begin code\n"
+    "    (local.set $len (i32.const 0))            ;; Set len to 0\n"
+    "    (local.set $i (local.get $str))           ;; Set i to the starting index of str\n"
+    "    \n"
+    "    ;; Begin Loop\n"
+    "      (block $exit_while\n"
+    "        (loop $while\n"
+    "          ;; While test condition\n"
+    "          (i32.load8_u (local.get $i))              ;; Stack.push str[i]\n"
+    "          (i32.eqz)                                 ;; Check if we loaded a nullterm\n"
+    "          (br_if $exit_while)                       ;; break\n"
+    "          \n"
+    "          ;; While body\n"
+    "          (i32.add (local.get $len) (i32.const 1))  ;; len + 1\n"
+    "          (local.set $len)                          ;; len = len + 1\n"
+    "          (i32.add (local.get $i) (i32.const 1))    ;; i + 1\n"
+    "          (local.set $i)                            ;; i = i + 1\n"
+    "          (br $while)                               ;; continue\n"
+    "        )\n"
+    "      )\n"
+    "    \n"
+    "    (local.get $len)                          ;; return len\n"
+    "  )\n"
+    "  (export \"size\" (func $size))\n"
+    "  \n", 1112},
+    std::string_view{"(func $size (param $str i32) (result i32)\n"
+    "(local $len i32)\n"
+    "(local $i i32)\n"
+    "(local.set $len (i32.const 0))\n"
+    "(local.set $i (local.get $str))\n"
+    "(block $exit_while\n"
+    "(loop $while\n"
+    "(i32.load8_u (local.get $i))\n"
+    "(i32.eqz)\n"
+    "(br_if $exit_while)\n"
+    "(i32.add (local.get $len) (i32.const 1))\n"
+    "(local.set $len)\n"
+    "(i32.add (local.get $i) (i32.const 1))\n"
+    "(local.set $i)\n"
+    "(br $while)\n"
+    ")\n"
+    ")\n"
+    "(local.get $len)\n"
+    ")\n"
+    "(export \"size\" (func $size))\n", 404},
+    { std::string_view{"$size", 5}, std::string_view{"\x60\x01\x7F\x01\x7F", 5}, std::string_view{"size", 4},
+      std::string_view{"\x01\x02\x7F\x41\x00\x21\x01\x20\x00\x21\x02\x02\x40\x03\x40\x20\x02\x2D\x00\x00\x45\x0D\x01\x20\x01\x41\x01\x6A\x21\x01\x20\x02\x41\x01\x6A\x21\x02\x0C\x00\x0B\x0B\x20\x01\x0B", 44},
+      {} },
+    2
+  },
+  { // $_strcpy
+    std::string_view{"  (func $_strcpy (param $str i32) (param $dest i32) (param $amount i32) (result i32)\n"
+    "    ;; Variables\n"
+    "    (local $i i32)\n"
+    "    \n"
+    "    ;; Begin Code\n"
+    "    (local.set $i (i32.const 0))                ;; set loop counter to 0\n"
+    "    ;; Setup while\n"
+    "    (block $exit_while\n"
+    "      (loop $while\n"
+    "        (local.get $i)\n"
+    "        (local.get $amount)\n"
+    "        (i32.ge_s)                                  ;; continue if i < amount\n"
+    "        (br_if $exit_while)                         ;; break if i >= amount\n"
+    "        ;; While body\n"
+    "        (i32.add (local.get $dest) (local.get $i))  ;; get the dest location\n"
+    "        (i32.add (local.get $str) (local.get $i))   ;; get addr of str[i]\n"
+    "        (i32.load8_u)                               ;; Dereference str[i]\n"
+    "        (i32.store8)                                ;; Store\n"
+    "        \n"
+    "        ;; Increment i\n"
+    "        (i32.add (local.get $i) (i32.const 1))\n"
+    "        (local.set $i)                              ;; set i to i+1\n"
+    "        (br $while)\n"
+    "      )\n"
+    "    )\n"
+    "    (local.get $dest)                           ;; Return the starting index of new str\n"
+    "  )\n"
+    "  \n", 1067},
+    std::string_view{"(func $_strcpy (param $str i32) (param $dest i32) (param $amount i32) (result i32)\n"
+    "(local $i i32)\n"
+    "(local.set $i (i32.const 0))\n"
+    "(block $exit_while\n"
+    "(loop $while\n"
+    "(local.get $i)\n"
+    "(local.get $amount)\n"
+    "(i32.ge_s)\n"
+    "(br_if $exit_while)\n"
+    "(i32.add (local.get $dest) (local.get $i))\n"
+    "(i32.add (local.get $str) (local.get $i))\n"
+    "(i32.load8_u)\n"
+    "(i32.store8)\n"
+    "(i32.add (local.get $i) (i32.const 1))\n"
+    "(local.set $i)\n"
+    "(br $while)\n"
+    ")\n"
+    ")\n"
+    "(local.get $dest)\n"
+    ")\n", 427},
+    { std::string_view{"$_strcpy", 8}, std::string_view{"\x60\x03\x7F\x7F\x7F\x01\x7F", 7}, std::string_view{"", 0},
+      std::string_view{"\x01\x01\x7F\x41\x00\x21\x03\x02\x40\x03\x40\x20\x03\x20\x02\x4E\x0D\x01\x20\x01\x20\x03\x6A\x20\x00\x20\x03\x6A\x2D\x00\x00\x3A\x00\x00\x20\x03\x41\x01\x6A\x21\x03\x0C\x00\x0B\x0B\x20\x01\x0B", 48},
+      {} },
+    4
+  },
+  { // $_str_concat
+    std::string_view{"  (func $_str_concat (param $str1 i32) (param $str2 i32) (result i32)\n"
+    "    ;; Variables\n"
+    "    (local $size1 i32)                                 ;; str1.size\n"
+    "    (local $size2 i32)                                 ;; str2.size\n"
+    "    (local $newPos i32)                                ;; location of concatenated string\n"
+    "    \n"
+    "    ;; Code Begin\n"
+    "    (local.set $size1 (call $size (local.get $str1)))  ;; size1 = size(str1)\n"
+    "    (local.set $size2 (call $size (local.get $str2)))  ;; size2 = size(str2)\n"
+    "    (i32.add (local.get $size1) (local.get $size2))\n"
+    "    (i32.const 1)                                      ;; Add a 1 for the nullpos\n"
+    "    (i32.add)                                          ;; size1+size2+1\n"
+    "    (local.set $newPos (call $_alloc_str))             ;; (newPos = allocated_pos)\n"
+    "    \n"
+    "    ;; copy str1\n"
+    "    (local.get $str1)                                  ;; str to copy\n"
+    "    (local.get $newPos)                                ;; pos to copy to\n"
+    "    (local.get $size1)                                 ;; amount to copy (size of str1)\n"
+    "    (call $_strcpy)\n"
+    "    ;; Now copy str2\n"
+    "    (local.get $size1)                                 ;; Offset\n"
+    "    (i32.add)                                          ;; pos to copy to\n"
+    "    (local.get $str2)                                  ;; str2 copy\n"
+    "    (call $_i32swap)                                   ;; Swap dest+offset with str2\n"
+    "    (local.get $size2)                                 ;; amount to copy (size of str2)\n"
+    "    (call $_strcpy)\n"
+    "    (drop)                                             ;; We don't want the start of the seconod string\n"
+    "    \n"
+    "    (local.get $newPos)                                ;; return newStr pos\n"
+    "  )\n"
+    "  \n"
+    "  \n", 1667},
+    std::string_view{"(func $_str_concat (param $str1 i32) (param $str2 i32) (result i32)\n"
+    "(local $size1 i32)\n"
+    "(local $size2 i32)\n"
+    "(local $newPos i32)\n"
+    "(local.set $size1 (call $size (local.get $str1)))\n"
+    "(local.set $size2 (call $size (local.get $str2)))\n"
+    "(i32.add (local.get $size1) (local.get $size2))\n"
+    "(i32.const 1)\n"
+    "(i32.add)\n"
+    "(local.set $newPos (call $_alloc_str))\n"
+    "(local.get $str1)\n"
+    "(local.get $newPos)\n"
+    "(local.get $size1)\n"
+    "(call $_strcpy)\n"
+    "(local.get $size1)\n"
+    "(i32.add)\n"
+    "(local.get $str2)\n"
+    "(call $_i32swap)\n"
+    "(local.get $size2)\n"
+    "(call $_strcpy)\n"
+    "(drop)\n"
+    "(local.get $newPos)\n"
+    ")\n", 538},
+    { std::string_view{"$_str_concat", 12}, std::string_view{"\x60\x02\x7F\x7F\x01\x7F", 6}, std::string_view{"", 0},
+      std::string_view{"\x01\x03\x7F\x20\x00\x10\x01\x21\x02\x20\x01\x10\x01\x21\x03\x20\x02\x20\x03\x6A\x41\x01\x6A\x10\x00\x21\x04\x20\x00\x20\x04\x20\x02\x10\x02\x20\x02\x6A\x20\x01\x10\x05\x20\x03\x10\x02\x1A\x20\x04\x0B", 50},
+      PRELUDE_CALLS_3 },
+    47
+  },
+  { // $_char_to_string
+    std::string_view{"  (func $_char_to_string (param $char i32) (result i32)\n"
+    "    ;; Variables\n"
+    "    (local $pos i32)                                 ;; The position of the allocated char\n"
+    "    \n"
+    "    ;; Begin Code\n"
+    "    (call $_alloc_str (i32.const 2))                 ;; one for char, one for nullterm\n"
+    "    (local.set $pos)                                 ;; Sets pos to the allocated str for return\n"
+    "    (local.get $pos)                                 ;; gets the position to store.\n"
+    "    (i32.store8 (local.get $pos) (local.get $char))  ;; store $char at pos\n"
+    "    ;; pos is already on the stack so return\n"
+    "  )\n"
+    "  \n", 582},
+    std::string_view{"(func $_char_to_string (param $char i32) (result i32)\n"
+    "(local $pos i32)\n"
+    "(call $_alloc_str (i32.const 2))\n"
+    "(local.set $pos)\n"
+    "(local.get $pos)\n"
+    "(i32.store8 (local.get $pos) (local.get $char))\n"
+    ")\n", 188},
+    { std::string_view{"$_char_to_string", 16}, std::string_view{"\x60\x01\x7F\x01\x7F", 5}, std::string_view{"", 0},
+      std::string_view{"\x01\x01\x7F\x41\x02\x10\x00\x21\x01\x20\x01\x20\x01\x20\x00\x3A\x00\x00\x0B", 19},
+      PRELUDE_CALLS_4 },
+    17
+  },
+  { // $_i32swap
+    std::string_view{"  ;; Function to swap top 2 items on the stack. (both i32 version)\n"
+    "  (func $_i32swap (param $first i32) (param $second i32) (result i32 i32)\n"
+    "    ;; Variables\n"
+    "    ;; Now place them down in reverse order\n"
+    "    (local.get $second)\n"
+    "    (local.get $first)\n"
+    "  )\n"
+    "  \n", 256},
+    std::string_view{"(func $_i32swap (param $first i32) (param $second i32) (result i32 i32)\n"
+    "(local.get $second)\n"
+    "(local.get $first)\n"
+    ")\n", 113},
+    { std::string_view{"$_i32swap", 9}, std::string_view{"\x60\x02\x7F\x7F\x02\x7F\x7F", 7}, std::string_view{"", 0},
+      std::string_view{"\x00\x20\x01\x20\x00\x0B", 6},
+      {} },
+    32
+  },
+  { // $_dupe_mem
+    std::string_view{"  ;; Function to duplicate src, amt times\n"
+    "  (func $_dupe_mem (param $src i32) (param $amt i32) (result i32)\n"
+    "    ;; Variables\n"
+    "    (local $newPos i32)                               ;; start pos of allocated str\n"
+    "    (local $total i32)                                ;; The size to allocate\n"
+    "    (local $i i32)                                    ;; Loop counter\n"
+    "    (local $src_size i32)\n"
+    "    \n"
+    "    ;; Begin Code\n"
+    "    (local.get $src)\n"
+    "    (call $size)                                      ;; Get the size of str\n"
+    "    (local.set $src_size)\n"
+    "    (i32.mul (local.get $src_size) (local.get $amt))  ;; Calculate total\n"
+    "    (local.set $total)\n"
+    "    (i32.add (local.get $total) (i32.const 1))        ;; Add total_size and a nullterm\n"
+    "    (call $_alloc_str)                                ;; Allocate the space\n"
+    "    (local.set $newPos)\n"
+    "    \n"
+    "    ;; Setup while loop\n"
+    "    (local.set $i (i32.const 0))\n"
+    "    (block $exit_while\n"
+    "      (loop $while\n"
+    "        ;; Loop condition\n"
+    "        (i32.ge_s (local.get $i) (local.get $amt))        ;; i < amt\n"
+    "        (br_if $exit_while)                               ;; break if i >= amt\n"
+    "        ;; While body\n"
+    "        (local.get $src)                                  ;; arg1\n"
+    "        (i32.mul (local.get $i) (local.get $src_size))    ;; offset\n"
+    "        (local.get $newPos)                               ;; Add dest + offset\n"
+    "        (i32.add)                                         ;; pos to insert new item. arg2\n"
+    "        (local.get $src_size)                             ;; arg3\n"
+    "        (call $_strcpy)\n"
+    "        (drop)                                            ;; Not using it.\n"
+    "        ;; Increment i\n"
+    "        (local.set $i (i32.add (local.get $i) (i32.const 1)))\n"
+    "        (br $while)                                       ;; Continue the loop\n"
+    "      )                                                 ;; Close while loop\n"
+    "    )                                                 ;; Close while block\n"
+    "    (local.get $newPos)                               ;; return start of allocation addr\n"
+    "  )                                                 ;; End _dupemem\n"
+    "  \n", 2056},
+    std::string_view{"(func $_dupe_mem (param $src i32) (param $amt i32) (result i32)\n"
+    "(local $newPos i32)\n"
+    "(local $total i32)\n"
+    "(local $i i32)\n"
+    "(local $src_size i32)\n"
+    "(local.get $src)\n"
+    "(call $size)\n"
+    "(local.set $src_size)\n"
+    "(i32.mul (local.get $src_size) (local.get $amt))\n"
+    "(local.set $total)\n"
+    "(i32.add (local.get $total) (i32.const 1))\n"
+    "(call $_alloc_str)\n"
+    "(local.set $newPos)\n"
+    "(local.set $i (i32.const 0))\n"
+    "(block $exit_while\n"
+    "(loop $while\n"
+    "(i32.ge_s (local.get $i) (local.get $amt))\n"
+    "(br_if $exit_while)\n"
+    "(local.get $src)\n"
+    "(i32.mul (local.get $i) (local.get $src_size))\n"
+    "(local.get $newPos)\n"
+    "(i32.add)\n"
+    "(local.get $src_size)\n"
+    "(call $_strcpy)\n"
+    "(drop)\n"
+    "(local.set $i (i32.add (local.get $i) (i32.const 1)))\n"
+    "(br $while)\n"
+    ")\n"
+    ")\n"
+    "(local.get $newPos)\n"
+    ")\n", 697},
+    { std::string_view{"$_dupe_mem", 10}, std::string_view{"\x60\x02\x7F\x7F\x01\x7F", 6}, std::string_view{"", 0},
+      std::string_view{"\x01\x04\x7F\x20\x00\x10\x01\x21\x05\x20\x05\x20\x01\x6C\x21\x03\x20\x03\x41\x01\x6A\x10\x00\x21\x02\x41\x00\x21\x04\x02\x40\x03\x40\x20\x04\x20\x01\x4E\x0D\x01\x20\x00\x20\x04\x20\x05\x6C\x20\x02\x6A\x20\x05\x10\x02\x1A\x20\x04\x41\x01\x6A\x21\x04\x0C\x00\x0B\x0B\x20\x02\x0B", 69},
+      PRELUDE_CALLS_6 },
+    71
+  },
+};
+
+// Changes whenever any part of the prelude does; suitable as a cache key.
+inline constexpr std::string_view PRELUDE_VERSION = "f16fc658ebb20784";
@@ -1,32 +1,64 @@
 #include <assert.h>
-#include <fstream>
+#include <algorithm>
+#include <array>
+#include <cstdlib>
 #include <memory>
 #include <string>
-#include <unordered_map>
+#include <thread>
 #include <vector>
 
 #include "ASTNode.hpp"
+#include "CoalesceLocals.hpp"
 #include "Control.hpp"
+#include "DeadCode.hpp"
+#include "FoldConstants.hpp"
+#include "FoldStrings.hpp"
 #include "lexer.hpp"
+#include "PassManager.hpp"
+#include "Prelude.hpp"
+#include "SourceBuffer.hpp"
 #include "SymbolTable.hpp"
 #include "TokenQueue.hpp"
-#include "GenerateHelperWAT.hpp"
+
+// Binary operator precedence and associativity, indexed by token id.  Lower levels bind tighter.
+struct OpInfo {
+  static constexpr size_t NOT_OP = 1000;  // Level for tokens that are not binary operators.
+  size_t level = NOT_OP;
+  char assoc = 'n';   // l=left; r=right; n=non
+};
+
+constexpr std::array<OpInfo, 256> MakeOpTable() {
+  using emplex::Lexer;
+  std::array<OpInfo, 256> table{};
+  size_t cur_prec = 0;
+  table['('] = table['!'] =                                 OpInfo{cur_prec++, 'n'};
+  table['*'] = table['/'] = table['%'] =                    OpInfo{cur_prec++, 'l'};
+  table['+'] = table['-'] =                                 OpInfo{cur_prec++, 'l'};
+  table[Lexer::ID_EXPR_COMPARE] =                           OpInfo{cur_prec++, 'n'};  // < <= > >=
+  table[Lexer::ID_EXPR_COMPARE_EQ] =                        OpInfo{cur_prec++, 'n'};  // == !=
+  table[Lexer::ID_AND] =                                    OpInfo{cur_prec++, 'l'};
+  table[Lexer::ID_OR] =                                     OpInfo{cur_prec++, 'l'};
+  table['='] =                                              OpInfo{cur_prec++, 'r'};
+  return table;
+}
 
 class Tubular {
 private:
-  using ast_ptr_t = std::unique_ptr<ASTNode>;
-  using fun_ptr_t = std::unique_ptr<ASTNode_Function>;
+  using ast_ptr_t = ASTNode::ptr_t;
+  using fun_ptr_t = ASTArena::ptr_t<ASTNode_Function>;
 
   TokenQueue tokens;
   std::vector<fun_ptr_t> functions{};
 
-  struct OpInfo {
-    size_t level;
-    char assoc;   // l=left; r=right; n=non
-  };
-  std::unordered_map<std::string, OpInfo> op_map{};
+  static constexpr std::array<OpInfo, 256> op_table = MakeOpTable();
+
+  static constexpr OpInfo GetOpInfo(int token_id) {
+    return (token_id >= 0 && token_id < 256) ? op_table[static_cast<size_t>(token_id)] : OpInfo{};
+  }
 
   Control control;
+  PassManager passes;
+  bool binary = false;    // Is the output a binary module (rather than WAT)?
 
   // == HELPER FUNCTIONS
 
@@ -37,8 +69,8 @@ private:
   }
 
   template <typename NODE_T, typename... ARG_Ts>
-  static std::unique_ptr<NODE_T> MakeNode(ARG_Ts &&... args) {
-    return std::make_unique<NODE_T>( std::forward<ARG_Ts>(args)... );
+  static ASTArena::ptr_t<NODE_T> MakeNode(ARG_Ts &&... args) {
+    return NodeArena().Make<NODE_T>( std::forward<ARG_Ts>(args)... );
   }
 
   ast_ptr_t MakeVarNode(emplex::Token token) {
@@ -72,100 +104,141 @@ private:
     return MakeNode<ASTNode_ToString>(std::move(node_ptr));
   }
 
-  void SetupOperators() {
-    // Setup operator precedence.
-    size_t cur_prec = 0;
-    op_map["("]  = op_map["!"]  =               OpInfo{cur_prec++, 'n'};
-    op_map["*"]  = op_map["/"]  = op_map["%"] = OpInfo{cur_prec++, 'l'};
-    op_map["+"]  = op_map["-"]  =               OpInfo{cur_prec++, 'l'};
-    op_map["<"]  = op_map["<="] = op_map[">"] = op_map[">="] = OpInfo{cur_prec++, 'n'};
-    op_map["=="] = op_map["!="] =               OpInfo{cur_prec++, 'n'};
-    op_map["&&"] =                              OpInfo{cur_prec++, 'l'};
-    op_map["||"] =                              OpInfo{cur_prec++, 'l'};
-    op_map["="]  =                              OpInfo{cur_prec++, 'r'};
-  }
-
   void GenerateInbuiltFunctions() {
     // size function
-    std::vector<Type> param_types{Type("string")};
-    control.symbols.AddInbuiltFunction("size", param_types, Type("int"));
+    std::vector<Type> param_types{Type::String()};
+    control.symbols.AddInbuiltFunction("size", param_types, Type::Int());
   }
 
 public:
-  Tubular(std::string filename) {    
-    std::ifstream in_file(filename);              // Load the input file
-    if (in_file.fail()) {
+  Tubular(std::string filename, size_t lex_threads=1) {
+    SourceBuffer source(filename);                // Map (or read) the input file
+    if (source.Fail()) {
       std::cerr << "ERROR: Unable to open file '" << filename << "'." << std::endl;
       exit(1);
     }
 
-    tokens.Load(in_file);  // Load all tokens from the file.
+    // The queue keeps the source alive.  Lex while parsing, or lex everything up front in parallel.
+    if (lex_threads > 1) tokens.Load(std::move(source), lex_threads);
+    else tokens.Stream(std::move(source));
+
+    // Optimization passes, in the order they run.
+    passes.Add("fold-constants", OPT_ALL, FoldConstants);
+    passes.Add("fold-strings", OPT_ALL, FoldStrings);
+    passes.Add("dead-code", OPT_ALL, EliminateDeadCode);
+    passes.Add("coalesce-locals", OPT_FULL, CoalesceLocals);
+  }
+
+  // Expressions are parsed with an explicit stack of pending constructs (rather than recursion),
+  // so even machine-generated expressions with huge nesting depths cannot overflow the call stack.
+  struct ExprFrame {
+    enum Kind { EXPR, UNARY, PAREN, SQRT, INDEX, CALL };
+    Kind kind = EXPR;
+    emplex::Token token{};               // Operator or function name that started this frame.
+    size_t prec_limit = OpInfo::NOT_OP;  // EXPR: loosest operator level allowed here.
+    size_t skip_prec = OpInfo::NOT_OP;   // EXPR: if we get a non-associative op, we must skip next one.
+    OpInfo op_info{};                    // EXPR: binary operator waiting for its right-hand side.
+    ast_ptr_t node{};                    // EXPR: value so far; INDEX: variable; CALL: call node.
+    size_t num_args = 0;                 // CALL: number of parameters the function takes.
+  };
+
+  // Check to see if a term is followed by a type modifier.
+  ast_ptr_t Parse_TypeModifier(ast_ptr_t && out) {
+    if (tokens.UseIf(':')) {
+      auto type_token = tokens.Use(emplex::Lexer::ID_TYPE, "Expected a type specified after ':'.");
+      if (type_token.Lexeme() == "double") out = MakeNode<ASTNode_ToDouble>(std::move(out));
+      else if (type_token.Lexeme() == "int") out = MakeNode<ASTNode_ToInt>(std::move(out));
+      else if (type_token.Lexeme() == "string") out = MakeNode<ASTNode_ToString>(std::move(out));
+    }
+    return std::move(out);
+  }
+
+  // Start a function call (the '(' is next).  Return the call if it takes no arguments;
+  // otherwise push frames to parse the arguments and return nullptr.
+  ast_ptr_t Parse_Function_Call(emplex::Token fun_token, std::vector<ExprFrame> & stack) {
+    tokens.Use(); // Use the '(' token initiating a function call
+
+    size_t fun_id = control.symbols.GetVarID(fun_token);
+    const Type & fun_type = control.symbols.GetType(fun_id);
+
+    if (!fun_type.IsFunction()) // treated a variable as if it's a function
+    {
+      Error(fun_token, fun_token.Lexeme(), " cannot be used as a function");
+    }
+
+    ast_ptr_t fun_call = MakeNode<ASTNode_Function_Call>(fun_token, fun_id);
+    if (fun_type.NumParams() == 0) {
+      tokens.Use(')'); // Expecting an end of function call
+      return fun_call;
+    }
 
-    SetupOperators();
+    stack.push_back(ExprFrame{ExprFrame::CALL, fun_token});
+    stack.back().node = std::move(fun_call);
+    stack.back().num_args = fun_type.NumParams();
+    stack.push_back(ExprFrame{ExprFrame::EXPR, fun_token});
+    return nullptr;
   }
 
   // Convert any token representing a unary value into an ASTNode.
-  // (i.e., a leaf in an expression and associated unary operators)
-  ast_ptr_t Parse_UnaryTerm() {
-    const emplex::Token & token = tokens.Use();
+  // (i.e., a leaf in an expression)  Prefix operators and terms that contain full expressions
+  // push a frame onto the stack instead and return nullptr.
+  ast_ptr_t Parse_UnaryTerm(std::vector<ExprFrame> & stack) {
+    const emplex::Token token = tokens.Use();
 
-    if (token == '+') return Parse_UnaryTerm(); // (Operator + does nothing...)
+    if (token == '+') return nullptr; // (Operator + does nothing...)
 
     if (token == '-' || token == '!') {  // Add node for unary prefix
-      return MakeNode<ASTNode_Math1>(token, Parse_UnaryTerm());
+      stack.push_back(ExprFrame{ExprFrame::UNARY, token});
+      return nullptr;
     }
 
     // Check main terms.
     ast_ptr_t out;
     switch (token.id) {
     case '(': // Allow full expressions in parentheses.
-      out = Parse_Expression();
-      tokens.Use(')');
-      break;
+      stack.push_back(ExprFrame{ExprFrame::PAREN, token});
+      stack.push_back(ExprFrame{ExprFrame::EXPR, token});
+      return nullptr;
     case emplex::Lexer::ID_ID:
-      if (!control.symbols.Has(token.lexeme)) {
-        Error(token, "Unknown variable '", token.lexeme, "'.");
+      if (!control.symbols.Has(token)) {
+        Error(token, "Unknown variable '", token.Lexeme(), "'.");
       }
 
       // Is it a function call or just a regular variable
-      out = Parse_ID_Expression(token);
+      if (tokens.Is('(')) return Parse_Function_Call(token, stack);
+      out = MakeVarNode(token);
+      if (tokens.UseIf('[')) {
+        // Typecheck in typecheck
+        stack.push_back(ExprFrame{ExprFrame::INDEX, token});
+        stack.back().node = std::move(out);
+        stack.push_back(ExprFrame{ExprFrame::EXPR, token});
+        return nullptr;
+      }
       break;
     case emplex::Lexer::ID_LIT_INT:
-      out = MakeNode<ASTNode_IntLit>(token, std::stoi(token.lexeme));
+      out = MakeNode<ASTNode_IntLit>(token, std::stoi(std::string(token.Lexeme())));
       break;
     case emplex::Lexer::ID_LIT_CHAR:
-      out = MakeNode<ASTNode_CharLit>(token, token.lexeme[1]);
+      out = MakeNode<ASTNode_CharLit>(token, token.Lexeme()[1]);
       break;
     case emplex::Lexer::ID_LIT_FLOAT:
-      out = MakeNode<ASTNode_FloatLit>(token, std::stod(token.lexeme));
+      out = MakeNode<ASTNode_FloatLit>(token, std::stod(std::string(token.Lexeme())));
       break;
     case emplex::Lexer::ID_SQRT:
       tokens.Use('(');
-      out = PromoteToDouble(Parse_Expression());
-      tokens.Use(')');
-      out = MakeNode<ASTNode_Math1>(token, std::move(out));
-      break;
-    
+      stack.push_back(ExprFrame{ExprFrame::SQRT, token});
+      stack.push_back(ExprFrame{ExprFrame::EXPR, token});
+      return nullptr;
+
     case emplex::Lexer::ID_SIZE:
-      out = Parse_Function_Call(token);
-      break;
-    
+      return Parse_Function_Call(token, stack);
+
     case emplex::Lexer::ID_LIT_STRING:
       out = MakeNode<ASTNode_StringLit>(token);
       break;
 
     default:
-      Error(token, "Unexpected token '", token.lexeme, "'");
-    }
-
-    // @CAO Check for '(' or '[' to know if this is a function call or array index?
-
-    // Check to see if the term is followed by a type modifier.
-    if (tokens.UseIf(':')) {
-      auto type_token = tokens.Use(emplex::Lexer::ID_TYPE, "Expected a type specified after ':'.");
-      if (type_token.lexeme == "double") out = MakeNode<ASTNode_ToDouble>(std::move(out));
-      else if (type_token.lexeme == "int") out = MakeNode<ASTNode_ToInt>(std::move(out));
-      else if (type_token.lexeme == "string") out = MakeNode<ASTNode_ToString>(std::move(out));
+      Error(token, "Unexpected token '", token.Lexeme(), "'");
     }
 
     return out;
@@ -173,58 +246,94 @@ public:
 
   // Parse expressions.  The level input determines how restrictive this parse should be.
   // Only continue processing with types at the target level or higher.
-  ast_ptr_t Parse_Expression(size_t prec_limit=1000) {
-    // Any expression must begin with a variable name or a literal value.
-    ast_ptr_t cur_node = Parse_UnaryTerm();
-
-    size_t skip_prec = 1000; // If we get a non-associative op, we must skip next one.
-
-    // While there are more tokens to process, try to expand this expression.
-    while (tokens.Any()) {
-      // Peek at the next token; if it is an op, keep going and get its info.
-      auto op_token = tokens.Peek();
-      if (!op_map.count(op_token.lexeme)) break;  // Not an op token; stop here!
-      OpInfo op_info = op_map[op_token.lexeme];
-
-      // If precedence of next operator is too high, return what we have.
-      if (op_info.level > prec_limit) break;
-
-      // If the next precedence is not allowed, throw an error.
-      if (op_info.level == skip_prec) {
-        Error(op_token, "Operator '", op_token.lexeme, "' is non-associative.");
+  ast_ptr_t Parse_Expression(size_t prec_limit=OpInfo::NOT_OP) {
+    std::vector<ExprFrame> stack;
+    stack.push_back(ExprFrame{ExprFrame::EXPR, tokens.Peek(), prec_limit});
+
+    ast_ptr_t value;  // A finished term or sub-expression to hand to the frame on top of the stack.
+    while (true) {
+      // Any expression must begin with a variable name or a literal value.
+      if (!value) {
+        value = Parse_UnaryTerm(stack);
+        if (!value) continue;
+        value = Parse_TypeModifier(std::move(value));
       }
 
-      // If we made it here, we have a binary operation to use, so consume it.
-      tokens.Use();
-
-      // Find the allowed precedence for the next term.
-      size_t next_limit = op_info.level;
-      if (op_info.assoc != 'r') --next_limit;
-
-      // Load the next term.
-      ast_ptr_t node2 = std::move(Parse_Expression(next_limit));
-
-      auto node1Type = cur_node.get()->ReturnType(control.symbols);
-      auto node2Type = node2.get()->ReturnType(control.symbols);
-
-      /*
-      if (node1Type.IsString() && node2Type.IsChar())
-      {
-        node2 = PromoteToString(std::move(node2));
+      ExprFrame & frame = stack.back();
+      switch (frame.kind) {
+      case ExprFrame::EXPR: {
+        // Build the new node (or start with the first term).
+        if (frame.node) {
+          frame.node = MakeNode<ASTNode_Math2>(frame.token, std::move(frame.node), std::move(value));
+          // If operator is non-associative, skip the current precedence for next loop.
+          frame.skip_prec = (frame.op_info.assoc == 'n') ? frame.op_info.level : OpInfo::NOT_OP;
+        }
+        else frame.node = std::move(value);
+
+        // Peek at the next token; if it is an op, keep going and get its info.
+        const emplex::Token op_token = tokens.Peek();
+        const OpInfo op_info = GetOpInfo(op_token.id);
+
+        // If this is not an op or its precedence is too high, this expression is done.
+        if (tokens.None() || op_info.level == OpInfo::NOT_OP || op_info.level > frame.prec_limit) {
+          value = std::move(frame.node);
+          stack.pop_back();
+          if (stack.empty()) return value;
+          continue;
+        }
+
+        // If the next precedence is not allowed, throw an error.
+        if (op_info.level == frame.skip_prec) {
+          Error(op_token, "Operator '", op_token.Lexeme(), "' is non-associative.");
+        }
+
+        // If we made it here, we have a binary operation to use, so consume it.
+        tokens.Use();
+        frame.token = op_token;
+        frame.op_info = op_info;
+
+        // Find the allowed precedence for the next term, then load it.
+        size_t next_limit = op_info.level;
+        if (op_info.assoc != 'r') --next_limit;
+        stack.push_back(ExprFrame{ExprFrame::EXPR, op_token, next_limit});
+        break;
+      }
+      case ExprFrame::UNARY:
+        value = MakeNode<ASTNode_Math1>(frame.token, std::move(value));
+        stack.pop_back();
+        break;
+      case ExprFrame::PAREN:
+        tokens.Use(')');
+        stack.pop_back();
+        value = Parse_TypeModifier(std::move(value));
+        break;
+      case ExprFrame::SQRT: {
+        ast_ptr_t arg = PromoteToDouble(std::move(value));
+        tokens.Use(')');
+        value = Parse_TypeModifier(MakeNode<ASTNode_Math1>(frame.token, std::move(arg)));
+        stack.pop_back();
+        break;
+      }
+      case ExprFrame::INDEX:
+        tokens.Use(']');
+        value = MakeNode<ASTNode_Index>(std::move(frame.node), std::move(value));
+        stack.pop_back();
+        value = Parse_TypeModifier(std::move(value));
+        break;
+      case ExprFrame::CALL:
+        // Type mismatch checks happen during code generation.
+        frame.node->AddChild(std::move(value));
+        if (tokens.UseIf(',') && frame.node->NumChildren() < frame.num_args) {
+          stack.push_back(ExprFrame{ExprFrame::EXPR, frame.token});  // Parse the next argument.
+          break;
+        }
+        tokens.Use(')'); // Expecting an end of function call
+        value = std::move(frame.node);
+        stack.pop_back();
+        value = Parse_TypeModifier(std::move(value));
+        break;
       }
-      else if (node1Type.IsChar() && node2Type.IsString())
-      {
-        cur_node = PromoteToString(std::move(cur_node));
-      } */
-
-      // Build the new node.
-      cur_node = MakeNode<ASTNode_Math2>(op_token, std::move(cur_node), std::move(node2));
-
-      // If operator is non-associative, skip the current precedence for next loop.
-      skip_prec = (op_info.assoc == 'n') ? op_info.level : 1000;
     }
-
-    return cur_node;
   }
 
   ast_ptr_t Parse_Statement() {
@@ -253,16 +362,12 @@ public:
     if (tokens.UseIf(';')) {
       return nullptr;  // Variable added, nothing else to do.
     }
-    auto op_token =
-      tokens.Use('=', "Expected ';' or '=' after declaration of variable '", id_token.lexeme, "'.");
+    tokens.Use('=', "Expected ';' or '=' after declaration of variable '", id_token.Lexeme(), "'.");
     auto rhs_node = Parse_Expression();
     tokens.Use(';');
 
     auto lhs_node = MakeVarNode(id_token);
-    Type lhs_type = lhs_node->ReturnType(control.symbols);
-    Type rhs_type = rhs_node->ReturnType(control.symbols);
-
-    return MakeNode<ASTNode_Math2>(id_token, "=", std::move(lhs_node), std::move(rhs_node));
+    return MakeNode<ASTNode_Math2>(id_token, OpCode::ASSIGN, std::move(lhs_node), std::move(rhs_node));
   }
 
   ast_ptr_t Parse_Statement_If() {
@@ -325,60 +430,6 @@ public:
     return out_node;
   }
 
-  ast_ptr_t Parse_Function_Call(emplex::Token fun_token) {
-  // At this point, fun_token is the token containing the function name
-  
-  tokens.Use(); // Use the '(' token initiating a function call
-
-  size_t fun_id = control.symbols.GetVarID(fun_token.lexeme);
-  Type fun_type = control.symbols.GetType(fun_id);
-
-  if (!fun_type.IsFunction()) // treated a variable as if it's a function
-  {
-    Error(fun_token, fun_token.lexeme, " cannot be used as a function");
-  }
-
-  // std::string str = ToString("function information:\nFunction id: ", fun_id, "\n Function name: ",
-  //   fun_token.lexeme, "\nFunction return type: ", fun_type.ReturnType().ToWAT());
-
-  // std::cout << str << std::endl;
-
-  auto fun_call = MakeNode<ASTNode_Function_Call>(fun_token, fun_id);
-
-  for (size_t i = 0; i < fun_type.NumParams(); ++i) {
-    //ast_ptr_t arg = Parse_Statement_Expression();
-    auto arg = Parse_Expression();  // Can be inlined. Just for debugging rn
-    
-    // Type mismatch check can happen here. Might just do it in TypeCheck
-    fun_call.get()->AddChild(std::move(arg));
-    if (!tokens.UseIf(',')) {
-      break;  // Break if we don't separate
-    }
-  }
-
-  tokens.Use(')'); // Expecting an end of function call
-
-  return fun_call;
-}
-
-  ast_ptr_t Parse_ID_Expression(emplex::Token token) 
-  {
-
-    if (tokens.Is('(')) {return Parse_Function_Call(token); }
-    auto varNode =  MakeVarNode(token);
-
-    if (tokens.UseIf('[')) {
-      // Typecheck in typecheck
-      ast_ptr_t index = Parse_Expression();
-      tokens.Use(']');
-
-      return MakeNode<ASTNode_Index>(std::move(varNode), std::move(index));
-    }
-
-    return varNode;
-  }
-
-
   // A function has the format:
   //    function ID ( PARAMETERS ) : TYPE { STATEMENT_BLOCK }
   //    The initial ID is the function name.
@@ -389,6 +440,7 @@ public:
     using namespace emplex;
     tokens.Use(Lexer::ID_FUNCTION, "Outermost scope must define functions.");
     control.symbols.PushScope();  // Enter a special scope for the function.
+    control.symbols.ClearFunctionVars();  // Parameters are the first variables of the function.
     auto name_token = tokens.Use(Lexer::ID_ID, "Function must have a name.");
     tokens.Use('(', "Function declaration must have '(' after name.");
     std::vector<size_t> param_ids;
@@ -401,7 +453,7 @@ public:
       size_t param_id = control.symbols.AddVar(type_token, id_token);
       param_ids.push_back(param_id);
       if (!tokens.UseIf(',') && !tokens.Is(')')) {
-        TriggerError("Parameters must be separated by commas (','; found '", tokens.Peek().lexeme, "'.");
+        TriggerError("Parameters must be separated by commas (','; found '", tokens.Peek().Lexeme(), "'.");
       }
     }
     tokens.Use(':');
@@ -411,12 +463,11 @@ public:
     size_t fun_id = control.symbols.AddFunction(name_token, param_types, return_type);
 
     // Now parse the body of this function.
-    control.symbols.ClearFunctionVars();
     ast_ptr_t body = Parse_StatementList();
     control.symbols.PopScope(); // Leave the function scope.
 
     if (!body->IsReturn()) {
-      Error(name_token, "Function '", name_token.lexeme, "' must guarantee a return statement through all paths.");
+      Error(name_token, "Function '", name_token.Lexeme(), "' must guarantee a return statement through all paths.");
     }
 
     auto out_node = MakeNode<ASTNode_Function>(name_token, fun_id, param_ids, std::move(body));
@@ -432,7 +483,8 @@ public:
 
     while (tokens.Any()) {
       functions.push_back( Parse_Function() );
-      functions.back()->TypeCheck(control.symbols);
+      TypeCheckTree(*functions.back(), control.symbols);
+      passes.Run(*functions.back(), control.symbols);
     }
   }
 
@@ -444,33 +496,16 @@ public:
     control.CommentLine(";; Define a memory block with ten pages (64KB)");
     control.Code("(memory (export \"memory\") 1)");
     for (auto & fun_ptr : functions) {
-      fun_ptr->InitializeWAT(control);
+      InitializeTreeWAT(*fun_ptr, control);
     }
     control.Code("(global $free_mem (mut i32) (i32.const ", control.wat_mem_pos, "))")
            .Code("");
 
-    control.Code(";; Function to allocate a string; add one to size and places null there.")
-           .Code("(func $_alloc_str (param $size i32) (result i32)")
-           .Code("  (local $null_pos i32) ;; Local variable to place null terminator.")
-           .Code("  (global.get $free_mem)").Comment("Old free mem is alloc start.")
-           .Code("  (global.get $free_mem)").Comment("Adjust new free mem.")
-           .Code("  (local.get $size)")
-           .Code("  (i32.add)")
-           .Code("  (local.set $null_pos)")
-           .Code("  (i32.store8 (local.get $null_pos) (i32.const 0))").Comment("Place null terminator.")
-           .Code("  (i32.add (i32.const 1) (local.get $null_pos))")
-           .Code("  (global.set $free_mem)").Comment("Update free memory start.")
-           .Code(")")
-           .Code("");
-
-    // Generate the size function
-    GenerateSizeFunction(control);
-    GenerateStrCpy(control);
-    // Generate the str_concat function
-    GenerateStrConcat(control);
-    GenerateCharToString(control);
-    GenerateI32Swap(control);
-    GenerateDupeMem(control);
+    // The runtime helpers are pre-rendered, and only those that the code uses are included, so
+    // they are added once all other code is generated.  Binary output splices in their encoded
+    // form instead.
+    if (!binary) control.CommentLine("Runtime prelude ", PRELUDE_VERSION);
+    const size_t prelude_mark = control.code.Mark();
 
     for (auto & fun_ptr : functions) {
       fun_ptr->ToWAT(control);
@@ -478,9 +513,51 @@ public:
 
     control.Indent(-2);
     control.Code(")").Comment("END program module");
+
+    if (!binary) {
+      const uint32_t needs = PreludeNeeds();
+      std::string prelude;
+      for (size_t id = 0; id < std::size(PRELUDE_FUNCTIONS); ++id) {
+        const PreludeFunction & helper = PRELUDE_FUNCTIONS[id];
+        if (needs & (1u << id)) prelude += control.code.IsCompact() ? helper.compact_wat : helper.wat;
+      }
+      control.code.InsertText(prelude_mark, prelude);
+    }
   }
 
-  void PrintCode(std::ostream& os = std::cout) const { control.PrintCode(os); }
+  // Bit mask of the prelude functions needed by the generated code (with all that they call).
+  uint32_t PreludeNeeds() const {
+    uint32_t needs = 0;
+    for (const PreludeFunction & helper : PRELUDE_FUNCTIONS) {
+      const std::string_view name = helper.binary.name.substr(1);   // Drop the '$'.
+      if (std::ranges::find(control.used_helpers, name) != control.used_helpers.end()) {
+        needs |= helper.needs;
+      }
+    }
+    return needs;
+  }
+
+  void PrintCode(std::ostream& os = std::cout) { control.PrintCode(os); }
+  void PrintWasm(std::ostream& os = std::cout) {
+    assert(binary);
+    const uint32_t needs = PreludeNeeds();
+    std::vector<WasmFunction> prelude;
+    for (size_t id = 0; id < std::size(PRELUDE_FUNCTIONS); ++id) {
+      if (needs & (1u << id)) prelude.push_back(PRELUDE_FUNCTIONS[id].binary);
+    }
+    control.PrintWasm(os, prelude);
+  }
+  void Compact(bool in=true) { control.Compact(in); }
+  void Binary(bool in=true) { binary = in; control.Binary(in); }
+  void Optimize(OptLevel level) {
+    passes.SetLevel(level);
+    control.UsePeephole(OPT_ALL & OptBit(level));
+  }
+  void KeepStats(bool in=true) { passes.KeepStats(in); }
+  void PrintStats(std::ostream & os = std::cerr) const {
+    passes.PrintStats(os);
+    control.peephole.PrintStats(os);
+  }
   void PrintSymbols() const { control.symbols.Print(); }
   void PrintAST() const {
     for (auto & fun_ptr : functions) {
@@ -492,13 +569,42 @@ public:
 
 int main(int argc, char * argv[])
 {
-  if (argc != 2) {
-    std::cout << "Format: " << argv[0] << " [filename]" << std::endl;
+  std::string filename;
+  size_t lex_threads = 1;
+  bool compact = false;
+  bool wasm = false;
+  bool stats = false;
+  OptLevel opt_level = OptLevel::O0;
+  bool bad_args = false;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "-j" && i+1 < argc) {
+      lex_threads = std::strtoul(argv[++i], nullptr, 10);
+      if (lex_threads == 0) lex_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    else if (arg == "--compact") compact = true;
+    else if (arg == "--wasm") wasm = true;
+    else if (arg == "--stats") stats = true;
+    else if (ToOptLevel(arg)) opt_level = *ToOptLevel(arg);
+    else if (filename.empty()) filename = arg;
+    else bad_args = true;
+  }
+  if (filename.empty() || bad_args) {
+    std::cout << "Format: " << argv[0] << " [-j THREADS] [-O0|-O1|-O2|-Os] [--stats] [--compact] [--wasm] [filename]\n"
+              << "  (use '-' as the filename to read from standard input)\n"
+              << "  -j THREADS  Lex large inputs on multiple threads (0 = one per core).\n"
+              << "  -O0 ... -Os Optimization level: none (default), basic, full for speed, full for size.\n"
+              << "  --stats     Report the time and effect of each optimization pass (to standard error).\n"
+              << "  --compact   Output minimal WAT, without comments, indentation, or blank lines.\n"
+              << "  --wasm      Output a binary WebAssembly module instead of WAT." << std::endl;
     exit(1);
   }
 
-
-  Tubular prog(argv[1]);
+  Tubular prog(filename, lex_threads);
+  prog.Compact(compact);
+  prog.Binary(wasm);
+  prog.Optimize(opt_level);
+  prog.KeepStats(stats);
   prog.Parse();
 
   // prog.PrintSymbols();
@@ -509,16 +615,15 @@ int main(int argc, char * argv[])
   // prog.PrintSymbols();
   // prog.PrintAST();
 
-  if (std::string(argv[1]) == std::string("experiments/ez_test"))
+  if (wasm)
   {
-    std::ofstream os("experiments/ez.wat");
-    prog.PrintCode(os);
-    os.close();
-    std::system("cd experiments && wat2wasm ez.wat");
+    prog.PrintWasm();
   }
   else
   {
     prog.PrintCode();
   }
+
+  if (stats) prog.PrintStats();
   
 }
@@ -0,0 +1,220 @@
+#pragma once
+
+// Vectorized scanning kernels for the lexer.
+//
+// While the DFA sits in a state that loops back to itself (whitespace, identifier bodies, line
+// and block comments), every byte up to the first one outside that state's loop set can be
+// consumed without consulting the transition table.  These kernels find the end of such a run
+// 16 (SSE2) or 32 (AVX2) bytes at a time and count the newlines they pass over.  The widest
+// kernel the CPU supports is selected at runtime; a scalar version covers everything else.
+//
+// Example usage:
+//   size_t newlines = 0;
+//   const char * last_newline = nullptr;
+//   pos = scan::SkipRun(scan::RunKind::WHITESPACE, pos, end, newlines, last_newline);
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)  // SSE2 is part of the x86-64 baseline; AVX2 is checked at runtime.
+#include <immintrin.h>
+#define SCAN_KERNELS_X86 1
+#endif
+
+namespace scan {
+
+  enum class RunKind : uint8_t { NONE=0, WHITESPACE, IDENTIFIER, LINE_COMMENT, BLOCK_COMMENT };
+  enum class Level { SCALAR=0, SSE2, AVX2 };
+
+  // Bytes a run of the given kind may contain.  Control bytes (< 9) and non-ASCII bytes are never
+  // part of a run, so the lexer's regular per-byte path handles them.
+  constexpr bool InRun(RunKind kind, unsigned char c) {
+    switch (kind) {
+    case RunKind::WHITESPACE:    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    case RunKind::IDENTIFIER:    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                                        (c >= '0' && c <= '9') || c == '_';
+    case RunKind::LINE_COMMENT:  return c >= 9 && c < 128 && c != '\n';
+    case RunKind::BLOCK_COMMENT: return c >= 9 && c < 128 && c != '*';
+    default: return false;
+    }
+  }
+
+  // Can runs of this kind span multiple lines?
+  constexpr bool HasNewlines(RunKind kind) { return InRun(kind, '\n'); }
+
+  // ---------- Scalar kernels ----------
+
+  template <RunKind KIND>
+  const char * SkipRunScalar(const char * pos, const char * end,
+                             size_t & newlines, const char *& last_newline) {
+    for (; pos < end && InRun(KIND, static_cast<unsigned char>(*pos)); ++pos) {
+      if (HasNewlines(KIND) && *pos == '\n') { ++newlines; last_newline = pos; }
+    }
+    return pos;
+  }
+
+#ifdef SCAN_KERNELS_X86
+  // ---------- SSE2 kernels (16 bytes per step) ----------
+
+  // Signed-byte range test; non-ASCII bytes are negative and so fall outside any ASCII range.
+  inline __m128i InRange128(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(hi + 1))));
+  }
+
+  template <RunKind KIND>
+  inline __m128i Match128(__m128i v) {
+    if constexpr (KIND == RunKind::WHITESPACE) {
+      return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                       _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                          _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                                       _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+    } else if constexpr (KIND == RunKind::IDENTIFIER) {
+      const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));  // Fold case for letters.
+      return _mm_or_si128(_mm_or_si128(InRange128(lower, 'a', 'z'), InRange128(v, '0', '9')),
+                          _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    } else {
+      const char excluded = (KIND == RunKind::LINE_COMMENT) ? '\n' : '*';
+      return _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(excluded)),
+                              _mm_cmpgt_epi8(v, _mm_set1_epi8(8)));
+    }
+  }
+
+  template <RunKind KIND>
+  const char * SkipRunSSE2(const char * pos, const char * end,
+                           size_t & newlines, const char *& last_newline) {
+    while (end - pos >= 16) {
+      const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+      const uint32_t stops = ~static_cast<uint32_t>(_mm_movemask_epi8(Match128<KIND>(chunk))) & 0xFFFFu;
+      if constexpr (HasNewlines(KIND)) {
+        const uint32_t in_run = stops ? (stops & (0u - stops)) - 1 : 0xFFFFu;
+        const uint32_t nl = static_cast<uint32_t>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')))) & in_run;
+        if (nl) {
+          newlines += static_cast<size_t>(std::popcount(nl));
+          last_newline = pos + (31 - std::countl_zero(nl));
+        }
+      }
+      if (stops) return pos + std::countr_zero(stops);
+      pos += 16;
+    }
+    return SkipRunScalar<KIND>(pos, end, newlines, last_newline);
+  }
+
+  // ---------- AVX2 kernels (32 bytes per step) ----------
+
+  __attribute__((target("avx2")))
+  inline __m256i InRange256(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(static_cast<char>(lo - 1))),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), v));
+  }
+
+  template <RunKind KIND>
+  __attribute__((target("avx2")))
+  inline __m256i Match256(__m256i v) {
+    if constexpr (KIND == RunKind::WHITESPACE) {
+      return _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                             _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                             _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+                                             _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+    } else if constexpr (KIND == RunKind::IDENTIFIER) {
+      const __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));  // Fold case for letters.
+      return _mm256_or_si256(_mm256_or_si256(InRange256(lower, 'a', 'z'), InRange256(v, '0', '9')),
+                             _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    } else {
+      const char excluded = (KIND == RunKind::LINE_COMMENT) ? '\n' : '*';
+      return _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(excluded)),
+                                 _mm256_cmpgt_epi8(v, _mm256_set1_epi8(8)));
+    }
+  }
+
+  template <RunKind KIND>
+  __attribute__((target("avx2")))
+  const char * SkipRunAVX2(const char * pos, const char * end,
+                           size_t & newlines, const char *& last_newline) {
+    while (end - pos >= 32) {
+      const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pos));
+      const uint32_t stops = ~static_cast<uint32_t>(_mm256_movemask_epi8(Match256<KIND>(chunk)));
+      if constexpr (HasNewlines(KIND)) {
+        const uint32_t in_run = stops ? (stops & (0u - stops)) - 1 : 0xFFFFFFFFu;
+        const uint32_t nl = static_cast<uint32_t>(
+          _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n')))) & in_run;
+        if (nl) {
+          newlines += static_cast<size_t>(std::popcount(nl));
+          last_newline = pos + (31 - std::countl_zero(nl));
+        }
+      }
+      if (stops) return pos + std::countr_zero(stops);
+      pos += 32;
+    }
+    return SkipRunSSE2<KIND>(pos, end, newlines, last_newline);
+  }
+#endif // SCAN_KERNELS_X86
+
+  // ---------- Runtime dispatch ----------
+
+  using kernel_t = const char * (*)(const char *, const char *, size_t &, const char *&);
+
+  struct KernelSet {
+    Level level = Level::SCALAR;
+    kernel_t kernels[5] = { nullptr, nullptr, nullptr, nullptr, nullptr };  // Indexed by RunKind.
+  };
+
+  inline KernelSet MakeKernelSet(Level level) {
+    KernelSet out;
+    out.level = Level::SCALAR;
+    out.kernels[1] = SkipRunScalar<RunKind::WHITESPACE>;
+    out.kernels[2] = SkipRunScalar<RunKind::IDENTIFIER>;
+    out.kernels[3] = SkipRunScalar<RunKind::LINE_COMMENT>;
+    out.kernels[4] = SkipRunScalar<RunKind::BLOCK_COMMENT>;
+#ifdef SCAN_KERNELS_X86
+    if (level >= Level::SSE2) {
+      out.level = Level::SSE2;
+      out.kernels[1] = SkipRunSSE2<RunKind::WHITESPACE>;
+      out.kernels[2] = SkipRunSSE2<RunKind::IDENTIFIER>;
+      out.kernels[3] = SkipRunSSE2<RunKind::LINE_COMMENT>;
+      out.kernels[4] = SkipRunSSE2<RunKind::BLOCK_COMMENT>;
+    }
+    if (level >= Level::AVX2 && __builtin_cpu_supports("avx2")) {
+      out.level = Level::AVX2;
+      out.kernels[1] = SkipRunAVX2<RunKind::WHITESPACE>;
+      out.kernels[2] = SkipRunAVX2<RunKind::IDENTIFIER>;
+      out.kernels[3] = SkipRunAVX2<RunKind::LINE_COMMENT>;
+      out.kernels[4] = SkipRunAVX2<RunKind::BLOCK_COMMENT>;
+    }
+#else
+    (void) level;
+#endif
+    return out;
+  }
+
+  // The active kernels; start with the best the CPU supports.
+  inline KernelSet & ActiveKernels() {
+    static KernelSet active = MakeKernelSet(Level::AVX2);
+    return active;
+  }
+
+  // Force a particular kernel level (capped at what the CPU supports); returns the level used.
+  inline Level SelectLevel(Level level) {
+    ActiveKernels() = MakeKernelSet(level);
+    return ActiveKernels().level;
+  }
+
+  inline Level ActiveLevel() { return ActiveKernels().level; }
+
+  inline const char * LevelName(Level level) {
+    switch (level) {
+    case Level::AVX2: return "AVX2";
+    case Level::SSE2: return "SSE2";
+    default: return "scalar";
+    }
+  }
+
+  // Skip past the run of 'kind' bytes starting at pos; count newlines and track the last one.
+  inline const char * SkipRun(RunKind kind, const char * pos, const char * end,
+                              size_t & newlines, const char *& last_newline) {
+    return ActiveKernels().kernels[static_cast<size_t>(kind)](pos, end, newlines, last_newline);
+  }
+
+} // End of namespace scan
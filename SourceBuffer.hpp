@@ -0,0 +1,124 @@
+#pragma once
+
+// A read-only view of an entire source file.
+//
+// Regular files are memory-mapped so the lexer can scan them in place without copying; anything
+// that cannot be mapped (pipes, stdin, character devices) is pulled in with a single bulk read().
+//
+// Example usage:
+//   SourceBuffer source(filename);  // Use "-" to read from standard input.
+//   if (source.Fail()) { ... }
+//   std::string_view text = source.View();
+//
+//   auto buffer = SourceBuffer::FromText("function ...");  // Own an in-memory string instead.
+
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class SourceBuffer {
+private:
+  const char * data = nullptr;  // Start of the source text (mapped or owned).
+  size_t size = 0;              // Number of bytes in the source text.
+  bool mapped = false;          // Is data an mmap region (true) or owned by 'contents' (false)?
+  bool fail = false;            // Did opening or reading the source fail?
+  std::string contents{};       // Storage used when the source could not be mapped.
+
+  // Read everything remaining on a file descriptor into 'contents'.
+  bool ReadAll(int fd, size_t size_hint) {
+    contents.resize(size_hint ? size_hint : 65536);
+    size_t used = 0;
+    while (true) {
+      if (used == contents.size()) contents.resize(contents.size() * 2);
+      ssize_t count = ::read(fd, contents.data() + used, contents.size() - used);
+      if (count < 0) return false;
+      if (count == 0) break;
+      used += static_cast<size_t>(count);
+    }
+    contents.resize(used);
+    data = contents.data();
+    size = used;
+    return true;
+  }
+
+  void Release() {
+    if (mapped) ::munmap(const_cast<char *>(data), size);
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    contents.clear();
+  }
+
+public:
+  SourceBuffer() { }
+  SourceBuffer(const std::string & filename) { Open(filename); }
+  SourceBuffer(const SourceBuffer &) = delete;
+  SourceBuffer(SourceBuffer && in) { *this = std::move(in); }
+  ~SourceBuffer() { Release(); }
+
+  SourceBuffer & operator=(const SourceBuffer &) = delete;
+  SourceBuffer & operator=(SourceBuffer && in) {
+    if (this == &in) return *this;
+    Release();
+    mapped = in.mapped;
+    fail = in.fail;
+    size = in.size;
+    contents = std::move(in.contents);
+    data = mapped ? in.data : contents.data();
+    in.data = nullptr;
+    in.size = 0;
+    in.mapped = false;
+    return *this;
+  }
+
+  // Build a buffer that owns a copy of in-memory source text.
+  static SourceBuffer FromText(std::string text) {
+    SourceBuffer out;
+    out.contents = std::move(text);
+    out.data = out.contents.data();
+    out.size = out.contents.size();
+    return out;
+  }
+
+  // Load the named file; "-" reads from standard input.  Returns success.
+  bool Open(const std::string & filename) {
+    Release();
+    const bool use_stdin = (filename == "-");
+    const int fd = use_stdin ? STDIN_FILENO : ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return !(fail = true);
+
+    struct stat info;
+    const bool have_info = (::fstat(fd, &info) == 0);
+    const bool is_regular = have_info && S_ISREG(info.st_mode);
+
+    fail = false;
+    if (is_regular && info.st_size > 0) {
+      void * region = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (region != MAP_FAILED) {
+        ::madvise(region, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+        data = static_cast<const char *>(region);
+        size = static_cast<size_t>(info.st_size);
+        mapped = true;
+      }
+    }
+
+    // Fall back to a bulk read for streams and anything mmap refused (empty files included).
+    if (!mapped) {
+      const size_t size_hint = is_regular ? static_cast<size_t>(info.st_size) + 1 : 0;
+      fail = !ReadAll(fd, size_hint);
+    }
+
+    if (!use_stdin) ::close(fd);
+    return !fail;
+  }
+
+  bool Fail() const { return fail; }
+  bool IsMapped() const { return mapped; }
+  size_t Size() const { return size; }
+  std::string_view View() const { return std::string_view(data ? data : "", size); }
+};
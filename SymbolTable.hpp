@@ -1,43 +1,105 @@
 #pragma once
 
+// Identifiers are looked up by atom (see AtomTable.hpp).  'bindings' holds, for each atom, the
+// innermost visible declaration, and each declaration links to the one it shadows.  Leaving a
+// scope walks an undo log of the declarations made inside it, restoring what they shadowed, so
+// a lookup is a single index no matter how deeply scopes are nested.
+//
+// Besides its global id, each variable gets a local id within its function (parameters first,
+// then locals in declaration order); those are the indices used in the generated code.
+
 #include <assert.h>
+#include <cstdint>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 
+#include "AtomTable.hpp"
 #include "lexer.hpp"
 #include "tools.hpp"
 #include "Type.hpp"
 
 class SymbolTable {
+public:
+  static constexpr size_t NO_ID = static_cast<size_t>(-1);
+
 private:
   struct VarInfo {
-    std::string name;     // Identifier for this variable.
+    uint32_t atom;        // Interned identifier for this variable.
+    uint32_t depth;       // Scope depth of the declaration (0 is global).
+    uint32_t local_id;    // Position among the variables of its function.
+    bool inbuilt;         // Is this a function provided by the runtime prelude?
     FilePos def_pos;      // Location in the file where variable was defined.
     Type type;            // Type of variable.
+    size_t shadowed;      // Declaration of the same name hidden by this one (or NO_ID).
   };
 
   // Track all of the individual variables.
   std::vector< VarInfo > var_array{};
 
-  // Track variable names in a scope to ids (positions) in var_array
-  using scope_t = std::unordered_map<std::string, size_t>;
+  // Innermost visible declaration for each atom (or NO_ID).
+  std::vector<size_t> bindings{};
 
-  // Keep a stack of active scopes as we process the file (start at global)
-  std::vector< scope_t > scope_stack{1};
+  // Declarations made inside open scopes, oldest first, and where each open scope begins.
+  std::vector<size_t> undo_log{};
+  std::vector<size_t> scope_starts{};
 
-  // Track variables that were created inside of a function body.
-  std::vector<size_t> function_vars; 
+  // Variables of the current function (parameters first), indexed by local id.
+  std::vector<size_t> function_vars;
 
-public:
-  static constexpr size_t NO_ID = static_cast<size_t>(-1);
+  uint32_t Depth() const { return static_cast<uint32_t>(scope_starts.size()); }
+
+  // Atoms for identifiers being declared are created if needed; lookups never create them.
+  static uint32_t DeclareAtom(const emplex::Token & token) {
+    return (token.atom != AtomTable::NO_ATOM) ? token.atom : Atoms().Intern(token.Lexeme());
+  }
+  static uint32_t LookupAtom(const emplex::Token & token) {
+    return (token.atom != AtomTable::NO_ATOM) ? token.atom : Atoms().Find(token.Lexeme());
+  }
+
+  size_t Binding(uint32_t atom) const {
+    return (atom < bindings.size()) ? bindings[atom] : NO_ID;
+  }
+  size_t & Binding(uint32_t atom) {
+    if (atom >= bindings.size()) bindings.resize(atom + 1, NO_ID);
+    return bindings[atom];
+  }
+
+  // Find the global declaration of an atom, below any local ones that shadow it.
+  size_t FindGlobal(uint32_t atom) const {
+    size_t id = Binding(atom);
+    while (id != NO_ID && At(id).depth > 0) id = At(id).shadowed;
+    return id;
+  }
+
+  // Add a global declaration; it goes beneath any local declarations of the same name.
+  size_t AddGlobal(uint32_t atom, FilePos def_pos, Type type, bool inbuilt=false) {
+    assert(FindGlobal(atom) == NO_ID);
+    const size_t id = var_array.size();
+    size_t & binding = Binding(atom);
+    size_t shadowed = NO_ID;
+    if (binding == NO_ID) binding = id;
+    else {
+      size_t above = binding;
+      while (At(above).shadowed != NO_ID) above = At(above).shadowed;
+      At(above).shadowed = id;
+    }
+    var_array.push_back(VarInfo{atom, 0, 0, inbuilt, def_pos, type, shadowed});
+    return id;
+  }
 
+public:
   // ----------- SCOPE MANAGEMENT ------------
 
-  void PushScope() { scope_stack.emplace_back(); }
+  void PushScope() { scope_starts.push_back(undo_log.size()); }
   void PopScope() {
-    assert(scope_stack.size() > 1); // First level is global -- do not delete!
-    scope_stack.pop_back();
+    assert(scope_starts.size() > 0); // First level is global -- do not delete!
+    while (undo_log.size() > scope_starts.back()) {
+      const VarInfo & var = At(undo_log.back());
+      bindings[var.atom] = var.shadowed;
+      undo_log.pop_back();
+    }
+    scope_starts.pop_back();
   }
 
   // ----------- CONTENTS CHECKS ------------
@@ -48,11 +110,9 @@ public:
   bool Has(size_t id) const { return id < var_array.size(); }
 
   // Test if a given identifier exists anywhere in the symbol table.
-  bool Has(std::string name) {
-    for (const scope_t & scope : scope_stack) {
-      if (scope.count(name)) return true;
-    }
-    return false;
+  bool Has(const emplex::Token & id_token) const {
+    const uint32_t atom = LookupAtom(id_token);
+    return atom != AtomTable::NO_ATOM && Binding(atom) != NO_ID;
   }
 
   // ----------- VARIABLE ACCESS ------------
@@ -67,38 +127,42 @@ public:
     return var_array[id];
   }
 
-  // Scan through symbol table, in order, to find the correct variable.
-  size_t GetVarID(std::string name) const {
-    for (auto scope_it = scope_stack.rbegin(); scope_it < scope_stack.rend(); ++scope_it) {
-      // Look for the variable in this scope; if we find it, print its ID.
-      auto var_it = scope_it->find(name);
-      if (var_it != scope_it->end()) return var_it->second;
-    }
-    assert(false); // Cannot find ID!
-    return NO_ID;  // Not found in any scope!
+  // Find the innermost visible declaration of an identifier.
+  size_t GetVarID(const emplex::Token & id_token) const {
+    const uint32_t atom = LookupAtom(id_token);
+    const size_t id = (atom == AtomTable::NO_ATOM) ? NO_ID : Binding(atom);
+    assert(id != NO_ID); // Cannot find ID!
+    return id;
   }
 
-  std::string GetName(size_t id) const { return At(id).name; }
+  const std::string & GetName(size_t id) const { return Atoms().Name(At(id).atom); }
+
+  bool IsInbuilt(size_t id) const { return At(id).inbuilt; }
+
+  // Index of a variable within its function.
+  uint32_t GetLocalID(size_t id) const { return At(id).local_id; }
+
+  // Have a variable use another local's slot (variables that are never live at once can share).
+  void SetLocalID(size_t id, uint32_t local_id) { At(id).local_id = local_id; }
 
 
   // ----------- ADDING VARIABLES and FUNCTIONS  ------------
 
   // Add a variable with the provided identifier.
-  size_t AddVar(emplex::Token type_token, emplex::Token id_token) {
+  size_t AddVar(const emplex::Token & type_token, const emplex::Token & id_token) {
     assert(id_token.id == emplex::Lexer::ID_ID);
 
-    const std::string name = id_token.lexeme;
-
-    scope_t & table = scope_stack.back();
-    if (table.count(name)) {
-      const auto & id = table[name];
-      Error(id_token, "Redeclaration of variable '", name,
-            "' (original declaration on line ", At(id).def_pos.line, ").");
+    const uint32_t atom = DeclareAtom(id_token);
+    size_t & binding = Binding(atom);
+    if (binding != NO_ID && At(binding).depth == Depth()) {
+      Error(id_token, "Redeclaration of variable '", id_token.Lexeme(),
+            "' (original declaration on line ", At(binding).def_pos.line, ").");
     }
     const size_t id = var_array.size();
-    Type type(type_token);
-    var_array.emplace_back(name, id_token, type);
-    table[name] = id;
+    const uint32_t local_id = static_cast<uint32_t>(function_vars.size());
+    var_array.push_back(VarInfo{atom, Depth(), local_id, false, id_token, Type(type_token), binding});
+    binding = id;
+    if (Depth() > 0) undo_log.push_back(id);
 
     function_vars.push_back(id); // Store this variable's ID for this function.
 
@@ -106,26 +170,19 @@ public:
   }
 
   size_t AddFunction(
-    emplex::Token id_token,
+    const emplex::Token & id_token,
     const std::vector<Type> & param_types,
     Type return_type
   ) {
     assert(id_token.id == emplex::Lexer::ID_ID);
 
-    const std::string name = id_token.lexeme;
-
     // Functions are always defined in the global scope.
-    scope_t & table = scope_stack[0]; 
-    if (table.count(name)) {
-      const auto & id = table[name];
-      Error(id_token, "Redeclaration of function '", name,
-            "' (original declaration on line ", At(id).def_pos.line, ").");
+    const uint32_t atom = DeclareAtom(id_token);
+    if (size_t prev_id = FindGlobal(atom); prev_id != NO_ID) {
+      Error(id_token, "Redeclaration of function '", id_token.Lexeme(),
+            "' (original declaration on line ", At(prev_id).def_pos.line, ").");
     }
-    const size_t id = var_array.size();
-    var_array.emplace_back(name, id_token, Type(param_types, return_type));
-    table[name] = id;
-
-    return id;
+    return AddGlobal(atom, id_token, Type(param_types, return_type));
   }
 
   /// @brief Creates an inbuilt function with pos 0,0
@@ -133,23 +190,15 @@ public:
   /// @param param_types vector of the parameter types
   /// @param return_type return type of the function
   /// @return the id to the function
-  size_t AddInbuiltFunction(const std::string& func_name, 
+  size_t AddInbuiltFunction(const std::string& func_name,
     const std::vector<Type>& param_types, Type return_type)
   {
-    emplex::Token inbuilt_token{emplex::Lexer::ID_FUNCTION, func_name, 0, 0};
-
     // Functions are always defined in the global scope.
-    scope_t & table = scope_stack[0];
-    if (table.count(func_name)) {
-      const auto & id = table[func_name];
+    const uint32_t atom = Atoms().Intern(func_name);
+    if (FindGlobal(atom) != NO_ID) {
       Error("Inbuilt function ", func_name, " already exists");
     }
-
-    const size_t id = var_array.size();
-    var_array.emplace_back(func_name, inbuilt_token, Type(param_types, return_type));
-    table[func_name] = id;
-
-    return id;
+    return AddGlobal(atom, FilePos{0, 0}, Type(param_types, return_type), true);
   }
 
   // ----------- TYPE MANAGEMENT ------------
@@ -157,18 +206,20 @@ public:
   const Type & GetType(size_t id) const { return At(id).type; }
 
   // ----------- TRACKING OF VARIABLES IN A FUNCTION BODY -------------
-  // Reset vars associated with a function (typically at the start of the next function)
+  // Reset vars associated with a function; call before its parameters are added.
   void ClearFunctionVars() { function_vars.resize(0); }
 
+  // All variables of the current function, ordered by local id.
+
   const std::vector<size_t> & GetFunctionVars() const { return function_vars; }
 
   // ----------- DEBUGGING ------------
 
   void Print() const {
     std::cout << var_array.size() << " variables found:" << std::endl;
-    for (const VarInfo & v : var_array) {
-      std::cout << " '" << v.name << "' (type: " << v.type.Name()
-                << "; defined: " << v.def_pos.ToString() << ")"
+    for (size_t id = 0; id < var_array.size(); ++id) {
+      std::cout << " '" << GetName(id) << "' (type: " << At(id).type.Name()
+                << "; defined: " << At(id).def_pos.ToString() << ")"
                 << std::endl;
     }
   }
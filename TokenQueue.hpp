@@ -2,9 +2,15 @@
 
 // A dynamic token manager.
 // 
+// Tokens are views into the source text, so the queue takes ownership of every source it loads.
+// Load() tokenizes a whole source up front; Stream() instead lexes tokens on demand as they are
+// peeked at, keeping only a small window of recent tokens (enough to Rewind()) in memory.
+//
 // Example usages:
 //   TokenQueue tokens;
-//   tokens.Load(filename);          // Load a file
+//   tokens.Load(SourceBuffer(filename));  // Load a file
+//   tokens.Stream(SourceBuffer(filename));  // ...or lex it lazily while parsing
+//   tokens.Load(SourceBuffer(filename), 8);  // ...or lex it up front on 8 threads
 //   auto token = tokens.Use();      // Get the next token and advance
 //   bool found = tokens.UseIf('$'); // Use the next token IF it is a dollar sign
 //   auto token2 = tokens.Peek();    // Get the next token _without_ advancing
@@ -14,16 +20,31 @@
 //   
 
 #include <assert.h>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <vector>
 
 #include "lexer.hpp"
+#include "ParallelLexer.hpp"
+#include "SourceBuffer.hpp"
 
 class TokenQueue {
 private:
-  emplex::Lexer lexer;
+  static constexpr size_t STREAM_WINDOW = 64;  // Tokens buffered before old ones are dropped...
+  static constexpr size_t STREAM_HISTORY = 8;  // ...keeping this many behind the current token.
+
+  // Source text that the tokens point into; held by pointer so views stay valid.
+  std::vector<std::unique_ptr<SourceBuffer>> sources{};
 
-  std::vector<emplex::Token> tokens{};
-  size_t token_id = 0;
+  // Lexing happens lazily while streaming, so even const lookups may pull in more tokens.
+  mutable emplex::Lexer lexer;
+  mutable std::vector<emplex::Token> tokens{};
+  mutable size_t token_id = 0;
+  mutable std::string_view stream_text{};  // Source still being lexed on demand.
+  mutable bool streaming = false;
 
   const emplex::Token eof_token{0, "_EOF_", 0, 0};
 
@@ -36,52 +57,102 @@ private:
     }
   }
 
+  // Lex the next non-ignored token from the stream into the buffer; return false at its end.
+  bool PullToken() const {
+    while (emplex::Token token = lexer.NextToken(stream_text)) {
+      if (emplex::Lexer::IgnoreToken(token.id)) continue;
+      emplex::Lexer::AssignAtom(token);
+      tokens.push_back(token);
+      return true;
+    }
+    streaming = false;
+    return false;
+  }
+
+  // Make sure the current token is buffered (if there is one); return whether it is.
+  bool Fill() const {
+    if (token_id < tokens.size()) return true;
+    if (!streaming) return false;
+    // Everything buffered has been used; drop all but a few tokens of history.
+    if (tokens.size() >= STREAM_WINDOW) {
+      const size_t drop = token_id - STREAM_HISTORY;
+      tokens.erase(tokens.begin(), tokens.begin() + drop);
+      token_id -= drop;
+    }
+    return PullToken();
+  }
+
+  // Finish lexing any source that is being streamed.
+  void Drain() const {
+    while (streaming) PullToken();
+  }
+
 public:
-  void Reset() { tokens.resize(0); token_id = 0; }
+  void Reset() { tokens.resize(0); token_id = 0; streaming = false; }
 
-  // Load in tokens from a stream.
-  void Load(std::istream & is) {
+  // Load in tokens from a source buffer, taking ownership of it.  Large sources can be lexed
+  // on multiple threads.
+  void Load(SourceBuffer && source, size_t num_threads=1) {
+    Drain();
     Cleanup();
-    auto new_tokens = lexer.Tokenize(is);
+    sources.push_back(std::make_unique<SourceBuffer>(std::move(source)));
+    auto new_tokens = TokenizeParallel(sources.back()->View(), num_threads);
     if (tokens.size() == 0) std::swap(tokens, new_tokens);
     else tokens.insert( tokens.end(), new_tokens.begin(), new_tokens.end() );
   }
 
-  // Load in tokens from a string.
-  void Load(const std::string & str) {
+  // Take ownership of a source buffer and lex it incrementally as tokens are requested.
+  void Stream(SourceBuffer && source) {
+    Drain();
     Cleanup();
-    auto new_tokens = lexer.Tokenize(str);
-    if (tokens.size() == 0) std::swap(tokens, new_tokens);
-    else tokens.insert( tokens.end(), new_tokens.begin(), new_tokens.end() );
+    sources.push_back(std::make_unique<SourceBuffer>(std::move(source)));
+    stream_text = sources.back()->View();
+    lexer.Restart();
+    streaming = true;
+    tokens.reserve(STREAM_WINDOW);
+  }
+
+  // Load in tokens from a stream.
+  void Load(std::istream & is) {
+    Load(SourceBuffer::FromText(
+      std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>())
+    ));
   }
 
-  // Count remaining tokens.
-  size_t Size() const { return tokens.size() - token_id; }
+  // Load in tokens from a string (a private copy is kept).
+  void Load(std::string_view str) { Load(SourceBuffer::FromText(std::string(str))); }
+
+  // Count remaining tokens (when streaming, this lexes the rest of the source).
+  size_t Size() const {
+    Drain();
+    return tokens.size() - token_id;
+  }
 
   // Test if there are ANY tokens remaining.
-  bool Any() const { return token_id < tokens.size(); }
+  bool Any() const { return Fill(); }
 
   // Test if there are NO tokens remaining.
-  bool None() const { return token_id >= tokens.size();; }
+  bool None() const { return !Fill(); }
 
   // Test if a specific token is next.
   bool Is(int id) const { return Any() && Peek() == id; }
 
   // Get the next token, but don't remove it from the queue.
-  const emplex::Token & Peek() const {
+  // (Tokens are returned by value; a streaming buffer may drop them once they are used.)
+  emplex::Token Peek() const {
     if (None()) return eof_token;
     return tokens[token_id];
   }
 
   // Get the next token, removing it from the queue.
-  const emplex::Token & Use() {
+  emplex::Token Use() {
     if (None()) return eof_token;
     return tokens[token_id++];
   }
 
   // Get and remove the next token, give provided error if is not expected id.
   template <typename... Ts>
-  const emplex::Token & Use(int id, Ts &&... message) {
+  emplex::Token Use(int id, Ts &&... message) {
     if (!Is(id)) {
       if constexpr (sizeof...(Ts) == 0) {
         Error( CurFilePos(), "Expected token of type ", emplex::Lexer::TokenName(id),
@@ -109,16 +180,16 @@ public:
   }
 
   // Get the current lexeme.
-  std::string CurLexeme() const { return Any() ? Peek().lexeme : ""; }
+  std::string CurLexeme() const { return Any() ? std::string(Peek().Lexeme()) : ""; }
 
   // Get the current line number.
-  size_t CurLine() const { return Any() ? Peek().line_id : 0; }
+  size_t CurLine() const { return Any() ? Peek().Line() : 0; }
 
   // Get the current column number.
-  size_t CurColumn() const { return Any() ? Peek().col_id : 0; }
+  size_t CurColumn() const { return Any() ? Peek().Col() : 0; }
 
   FilePos CurFilePos() const {
-    if (Any()) return FilePos{ Peek().line_id, Peek().col_id };
+    if (Any()) return FilePos{ Peek().Line(), Peek().Col() };
     else return FilePos{0,0};
   }
 
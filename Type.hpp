@@ -1,112 +1,91 @@
 #pragma once
 
+// Types are interned: a Type is a small handle pointing at a single, shared TypeInfo.
+//
+// The primitive types (char, int, double, string) are constexpr singletons, and each distinct
+// function signature is built once by the TypeInterner and reused thereafter.  Copying a Type
+// is therefore free, and two types are the same exactly when they point at the same TypeInfo.
+//
+// Example usage:
+//   Type int_type = Type::Int();
+//   Type fun_type({Type::String()}, int_type);   // int(string); same handle on every call.
+
 #include <assert.h>
-#include <memory>
+#include <cstdint>
+#include <deque>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include "lexer.hpp"
 #include "tools.hpp"
 
+struct TypeInfo;
+
 class Type {
+public:
+  enum class Kind : uint8_t { CHAR=0, INT, DOUBLE, STRING, FUNCTION };
+
 private:
-  struct Info_Char;
-  struct Info_Int;
-  struct Info_Double;
-  struct Info_String;
-  struct Info_Function;
-
-  struct Info_Base {
-    virtual ~Info_Base() { }
-
-    virtual bool IsChar() const { return false; }
-    virtual bool IsInt() const { return false; }
-    virtual bool IsDouble() const { return false; }
-    virtual bool IsString() const { return false; }
-    virtual bool IsFunction() const {return false; }
-    bool IsBase() const { return !(IsChar() || IsInt() || IsDouble()) || 
-      IsString() || IsFunction(); }
-
-    // Specialty types
-    bool IsNumeric() const { return IsChar() || IsInt() || IsDouble(); }
-    bool IsAlpha() const {return IsChar() || IsString(); }
-    bool IsIndexable() const {return IsString(); }
-
-    virtual std::string Name() const { return "void"; }
-    virtual std::string ToWAT() const { return "UNKNOWN_TYPE"; }
-
-    virtual bool IsSame(const Info_Base & in) const { assert(IsBase()); return in.IsBase(); }
-    virtual bool ConvertToOK(const Info_Base & in) const { assert(IsBase()); return in.IsBase(); }
-    virtual bool CastToOK(const Info_Base &) const { assert(IsBase()); return false; } 
-
-    bool ConvertFromOK(const Info_Base & in) const { return in.ConvertToOK(*this); }
-    bool CastFromOK(const Info_Base & in) const { return in.CastToOK(*this); }
-
-    virtual int BitCount() const { return 0; }
-
-    virtual std::unique_ptr<Info_Base> Clone() const {
-      return std::make_unique<Info_Base>();
-    }
-  };
+  const TypeInfo * info = nullptr;    // nullptr for the void type.
 
-  std::unique_ptr<Info_Base> info_ptr = nullptr;
+  constexpr explicit Type(const TypeInfo * info) : info(info) { }
+  constexpr const TypeInfo & Info() const { assert(info); return *info; }
+  constexpr bool IsKind(Kind kind) const;
 
-  // Helper functions
-  const Info_Base & Info() const { return *info_ptr; }
-  static const Info_Function & FunInfo(const Info_Base & in);
-  const Info_Function & FunInfo() const { return FunInfo(*info_ptr); }
+  friend class TypeInterner;
 
 public:
-  Type() { }  // Void type.
+  constexpr Type() = default;  // Void type.
+
+  // The primitive types.
+  static constexpr Type Char();
+  static constexpr Type Int();
+  static constexpr Type Double();
+  static constexpr Type String();
 
-  // Create a POD type from a string.
-  Type(std::string type_name);
+  // Create a POD type from its name.
+  Type(std::string_view type_name);
 
   // Create a POD type from a token.
-  Type(emplex::Token type_token) : Type(type_token.lexeme) { }
+  Type(const emplex::Token & type_token) : Type(type_token.Lexeme()) { }
 
-  // Create a Function type
+  // Create (or look up) a Function type
   Type(const std::vector<Type> & param_types, const Type & return_type);
 
-  // Move Constructor
-  Type (Type &&) = default;
-
-  // Copy Constructor
-  Type(const Type & in) {
-    if (in.info_ptr) {
-      info_ptr = in.Info().Clone();
-    }
-  }
-
-  bool IsChar() const { return info_ptr && Info().IsChar(); }
-  bool IsInt() const { return info_ptr && Info().IsInt(); }
-  bool IsDouble() const { return info_ptr && Info().IsDouble(); }
-  bool IsString() const { return info_ptr && Info().IsString(); }
-  bool IsFunction() const {return info_ptr && Info().IsFunction(); }
-  bool IsBase() const { return info_ptr && Info().IsBase(); }
-  bool IsNumeric() const { return info_ptr && Info().IsNumeric(); }
-  bool IsAlpha() const { return info_ptr && Info().IsAlpha(); }
-  bool IsIndexable() const {return info_ptr && Info().IsIndexable(); }
-
-  bool IsSame(const Type & in) const { return Info().IsSame(*in.info_ptr); }
-  bool operator==(const Type & in) const { return IsSame(in); }
+  constexpr bool IsVoid() const { return info == nullptr; }
+  constexpr bool IsChar() const { return IsKind(Kind::CHAR); }
+  constexpr bool IsInt() const { return IsKind(Kind::INT); }
+  constexpr bool IsDouble() const { return IsKind(Kind::DOUBLE); }
+  constexpr bool IsString() const { return IsKind(Kind::STRING); }
+  constexpr bool IsFunction() const { return IsKind(Kind::FUNCTION); }
+  constexpr bool IsBase() const { return IsString() || IsFunction(); }
+  constexpr bool IsNumeric() const { return IsChar() || IsInt() || IsDouble(); }
+  constexpr bool IsAlpha() const { return IsChar() || IsString(); }
+  constexpr bool IsIndexable() const { return IsString(); }
+
+  // Interned types are identical exactly when they are the same object.
+  constexpr bool IsSame(const Type & in) const { return info == in.info; }
+  constexpr bool operator==(const Type & in) const { return IsSame(in); }
 
   // Can one type be implicitly converted to another?
-  bool ConvertToOK(const Type & in) const { return Info().ConvertToOK(*in.info_ptr); }
+  constexpr bool ConvertToOK(const Type & in) const;
 
   // Can one type be implicitly converted to another?
-  bool ConvertFromOK(const Type & in) const { return Info().ConvertFromOK(*in.info_ptr); }
+  constexpr bool ConvertFromOK(const Type & in) const { return in.ConvertToOK(*this); }
 
   // Can one type be cast to another?
-  bool CastToOK(const Type & in) const { return Info().CastToOK(*in.info_ptr); }
+  constexpr bool CastToOK(const Type & in) const;
 
   // Can one type be cast to another?
-  bool CastFromOK(const Type & in) const { return Info().CastFromOK(*in.info_ptr); }
+  constexpr bool CastFromOK(const Type & in) const { return in.CastToOK(*this); }
 
-  std::string Name() const { assert(info_ptr); return Info().Name(); }
-  std::string ToWAT() const { assert(info_ptr); return Info().ToWAT(); }
+  std::string Name() const;
+  std::string ToWAT() const;
 
-  int BitCount() const { assert(info_ptr); return Info().BitCount(); }
+  constexpr int BitCount() const;
 
   // Calls that can only be run function types for more type info.
   size_t NumParams() const;
@@ -114,151 +93,143 @@ public:
   const Type & ReturnType() const;
 };
 
-struct Type::Info_Char : Type::Info_Base {
-  bool IsChar() const override { return true; }
-  std::string Name() const override { return "char"; }
-  std::string ToWAT() const override { return "i32"; }
-  int BitCount() const override { return 22; }
+static_assert(std::is_trivially_copyable_v<Type> && sizeof(Type) == sizeof(void *));
 
-  std::unique_ptr<Info_Base> Clone() const override {
-    return std::make_unique<Info_Char>();
-  }
+struct TypeInfo {
+  Type::Kind kind;
+  std::string_view name;          // Primitive types only; functions build theirs.
+  std::string_view wat;
+  int bit_count;
+  uint8_t convert_to;             // Bit mask of the kinds this type implicitly converts to.
+  uint8_t cast_to;                // Bit mask of the kinds this type can be cast to.
 
-  bool IsSame(const Info_Base & in) const override { return in.IsChar(); }
-
-  bool ConvertToOK(const Info_Base & in) const override {
-    return (in.IsChar() || in.IsInt() || in.IsDouble());
-  }
-  bool CastToOK(const Info_Base & in) const override {
-    return (in.IsChar() || in.IsInt() || in.IsDouble() || in.IsString());
-  }
+  // Function types only.
+  Type return_type{};
+  const Type * param_types = nullptr;
+  size_t num_params = 0;
 };
 
-struct Type::Info_Int : Type::Info_Base {
-  bool IsInt() const override { return true; }
-  std::string Name() const override { return "int"; }
-  std::string ToWAT() const override { return "i32"; }
-  int BitCount() const override { return 32; }
-
-  std::unique_ptr<Info_Base> Clone() const override {
-    return std::make_unique<Info_Int>();
-  }
-
-  bool IsSame(const Info_Base & in) const override { return in.IsInt(); }
+constexpr uint8_t KindBit(Type::Kind kind) { return 1 << static_cast<uint8_t>(kind); }
 
-  bool ConvertToOK(const Info_Base & in) const override {
-    return (in.IsInt() || in.IsDouble());
-  }
-  bool CastToOK(const Info_Base & in) const override {
-    return (in.IsChar() || in.IsInt() || in.IsDouble());
-  }
-};
+inline constexpr uint8_t NUMERIC_KIND_BITS =
+  KindBit(Type::Kind::CHAR) | KindBit(Type::Kind::INT) | KindBit(Type::Kind::DOUBLE);
 
-struct Type::Info_Double : Type::Info_Base {
-  bool IsDouble() const override { return true; }
-  std::string Name() const override { return "double"; }
-  std::string ToWAT() const override { return "f64"; }
-  int BitCount() const override { return 64; }
+inline constexpr TypeInfo TYPE_INFO_CHAR{ Type::Kind::CHAR, "char", "i32", 22,
+  NUMERIC_KIND_BITS, NUMERIC_KIND_BITS | KindBit(Type::Kind::STRING) };
+inline constexpr TypeInfo TYPE_INFO_INT{ Type::Kind::INT, "int", "i32", 32,
+  KindBit(Type::Kind::INT) | KindBit(Type::Kind::DOUBLE), NUMERIC_KIND_BITS };
+inline constexpr TypeInfo TYPE_INFO_DOUBLE{ Type::Kind::DOUBLE, "double", "f64", 64,
+  KindBit(Type::Kind::DOUBLE), NUMERIC_KIND_BITS };
+inline constexpr TypeInfo TYPE_INFO_STRING{ Type::Kind::STRING, "string", "i32", 99, // Set high to trump int
+  0, KindBit(Type::Kind::CHAR) };   // TODO: EC support cast to int
 
-  std::unique_ptr<Info_Base> Clone() const override {
-    return std::make_unique<Info_Double>();
-  }
+constexpr Type Type::Char() { return Type(&TYPE_INFO_CHAR); }
+constexpr Type Type::Int() { return Type(&TYPE_INFO_INT); }
+constexpr Type Type::Double() { return Type(&TYPE_INFO_DOUBLE); }
+constexpr Type Type::String() { return Type(&TYPE_INFO_STRING); }
 
-  bool IsSame(const Info_Base & in) const override { return in.IsDouble(); }
+constexpr bool Type::IsKind(Kind kind) const { return info && info->kind == kind; }
 
-  bool ConvertToOK(const Info_Base & in) const override {
-    return in.IsDouble(); // Cannot freely convert to any other type.
-  }
-  bool CastToOK(const Info_Base & in) const override {
-    return (in.IsChar() || in.IsInt() || in.IsDouble());
-  }
-};
-
-struct Type::Info_String : Type::Info_Base {
-  bool IsString() const override {return true; }
-  std::string Name() const override { return "string"; }
-  std::string ToWAT() const override {return "i32"; } // TODO: Might need more
-  int BitCount() const override {return 99; } // Set high to trump int
+constexpr bool Type::ConvertToOK(const Type & in) const {
+  if (IsFunction()) return IsSame(in);   // Functions only convert to identical functions.
+  return Info().convert_to & KindBit(in.Info().kind);
+}
 
-  std::unique_ptr<Info_Base> Clone() const override {
-    return std::make_unique<Info_String>();
-  }
+constexpr bool Type::CastToOK(const Type & in) const {
+  return Info().cast_to & KindBit(in.Info().kind);
+}
 
-  bool IsSame(const Info_Base & in) const override { return in.IsString(); }
+constexpr int Type::BitCount() const { return Info().bit_count; }
 
-  bool ConvertToOK(const Info_Base & in) const override {
-    return false; // Cannot implicitly convert to any other type
-  }
-  bool CastToOK(const Info_Base & in) const override {
-    return (in.IsChar()); // TODO: EC support cast to int
-  }
-};
+static_assert(Type::Char().ConvertToOK(Type::Double()) && !Type::Double().ConvertToOK(Type::Int()));
+static_assert(Type::String().CastToOK(Type::Char()) && !Type::String().ConvertToOK(Type::Char()));
+static_assert(Type::Int() == Type::Int() && Type::Int() != Type::Char() && Type() == Type());
 
+// Owns every function type; each signature is stored once and found again by hashing.
+class TypeInterner {
+private:
+  struct FunctionEntry {
+    std::vector<Type> param_types;
+    TypeInfo info;
+  };
 
-struct Type::Info_Function : Type::Info_Base {
-  std::vector<Type> param_types;
-  Type return_type;
+  // A signature is its return type followed by its parameter types.
+  using key_t = std::vector<const TypeInfo *>;
+  struct KeyHash {
+    size_t operator()(const key_t & key) const {
+      size_t hash = key.size();
+      for (const TypeInfo * ptr : key) {
+        hash ^= std::hash<const TypeInfo *>{}(ptr) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+      }
+      return hash;
+    }
+  };
 
-  Info_Function(const std::vector<Type> & param_types, Type return_type)
-    : param_types(param_types), return_type(return_type) { }
-  bool IsFunction() const override { return true; }
-  std::string Name() const override { return return_type.Name() + "(...)"; }
-  std::unique_ptr<Info_Base> Clone() const override {
-    return std::make_unique<Info_Function>(param_types, return_type);
-  }
+  std::deque<FunctionEntry> functions{};   // Deque, so entries never move.
+  std::unordered_map<key_t, const TypeInfo *, KeyHash> function_map{};
 
-  bool IsSame(const Info_Base & in) const override {
-    if (!in.IsFunction()) return false;
-    const Info_Function & in_fun = FunInfo(in);
-    if (param_types.size() != in_fun.param_types.size()) return false;
-    for (size_t i = 0; i < param_types.size(); ++i) {
-      if (param_types[i] != in_fun.param_types[i]) return false;
+public:
+  static TypeInterner & Get() {
+    static TypeInterner interner;
+    return interner;
+  }
+
+  Type Function(const std::vector<Type> & param_types, const Type & return_type) {
+    key_t key;
+    key.reserve(param_types.size() + 1);
+    key.push_back(return_type.info);
+    for (const Type & param : param_types) key.push_back(param.info);
+
+    auto [it, inserted] = function_map.try_emplace(std::move(key), nullptr);
+    if (inserted) {
+      FunctionEntry & entry = functions.emplace_back(FunctionEntry{param_types, {}});
+      entry.info = TypeInfo{ Type::Kind::FUNCTION, "", "UNKNOWN_TYPE", 0, 0, 0, return_type,
+                             entry.param_types.data(), entry.param_types.size() };
+      it->second = &entry.info;
     }
-    return return_type == in_fun.return_type;
-  }
-  bool ConvertToOK(const Info_Base & in) const override {
-    return IsSame(in);
-  }
-  bool CastToOK(const Info_Base &) const override {
-    return false; // There are no casts to functions.
+    return Type(it->second);
   }
+
+  size_t NumFunctionTypes() const { return functions.size(); }
 };
 
 ///////////////////////////////////////
 //  Full function implementations
 
-const Type::Info_Function & Type::FunInfo(const Info_Base & in) {
-  assert(in.IsFunction()); // Ensure that this is a function type.
-  return dynamic_cast<const Info_Function &>(in);
-}
-
-// Create a POD type from a string.
-Type::Type(std::string type_name) {
-  if (type_name == "char") info_ptr = std::make_unique<Info_Char>();
-  else if (type_name == "int") info_ptr = std::make_unique<Info_Int>();
-  else if (type_name == "double") info_ptr = std::make_unique<Info_Double>();
-  else if (type_name == "string") info_ptr = std::make_unique<Info_String>();
+// Create a POD type from its name.
+inline Type::Type(std::string_view type_name) {
+  if (type_name == "char") *this = Char();
+  else if (type_name == "int") *this = Int();
+  else if (type_name == "double") *this = Double();
+  else if (type_name == "string") *this = String();
   else {
     std::cerr << "Internal ERROR: Unknown Type '" << type_name << "'." << std::endl;
     assert(false);
   }
 }
 
-// Create a Function type
-Type::Type(const std::vector<Type> & param_types, const Type & return_type) {
-  info_ptr = std::make_unique<Info_Function>(param_types, return_type);
+// Create (or look up) a Function type
+inline Type::Type(const std::vector<Type> & param_types, const Type & return_type)
+  : Type(TypeInterner::Get().Function(param_types, return_type)) { }
+
+inline std::string Type::Name() const {
+  if (IsFunction()) return Info().return_type.Name() + "(...)";
+  return std::string(Info().name);
 }
 
-size_t Type::NumParams() const {
-  return FunInfo().param_types.size();
+inline std::string Type::ToWAT() const { return std::string(Info().wat); }
+
+inline size_t Type::NumParams() const {
+  assert(IsFunction()); // Ensure that this is a function type.
+  return info->num_params;
 }
 
-const Type & Type::ParamType(size_t id) const {
+inline const Type & Type::ParamType(size_t id) const {
   assert(id < NumParams());
-  return FunInfo().param_types[id];
-};
-
-const Type & Type::ReturnType() const {
-  return FunInfo().return_type;
+  return info->param_types[id];
 }
 
+inline const Type & Type::ReturnType() const {
+  assert(IsFunction()); // Ensure that this is a function type.
+  return info->return_type;
+}
@@ -0,0 +1,699 @@
+#pragma once
+
+// Binary WebAssembly output.
+//
+// The WasmEncoder builds a binary module straight from the instructions recorded during code
+// generation (see WasmInstr.hpp): each function is encoded as soon as its code is finished, and
+// Link() lays out the module around them as wat2wasm would (function types in order of first
+// use, minimal LEB128 sizes, and runs of same-typed locals grouped together).  No WAT is printed
+// or parsed along the way.
+//
+// The runtime prelude is written as WAT (see GenerateHelperWAT.hpp), so the encoder also
+// understands the subset of WAT used there; prelude/MakePrelude uses ForEachFunction() to
+// encode each helper once, ahead of time, for splicing into every module.
+//
+// Example usage:
+//   WasmEncoder wasm;
+//   wasm.BeginFunction("$Main", WASM_I32);
+//   ...                                   // Code for the function is added to a CodeBuffer.
+//   wasm.EndFunction(code, "Main");
+//   std::string bytes = wasm.Link({}, 0);
+
+#include <assert.h>
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "CodeBuffer.hpp"
+#include "tools.hpp"
+#include "WasmInstr.hpp"
+
+// A call inside an encoded function body; the callee's index is filled in when it is spliced.
+struct WasmCall {
+  uint32_t offset;                // Position of the callee index in the body.
+  std::string_view target;        // WAT identifier of the callee.
+};
+
+// A function that is already encoded, for splicing into a module (see Prelude.hpp).
+struct WasmFunction {
+  std::string_view name;          // WAT identifier, such as "$size".
+  std::string_view type;          // Encoded function type.
+  std::string_view export_name;   // Empty if the function is not exported.
+  std::string_view body;          // Encoded code entry: locals, then instructions.
+  std::span<const WasmCall> calls{};
+};
+
+class WasmEncoder {
+private:
+  using bytes_t = std::string;
+
+  static const WasmOpInfo & GetOp(std::string_view name) {
+    const WasmOpInfo * op = FindWasmOp(name);
+    if (!op) Error("Internal error: WAT instruction '", name, "' cannot be encoded.");
+    return *op;
+  }
+
+  // ----------- TOKENS ------------
+
+  struct WatToken {
+    enum Kind : uint8_t { OPEN, CLOSE, ATOM, STRING };
+    Kind kind;
+    std::string_view text;   // Atom text, or string contents without their quotes.
+  };
+
+  std::vector<WatToken> tokens{};
+  size_t pos = 0;
+
+  void Tokenize(std::string_view wat) {
+    size_t i = 0;
+    while (i < wat.size()) {
+      const char c = wat[i];
+      if (c == ' ' || c == '\n' || c == '\t' || c == '\r') { ++i; }
+      else if (c == ';' && i+1 < wat.size() && wat[i+1] == ';') {
+        i = wat.find('\n', i);
+        if (i == std::string_view::npos) i = wat.size();
+      }
+      else if (c == '(') { tokens.push_back({WatToken::OPEN, wat.substr(i, 1)}); ++i; }
+      else if (c == ')') { tokens.push_back({WatToken::CLOSE, wat.substr(i, 1)}); ++i; }
+      else if (c == '"') {
+        size_t end = i + 1;
+        while (end < wat.size() && wat[end] != '"') end += (wat[end] == '\\') ? 2 : 1;
+        tokens.push_back({WatToken::STRING, wat.substr(i + 1, end - i - 1)});
+        i = end + 1;
+      }
+      else {
+        size_t end = wat.find_first_of(" \n\t\r()", i);
+        if (end == std::string_view::npos) end = wat.size();
+        tokens.push_back({WatToken::ATOM, wat.substr(i, end - i)});
+        i = end;
+      }
+    }
+  }
+
+  bool IsNext(WatToken::Kind kind) const { return pos < tokens.size() && tokens[pos].kind == kind; }
+  bool IsNextAtom(std::string_view text) const { return IsNext(WatToken::ATOM) && tokens[pos].text == text; }
+  bool IsNextId() const { return IsNext(WatToken::ATOM) && tokens[pos].text.starts_with('$'); }
+  // Is the next thing a list that starts with the provided keyword?
+  bool IsNextList(std::string_view keyword) const {
+    return IsNext(WatToken::OPEN) && pos + 1 < tokens.size() &&
+           tokens[pos+1].kind == WatToken::ATOM && tokens[pos+1].text == keyword;
+  }
+
+  std::string_view Use(WatToken::Kind kind) {
+    if (!IsNext(kind)) {
+      Error("Internal error: malformed WAT near '", (pos < tokens.size() ? tokens[pos].text : "EOF"), "'.");
+    }
+    return tokens[pos++].text;
+  }
+  std::string_view UseAtom() { return Use(WatToken::ATOM); }
+  void UseClose() { Use(WatToken::CLOSE); }
+
+  // Skip the rest of a list whose '(' has already been used.
+  void SkipList() {
+    for (size_t depth = 1; depth > 0; ++pos) {
+      assert(pos < tokens.size());
+      if (tokens[pos].kind == WatToken::OPEN) ++depth;
+      else if (tokens[pos].kind == WatToken::CLOSE) --depth;
+    }
+  }
+
+  // ----------- ENCODING HELPERS ------------
+
+  static void AddU32(bytes_t & out, uint64_t value) {
+    do {
+      uint8_t byte = value & 0x7F;
+      value >>= 7;
+      if (value) byte |= 0x80;
+      out.push_back(static_cast<char>(byte));
+    } while (value);
+  }
+
+  static void AddS32(bytes_t & out, int64_t value) {
+    while (true) {
+      const uint8_t byte = value & 0x7F;
+      value >>= 7;
+      const bool done = (value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40));
+      out.push_back(static_cast<char>(done ? byte : (byte | 0x80)));
+      if (done) return;
+    }
+  }
+
+  static void AddName(bytes_t & out, std::string_view name) {
+    AddU32(out, name.size());
+    out.append(name);
+  }
+
+  static void AddSection(bytes_t & out, uint8_t id, const bytes_t & body) {
+    out.push_back(static_cast<char>(id));
+    AddU32(out, body.size());
+    out.append(body);
+  }
+
+  static int64_t ParseInt(std::string_view text) {
+    int64_t value = 0;
+    const bool negative = text.starts_with('-');
+    if (negative) text.remove_prefix(1);
+    int base = 10;
+    if (text.starts_with("0x")) { text.remove_prefix(2); base = 16; }
+    uint64_t magnitude = 0;
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), magnitude, base);
+    if (ec != std::errc() || ptr != text.data() + text.size()) {
+      Error("Internal error: bad WAT integer '", text, "'.");
+    }
+    value = static_cast<int64_t>(magnitude);
+    return negative ? -value : value;
+  }
+
+  // Decode the escapes in a WAT string.
+  static void AddStringBytes(bytes_t & out, std::string_view text) {
+    for (size_t i = 0; i < text.size(); ++i) {
+      if (text[i] != '\\') { out.push_back(text[i]); continue; }
+      const char next = text[++i];
+      switch (next) {
+      case 'n': out.push_back('\n'); break;
+      case 't': out.push_back('\t'); break;
+      case 'r': out.push_back('\r'); break;
+      case '"': case '\'': case '\\': out.push_back(next); break;
+      default: {  // Two hex digits.
+        uint8_t value = 0;
+        std::from_chars(text.data() + i, text.data() + i + 2, value, 16);
+        out.push_back(static_cast<char>(value));
+        ++i;
+      }
+      }
+    }
+  }
+
+  // ----------- MODULE STRUCTURE ------------
+
+  std::vector<bytes_t> types{};                              // Encoded function types.
+  std::unordered_map<bytes_t, uint32_t> type_ids{};
+  std::unordered_map<std::string_view, uint32_t> function_ids{};
+
+  uint32_t AddType(const bytes_t & type) {
+    auto [it, inserted] = type_ids.try_emplace(type, static_cast<uint32_t>(types.size()));
+    if (inserted) types.push_back(type);
+    return it->second;
+  }
+
+  static bytes_t FunctionType(std::string_view params, std::string_view results) {
+    bytes_t type{'\x60'};
+    AddU32(type, params.size());
+    type += params;
+    AddU32(type, results.size());
+    type += results;
+    return type;
+  }
+
+  // Add the locals to the start of a body, grouped into runs of the same type.
+  static void AddLocals(bytes_t & body, std::string_view local_types) {
+    std::vector<std::pair<uint32_t, char>> runs;
+    for (char type : local_types) {
+      if (runs.size() && runs.back().second == type) ++runs.back().first;
+      else runs.emplace_back(1, type);
+    }
+    AddU32(body, runs.size());
+    for (auto [count, type] : runs) {
+      AddU32(body, count);
+      body.push_back(type);
+    }
+  }
+
+  uint32_t LookupIndex(const std::unordered_map<std::string_view, uint32_t> & ids, std::string_view name) {
+    if (!name.starts_with('$')) return static_cast<uint32_t>(ParseInt(name));
+    auto it = ids.find(name);
+    if (it == ids.end()) Error("Internal error: unknown WAT identifier '", name, "'.");
+    return it->second;
+  }
+
+  // Copy a pre-encoded body, giving each call the callee's index in this module.
+  bytes_t SpliceBody(const WasmFunction & fun) {
+    bytes_t body;
+    size_t copied = 0;
+    for (const WasmCall & call : fun.calls) {
+      body.append(fun.body, copied, call.offset - copied);
+      AddU32(body, LookupIndex(function_ids, call.target));
+      copied = call.offset;
+      while (fun.body[copied++] & 0x80) { }   // Skip the original index.
+    }
+    body.append(fun.body, copied);
+    return body;
+  }
+
+  // ----------- DIRECT ENCODING ------------
+
+  // A function encoded from code generation; its views are made once all are done (see Link).
+  struct Compiled {
+    bytes_t name, type{}, export_name{}, body{};
+    std::vector<std::pair<uint32_t, bytes_t>> calls{};   // Offset and callee of each call.
+  };
+
+  std::vector<Compiled> compiled{};
+  std::vector<std::pair<uint32_t, bytes_t>> data{};   // Offset and contents of each data segment.
+  bytes_t params{}, results{}, local_types{};         // Signature and locals of the current function.
+  std::vector<uint32_t> local_index{};                // Index of each local, by id.
+
+  void SetLocalIndex(uint32_t local_id) {
+    if (local_index.size() <= local_id) local_index.resize(local_id + 1, UINT32_MAX);
+    local_index[local_id] = static_cast<uint32_t>(params.size() + local_types.size());
+  }
+
+  uint32_t LocalIndex(int32_t local_id) const {
+    const size_t id = static_cast<size_t>(local_id);
+    if (id >= local_index.size() || local_index[id] == UINT32_MAX) {
+      Error("Internal error: local ", local_id, " is not declared.");
+    }
+    return local_index[id];
+  }
+
+  // Encode the instructions on the pending lines of 'code'.
+  void AddCode(bytes_t & body, const CodeBuffer & code, Compiled & fun) {
+    std::vector<WasmInstr::Kind> open;          // Structures entered, innermost last.
+    std::vector<std::string_view> block_labels; // Labels of open blocks ("" if unnamed).
+    auto block_type = [](const WasmInstr & instr) { return instr.result ? instr.result : 0x40; };
+    for (size_t id = 0; id < code.NumPendingLines(); ++id) {
+      const WasmInstr & instr = code.Instr(id);
+      switch (instr.kind) {
+      case WasmInstr::NONE: break;
+      case WasmInstr::OP:
+        body.push_back(static_cast<char>(instr.op->code));
+        switch (instr.op->imm) {
+        case WasmImm::NONE: break;
+        case WasmImm::LOCAL: AddU32(body, LocalIndex(instr.value)); break;
+        case WasmImm::FUNC:
+          fun.calls.emplace_back(static_cast<uint32_t>(body.size()), code.LineCode(id));
+          body.push_back('\0');                       // Filled in by Link().
+          break;
+        case WasmImm::LABEL: {
+          const std::string_view label = code.LineCode(id);
+          const auto it = std::find(block_labels.rbegin(), block_labels.rend(), label);
+          if (it == block_labels.rend()) Error("Internal error: unknown label '", label, "'.");
+          AddU32(body, static_cast<uint64_t>(it - block_labels.rbegin()));
+          break;
+        }
+        case WasmImm::I32: AddS32(body, instr.value); break;
+        case WasmImm::F64: {
+          const uint64_t bits = std::bit_cast<uint64_t>(instr.f64);
+          for (size_t i = 0; i < 8; ++i) body.push_back(static_cast<char>(bits >> (8 * i)));
+          break;
+        }
+        case WasmImm::MEMARG: AddU32(body, instr.op->align); AddU32(body, 0); break;
+        case WasmImm::MEMORY: body.push_back('\0'); break;
+        case WasmImm::GLOBAL: Error("Internal error: generated code cannot use globals.");
+        }
+        break;
+      case WasmInstr::BLOCK: case WasmInstr::LOOP: case WasmInstr::IF:
+        body.push_back(instr.kind == WasmInstr::BLOCK ? '\x02' : instr.kind == WasmInstr::LOOP ? '\x03' : '\x04');
+        body.push_back(static_cast<char>(block_type(instr)));
+        block_labels.push_back(instr.kind == WasmInstr::IF ? std::string_view{} : code.LineCode(id));
+        open.push_back(instr.kind);
+        break;
+      case WasmInstr::THEN: open.push_back(instr.kind); break;
+      case WasmInstr::ELSE: body.push_back('\x05'); open.push_back(instr.kind); break;
+      case WasmInstr::END:
+        assert(open.size());
+        if (open.back() != WasmInstr::THEN && open.back() != WasmInstr::ELSE) {
+          body.push_back('\x0B');
+          block_labels.pop_back();
+        }
+        open.pop_back();
+        break;
+      }
+    }
+    assert(open.empty());
+  }
+
+  // ----------- WAT (FOR THE PRELUDE) ------------
+
+  struct WatFunction {
+    std::string_view name;
+    uint32_t type_id;
+    size_t sig_pos;                 // First param/result token.
+    std::string_view export_name{};
+  };
+
+  std::vector<WatFunction> wat_functions{};
+  std::unordered_map<std::string_view, uint32_t> global_ids{};
+  uint32_t num_globals = 0;
+  std::unordered_map<std::string_view, uint32_t> local_ids{};
+  std::vector<std::string_view> labels{};   // Open block labels, innermost last ("" if unnamed).
+  std::vector<WasmCall> call_sites{};        // Calls in the function body being encoded.
+
+  // Read "(param ...)" and "(result ...)" lists; record param names if provided.
+  uint32_t ReadSignature(uint32_t * num_params=nullptr) {
+    bytes_t params, results;
+    while (IsNextList("param")) {
+      pos += 2;
+      if (IsNextId()) local_ids[UseAtom()] = static_cast<uint32_t>(params.size());
+      while (IsNext(WatToken::ATOM)) params.push_back(static_cast<char>(WasmValType(UseAtom())));
+      UseClose();
+    }
+    while (IsNextList("result")) {
+      pos += 2;
+      while (IsNext(WatToken::ATOM)) results.push_back(static_cast<char>(WasmValType(UseAtom())));
+      UseClose();
+    }
+    if (num_params) *num_params = static_cast<uint32_t>(params.size());
+    return AddType(FunctionType(params, results));
+  }
+
+  // Find every function and global, assigning indices.  Only functions are encoded.
+  void ScanModule() {
+    Use(WatToken::OPEN);
+    if (UseAtom() != "module") Error("Internal error: WAT must be a module.");
+    std::vector<std::pair<std::string_view, std::string_view>> func_exports;   // Name and target.
+    while (IsNext(WatToken::OPEN)) {
+      Use(WatToken::OPEN);
+      const std::string_view field = UseAtom();
+      if (field == "func") {
+        const uint32_t id = static_cast<uint32_t>(wat_functions.size());
+        WatFunction fun{IsNextId() ? UseAtom() : std::string_view{}, 0, 0};
+        if (fun.name.size()) function_ids[fun.name] = id;
+        if (IsNextList("export")) {
+          pos += 2;
+          fun.export_name = Use(WatToken::STRING);
+          UseClose();
+        }
+        fun.sig_pos = pos;
+        fun.type_id = ReadSignature();
+        local_ids.clear();
+        wat_functions.push_back(fun);
+        SkipList();
+      }
+      else if (field == "global") {
+        const uint32_t id = num_globals++;
+        if (IsNextId()) global_ids[UseAtom()] = id;
+        SkipList();
+      }
+      else if (field == "export") {
+        const std::string_view name = Use(WatToken::STRING);
+        Use(WatToken::OPEN);
+        if (UseAtom() == "func") func_exports.emplace_back(name, UseAtom());
+        SkipList();
+        UseClose();
+      }
+      else if (field == "memory" || field == "data") SkipList();
+      else Error("Internal error: WAT module field '", field, "' cannot be encoded.");
+    }
+    UseClose();
+
+    // Exports may name functions defined after them.
+    for (auto [name, target] : func_exports) {
+      wat_functions[LookupIndex(function_ids, target)].export_name = name;
+    }
+  }
+
+  uint32_t LookupLabel(std::string_view name) {
+    if (!name.starts_with('$')) return static_cast<uint32_t>(ParseInt(name));
+    for (size_t depth = 0; depth < labels.size(); ++depth) {
+      if (labels[labels.size() - 1 - depth] == name) return static_cast<uint32_t>(depth);
+    }
+    Error("Internal error: unknown WAT label '", name, "'.");
+    return 0;
+  }
+
+  // Read the immediates of an instruction and encode them.
+  void AddImmediates(bytes_t & out, const WasmOpInfo & op) {
+    switch (op.imm) {
+    case WasmImm::NONE: break;
+    case WasmImm::LOCAL:  AddU32(out, LookupIndex(local_ids, UseAtom())); break;
+    case WasmImm::GLOBAL: AddU32(out, LookupIndex(global_ids, UseAtom())); break;
+    case WasmImm::FUNC: {
+      const std::string_view target = UseAtom();
+      call_sites.push_back(WasmCall{static_cast<uint32_t>(out.size()), target});
+      AddU32(out, LookupIndex(function_ids, target));
+      break;
+    }
+    case WasmImm::LABEL:  AddU32(out, LookupLabel(UseAtom())); break;
+    case WasmImm::I32:    AddS32(out, static_cast<int32_t>(static_cast<uint32_t>(ParseInt(UseAtom())))); break;
+    case WasmImm::F64: {
+      const std::string_view text = UseAtom();
+      double value = 0.0;
+      auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+      if (ptr != text.data() + text.size()) Error("Internal error: bad WAT float '", text, "'.");
+      const uint64_t bits = std::bit_cast<uint64_t>(value);
+      for (size_t i = 0; i < 8; ++i) out.push_back(static_cast<char>(bits >> (8 * i)));
+      break;
+    }
+    case WasmImm::MEMARG: {
+      uint64_t offset = 0, align = op.align;
+      while (IsNext(WatToken::ATOM)) {
+        const std::string_view arg = UseAtom();
+        if (arg.starts_with("offset=")) offset = ParseInt(arg.substr(7));
+        else if (arg.starts_with("align=")) align = std::countr_zero(static_cast<uint64_t>(ParseInt(arg.substr(6))));
+        else Error("Internal error: bad WAT memory argument '", arg, "'.");
+      }
+      AddU32(out, align);
+      AddU32(out, offset);
+      break;
+    }
+    case WasmImm::MEMORY: out.push_back('\x00'); break;
+    }
+  }
+
+  // Read an optional block label and result type; return the encoded block type.
+  char ReadBlockHeader() {
+    labels.push_back(IsNextId() ? UseAtom() : std::string_view{});
+    char block_type = '\x40';
+    if (IsNextList("result")) {
+      pos += 2;
+      block_type = static_cast<char>(WasmValType(UseAtom()));
+      UseClose();
+    }
+    return block_type;
+  }
+
+  // Encode instructions until the close of the list that contains them (which is used).
+  // Nesting is tracked on an explicit stack, so deeply nested code cannot overflow the call stack.
+  void AddInstructions(bytes_t & out) {
+    struct Frame {
+      enum Kind : uint8_t { FOLDED, BLOCK, IF, THEN, ELSE } kind;
+      char block_type = '\x40';
+      const WasmOpInfo * op = nullptr;   // Folded instructions are written at the close,
+      size_t imm_pos = 0;                // with their immediates read again from here.
+    };
+    std::vector<Frame> stack;
+    while (true) {
+      const WatToken & token = tokens[pos++];
+      if (token.kind == WatToken::CLOSE) {
+        if (stack.empty()) return;
+        Frame & frame = stack.back();
+        switch (frame.kind) {
+        case Frame::FOLDED: {
+          const size_t end_pos = pos;
+          pos = frame.imm_pos;
+          out.push_back(static_cast<char>(frame.op->code));
+          AddImmediates(out, *frame.op);
+          pos = end_pos;
+          break;
+        }
+        case Frame::BLOCK: case Frame::IF: out.push_back('\x0B'); labels.pop_back(); break;
+        case Frame::THEN: case Frame::ELSE: break;
+        }
+        stack.pop_back();
+      }
+      else if (token.kind == WatToken::OPEN) {
+        const std::string_view name = UseAtom();
+        if (name == "block" || name == "loop") {
+          const char block_type = ReadBlockHeader();
+          out.push_back(name == "block" ? '\x02' : '\x03');
+          out.push_back(block_type);
+          stack.push_back(Frame{Frame::BLOCK});
+        }
+        else if (name == "if") {
+          // The condition comes first (if folded); the header is written at "then".
+          stack.push_back(Frame{Frame::IF, ReadBlockHeader()});
+        }
+        else if (name == "then") {
+          assert(stack.size() && stack.back().kind == Frame::IF);
+          out.push_back('\x04');
+          out.push_back(stack.back().block_type);
+          stack.push_back(Frame{Frame::THEN});
+        }
+        else if (name == "else") {
+          out.push_back('\x05');
+          stack.push_back(Frame{Frame::ELSE});
+        }
+        else {
+          const WasmOpInfo & op = GetOp(name);
+          stack.push_back(Frame{Frame::FOLDED, '\x40', &op, pos});
+          while (IsNext(WatToken::ATOM)) ++pos;   // Skip to any folded operands.
+        }
+      }
+      else if (token.kind == WatToken::ATOM) {  // A plain (unfolded) instruction.
+        const WasmOpInfo & op = GetOp(token.text);
+        out.push_back(static_cast<char>(op.code));
+        AddImmediates(out, op);
+      }
+      else Error("Internal error: unexpected string in WAT code.");
+    }
+  }
+
+  bytes_t FunctionBody(const WatFunction & fun) {
+    pos = fun.sig_pos;
+    call_sites.clear();
+    local_ids.clear();
+    labels.clear();
+    uint32_t num_locals = 0;
+    ReadSignature(&num_locals);
+
+    bytes_t local_types;
+    while (IsNextList("local")) {
+      pos += 2;
+      if (IsNextId()) local_ids[UseAtom()] = num_locals;
+      while (IsNext(WatToken::ATOM)) {
+        local_types.push_back(static_cast<char>(WasmValType(UseAtom())));
+        ++num_locals;
+      }
+      UseClose();
+    }
+
+    bytes_t body;
+    AddLocals(body, local_types);
+    AddInstructions(body);
+    body.push_back('\x0B');
+    return body;
+  }
+
+  explicit WasmEncoder(std::string_view wat) { Tokenize(wat); }
+
+public:
+  WasmEncoder() = default;
+
+  // Start a function, given its WAT name (such as "$Main") and result type (0 for none).  Its
+  // params and locals follow, in order; then its code.
+  void BeginFunction(std::string_view name, uint8_t result) {
+    compiled.push_back(Compiled{bytes_t(name)});
+    params.clear();
+    results.clear();
+    if (result) results.push_back(static_cast<char>(result));
+    local_types.clear();
+    local_index.clear();
+  }
+
+  void AddParam(uint32_t local_id, uint8_t type) {
+    assert(local_types.empty());
+    SetLocalIndex(local_id);
+    params.push_back(static_cast<char>(type));
+  }
+
+  void AddLocal(uint32_t local_id, uint8_t type) {
+    SetLocalIndex(local_id);
+    local_types.push_back(static_cast<char>(type));
+  }
+
+  // Encode the current function from the lines of 'code' that have not been laid out yet.
+  void EndFunction(const CodeBuffer & code, std::string_view export_name) {
+    Compiled & fun = compiled.back();
+    fun.type = FunctionType(params, results);
+    fun.export_name = export_name;
+    AddLocals(fun.body, local_types);
+    AddCode(fun.body, code, fun);
+    fun.body.push_back('\x0B');
+  }
+
+  // Add an active data segment; 'text' is the contents of a WAT string (escapes included).
+  void AddData(uint32_t offset, std::string_view text) {
+    data.emplace_back(offset, bytes_t{});
+    AddStringBytes(data.back().second, text);
+  }
+
+  // Lay out the module: the pre-encoded 'prelude' functions come first, then all functions
+  // encoded here.  The module has one memory (exported as "memory") and one mutable i32 global
+  // (the prelude's $free_mem), which starts at 'free_mem'.
+  std::string Link(std::span<const WasmFunction> prelude, int32_t free_mem) {
+    std::vector<std::vector<WasmCall>> calls(compiled.size());
+    std::vector<WasmFunction> functions(prelude.begin(), prelude.end());
+    for (size_t id = 0; id < compiled.size(); ++id) {
+      const Compiled & fun = compiled[id];
+      for (const auto & [offset, target] : fun.calls) calls[id].push_back(WasmCall{offset, target});
+      functions.push_back(WasmFunction{fun.name, fun.type, fun.export_name, fun.body, calls[id]});
+    }
+
+    types.clear();
+    type_ids.clear();
+    function_ids.clear();
+    std::vector<uint32_t> type_of;
+    for (const WasmFunction & fun : functions) {
+      function_ids[fun.name] = static_cast<uint32_t>(type_of.size());
+      type_of.push_back(AddType(bytes_t(fun.type)));
+    }
+
+    bytes_t module{'\0', 'a', 's', 'm', '\x01', '\0', '\0', '\0'};
+    bytes_t section;
+    auto Start = [&section](size_t count) { section.clear(); AddU32(section, count); };
+
+    if (types.size()) {
+      Start(types.size());
+      for (const bytes_t & type : types) section += type;
+      AddSection(module, 1, section);
+    }
+    if (functions.size()) {
+      Start(functions.size());
+      for (uint32_t type_id : type_of) AddU32(section, type_id);
+      AddSection(module, 3, section);
+    }
+    Start(1);                                   // Memory: one page, no maximum.
+    section += bytes_t{'\x00', '\x01'};
+    AddSection(module, 5, section);
+    Start(1);                                   // Global: mutable i32.
+    section += bytes_t{static_cast<char>(WASM_I32), '\x01', '\x41'};
+    AddS32(section, free_mem);
+    section.push_back('\x0B');
+    AddSection(module, 6, section);
+
+    size_t num_exports = 1;
+    for (const WasmFunction & fun : functions) num_exports += !fun.export_name.empty();
+    Start(num_exports);
+    AddName(section, "memory");
+    section += bytes_t{'\x02', '\x00'};
+    for (size_t id = 0; id < functions.size(); ++id) {
+      if (functions[id].export_name.empty()) continue;
+      AddName(section, functions[id].export_name);
+      section.push_back('\x00');
+      AddU32(section, id);
+    }
+    AddSection(module, 7, section);
+
+    if (functions.size()) {
+      Start(functions.size());
+      for (const WasmFunction & fun : functions) {
+        const bytes_t body = SpliceBody(fun);
+        AddU32(section, body.size());
+        section += body;
+      }
+      AddSection(module, 10, section);
+    }
+    if (data.size()) {
+      Start(data.size());
+      for (const auto & [offset, contents] : data) {
+        section += bytes_t{'\x00', '\x41'};   // Active segment in memory 0, at a constant offset.
+        AddS32(section, offset);
+        section.push_back('\x0B');
+        AddU32(section, contents.size());
+        section += contents;
+      }
+      AddSection(module, 11, section);
+    }
+    return module;
+  }
+
+  // Encode each function of a WAT module separately, passing each one (with the calls it makes)
+  // to 'fun' as a WasmFunction.
+  template <typename FUN_T>
+  static void ForEachFunction(std::string_view wat, FUN_T fun) {
+    WasmEncoder encoder(wat);
+    encoder.ScanModule();
+    for (const WatFunction & wat_fun : encoder.wat_functions) {
+      const bytes_t body = encoder.FunctionBody(wat_fun);
+      fun(WasmFunction{wat_fun.name, encoder.types[wat_fun.type_id], wat_fun.export_name, body,
+                       encoder.call_sites});
+    }
+  }
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+// Instructions as recorded by code generation.
+//
+// Code generation does not write instructions as text.  Each one is recorded as an entry from
+// WASM_OP_TABLE plus its immediate (a WasmInstr, held on a line of the CodeBuffer), along with
+// the structure around them: block, loop, and if, the then and else branches of an if, and the
+// end of each.  The peephole rules (Peephole.hpp) rewrite these records, WAT text is printed from
+// them (CodeBuffer.hpp), and binary output encodes them directly (WasmEncoder.hpp).
+//
+// Example usage:
+//   WasmInstr add = WasmInstr::Op(WasmOp("i32.add"));
+//   WasmInstr five = WasmInstr::Op(WasmOp("i32.const"), 5);
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+#include "tools.hpp"
+
+// Kinds of immediate values that follow an instruction name.
+enum class WasmImm : uint8_t { NONE, LOCAL, GLOBAL, FUNC, LABEL, I32, F64, MEMARG, MEMORY };
+
+struct WasmOpInfo {
+  std::string_view name;
+  uint8_t code;
+  WasmImm imm = WasmImm::NONE;
+  uint8_t align = 0;   // Natural alignment (log2 bytes) for loads and stores.
+};
+
+inline constexpr WasmOpInfo WASM_OP_TABLE[] = {
+  {"unreachable", 0x00}, {"nop", 0x01}, {"br", 0x0C, WasmImm::LABEL}, {"br_if", 0x0D, WasmImm::LABEL},
+  {"return", 0x0F}, {"call", 0x10, WasmImm::FUNC}, {"drop", 0x1A}, {"select", 0x1B},
+  {"local.get", 0x20, WasmImm::LOCAL}, {"local.set", 0x21, WasmImm::LOCAL}, {"local.tee", 0x22, WasmImm::LOCAL},
+  {"global.get", 0x23, WasmImm::GLOBAL}, {"global.set", 0x24, WasmImm::GLOBAL},
+  {"i32.load", 0x28, WasmImm::MEMARG, 2}, {"f64.load", 0x2B, WasmImm::MEMARG, 3},
+  {"i32.load8_s", 0x2C, WasmImm::MEMARG, 0}, {"i32.load8_u", 0x2D, WasmImm::MEMARG, 0},
+  {"i32.load16_s", 0x2E, WasmImm::MEMARG, 1}, {"i32.load16_u", 0x2F, WasmImm::MEMARG, 1},
+  {"i32.store", 0x36, WasmImm::MEMARG, 2}, {"f64.store", 0x39, WasmImm::MEMARG, 3},
+  {"i32.store8", 0x3A, WasmImm::MEMARG, 0}, {"i32.store16", 0x3B, WasmImm::MEMARG, 1},
+  {"memory.size", 0x3F, WasmImm::MEMORY}, {"memory.grow", 0x40, WasmImm::MEMORY},
+  {"i32.const", 0x41, WasmImm::I32}, {"f64.const", 0x44, WasmImm::F64},
+  {"i32.eqz", 0x45}, {"i32.eq", 0x46}, {"i32.ne", 0x47}, {"i32.lt_s", 0x48}, {"i32.lt_u", 0x49},
+  {"i32.gt_s", 0x4A}, {"i32.gt_u", 0x4B}, {"i32.le_s", 0x4C}, {"i32.le_u", 0x4D},
+  {"i32.ge_s", 0x4E}, {"i32.ge_u", 0x4F},
+  {"f64.eq", 0x61}, {"f64.ne", 0x62}, {"f64.lt", 0x63}, {"f64.gt", 0x64}, {"f64.le", 0x65},
+  {"f64.ge", 0x66},
+  {"i32.clz", 0x67}, {"i32.ctz", 0x68}, {"i32.popcnt", 0x69}, {"i32.add", 0x6A}, {"i32.sub", 0x6B},
+  {"i32.mul", 0x6C}, {"i32.div_s", 0x6D}, {"i32.div_u", 0x6E}, {"i32.rem_s", 0x6F},
+  {"i32.rem_u", 0x70}, {"i32.and", 0x71}, {"i32.or", 0x72}, {"i32.xor", 0x73}, {"i32.shl", 0x74},
+  {"i32.shr_s", 0x75}, {"i32.shr_u", 0x76}, {"i32.rotl", 0x77}, {"i32.rotr", 0x78},
+  {"f64.abs", 0x99}, {"f64.neg", 0x9A}, {"f64.ceil", 0x9B}, {"f64.floor", 0x9C},
+  {"f64.trunc", 0x9D}, {"f64.nearest", 0x9E}, {"f64.sqrt", 0x9F}, {"f64.add", 0xA0},
+  {"f64.sub", 0xA1}, {"f64.mul", 0xA2}, {"f64.div", 0xA3}, {"f64.min", 0xA4}, {"f64.max", 0xA5},
+  {"f64.copysign", 0xA6},
+  {"i32.trunc_f64_s", 0xAA}, {"i32.trunc_f64_u", 0xAB},
+  {"f64.convert_i32_s", 0xB7}, {"f64.convert_i32_u", 0xB8},
+};
+
+// Look up a plain instruction by its WAT name (nullptr if it is not one we know).
+inline const WasmOpInfo * FindWasmOp(std::string_view name) {
+  static const auto op_map = [](){
+    std::unordered_map<std::string_view, const WasmOpInfo *> out;
+    for (const WasmOpInfo & op : WASM_OP_TABLE) out[op.name] = &op;
+    return out;
+  }();
+  auto it = op_map.find(name);
+  return (it == op_map.end()) ? nullptr : it->second;
+}
+
+// Look up a plain instruction whose name is known at compile time.
+consteval const WasmOpInfo & WasmOp(std::string_view name) {
+  for (const WasmOpInfo & op : WASM_OP_TABLE) {
+    if (op.name == name) return op;
+  }
+  throw "Unknown WebAssembly instruction.";   // Not a constant expression, so a compile error.
+}
+
+// Encoded value types.
+inline constexpr uint8_t WASM_I32 = 0x7F, WASM_I64 = 0x7E, WASM_F32 = 0x7D, WASM_F64 = 0x7C;
+
+inline uint8_t WasmValType(std::string_view name) {
+  if (name == "i32") return WASM_I32;
+  if (name == "i64") return WASM_I64;
+  if (name == "f32") return WASM_F32;
+  if (name == "f64") return WASM_F64;
+  Error("Internal error: unknown WAT value type '", name, "'.");
+  return 0;
+}
+
+inline std::string_view WasmValTypeName(uint8_t type) {
+  switch (type) {
+  case WASM_I32: return "i32";
+  case WASM_I64: return "i64";
+  case WASM_F32: return "f32";
+  case WASM_F64: return "f64";
+  }
+  Error("Internal error: unknown value type 0x", static_cast<int>(type), ".");
+  return "";
+}
+
+struct WasmInstr {
+  enum Kind : uint8_t {
+    NONE,           // No instruction (a declaration, a blank line, or just a comment).
+    OP,             // A plain instruction from WASM_OP_TABLE.
+    BLOCK, LOOP,    // Start a labeled block or loop.
+    IF,             // Start an if, using the condition already on the stack.
+    THEN, ELSE,     // Start a branch of the innermost if.
+    END             // End the innermost block, loop, if, or branch.
+  };
+
+  Kind kind = NONE;
+  uint8_t result = 0;                 // BLOCK, LOOP, IF: value type left on the stack (0 for none).
+  const WasmOpInfo * op = nullptr;    // OP only.
+  int32_t value = 0;                  // I32 immediate, or the id of a LOCAL.
+  double f64 = 0.0;                   // F64 immediate.
+  // Locals, labels, and functions are also named (as are blocks and loops); a name is kept as
+  // the text of the instruction's line in the CodeBuffer.
+
+  static WasmInstr Op(const WasmOpInfo & op, int32_t value=0) { return WasmInstr{OP, 0, &op, value}; }
+  static WasmInstr Op(const WasmOpInfo & op, double value) { return WasmInstr{OP, 0, &op, 0, value}; }
+  static WasmInstr Structure(Kind kind, uint8_t result=0) { return WasmInstr{kind, result}; }
+
+  bool Is(uint8_t code) const { return kind == OP && op->code == code; }
+  bool HasName() const {
+    return kind == BLOCK || kind == LOOP ||
+           (kind == OP && IsOneOf<WasmImm::LOCAL, WasmImm::LABEL, WasmImm::FUNC>(op->imm));
+  }
+};
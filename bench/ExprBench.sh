@@ -0,0 +1,39 @@
+#!/bin/bash
+# Parser throughput benchmark on expression-heavy input.
+#
+# Generates a program whose functions are dominated by long arithmetic, comparison and logical
+# expressions, then reports the best wall-clock compile time over several runs.
+#
+# Usage: bench/ExprBench.sh [COMPILER] [FUNCTIONS] [RUNS]
+
+compiler="${1:-./Project4}"
+num_functions="${2:-4000}"
+runs="${3:-5}"
+input_file="$(mktemp /tmp/expr-bench-XXXXXX.tube)"
+trap 'rm -f "$input_file"' EXIT
+
+awk -v n="$num_functions" 'BEGIN {
+  for (i = 0; i < n; i++) {
+    printf "function expr%d(int a, int b, double d) : int {\n", i
+    printf "  int x = (a + b * %d - (a - b) / 3) %% 7 + a * a - (b + 1) * (a - 2) + %d;\n", i % 97 + 1, i
+    printf "  double y = d * 2.5 + (d - 1.0) / (d + 3.0) - a * d + b / 4.0 * (d * d - 0.5);\n"
+    printf "  int z = x;\n"
+    printf "  while (z > 0 && (x < 100 || y >= 2.0) && !(a == b) && a != x + 1) {\n"
+    printf "    z = z - 1 - (x + a) %% 3 * 2 + (b - a) * (b + a) / 7 - 1;\n"
+    printf "    x = x + z * 2 - a %% 5 + (b * 3 - (a + x) / 2) * (z - 1) - x / 3;\n"
+    printf "  }\n"
+    printf "  return x + z - (a * b + (x - z) * (x + z)) %% 11 + (y > d || a < b):int;\n"
+    printf "}\n"
+  }
+}' > "$input_file"
+
+best=""
+for ((run = 0; run < runs; run++)); do
+  start=$(date +%s.%N)
+  "$compiler" "$input_file" > /dev/null || { echo "ERROR: compile failed."; exit 1; }
+  end=$(date +%s.%N)
+  best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if ($3 == "" || t < $3) print t; else print $3 }')
+done
+
+echo "Expression benchmark: $num_functions functions, $(wc -c < "$input_file") bytes"
+echo "  best: $best s over $runs runs"
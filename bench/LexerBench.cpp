@@ -0,0 +1,106 @@
+// Lexer throughput microbenchmark.
+//
+// Builds a multi-megabyte input by repeating the provided source files, tokenizes it several
+// times, and reports the best tokens/second observed.  "make bench" builds this file twice:
+// once normally and once with -DEMPLEX_REFERENCE_DFA, so the compressed DFA tables can be
+// compared against the full reference tables on identical input.  Each build is timed with the
+// vectorized run skipping off and then at every kernel level the CPU supports; all of those
+// token streams must match exactly.
+//
+// Usage: LexerBench [-s MEGABYTES] [-r RUNS] file.tube ...
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "lexer.hpp"
+
+int main(int argc, char * argv[])
+{
+  size_t target_mb = 16;
+  size_t runs = 5;
+  std::vector<std::string> filenames;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "-s" && i+1 < argc) target_mb = std::stoul(argv[++i]);
+    else if (arg == "-r" && i+1 < argc) runs = std::stoul(argv[++i]);
+    else filenames.push_back(arg);
+  }
+  if (filenames.empty()) {
+    std::cout << "Format: " << argv[0] << " [-s MEGABYTES] [-r RUNS] [files...]" << std::endl;
+    exit(1);
+  }
+
+  // Concatenate the inputs (each ending in a newline) until we reach the target size.
+  std::string sample;
+  for (const auto & filename : filenames) {
+    std::ifstream in_file(filename);
+    if (in_file.fail()) {
+      std::cerr << "ERROR: Unable to open file '" << filename << "'." << std::endl;
+      exit(1);
+    }
+    sample.append(std::istreambuf_iterator<char>(in_file), std::istreambuf_iterator<char>());
+    sample += '\n';
+  }
+  std::string input;
+  input.reserve(target_mb * 1024 * 1024 + sample.size());
+  while (input.size() < target_mb * 1024 * 1024) input += sample;
+
+  // Tokenize the input 'runs' times; return the best time and keep the last token stream.
+  auto time_lexer = [&input, runs](bool fast_scan, std::vector<emplex::Token> & tokens) {
+    emplex::Lexer lexer;
+    lexer.UseFastScan(fast_scan);
+    double best_seconds = 0.0;
+    for (size_t run = 0; run < runs; ++run) {
+      const auto start = std::chrono::steady_clock::now();
+      tokens = lexer.Tokenize(input);
+      const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      if (run == 0 || elapsed.count() < best_seconds) best_seconds = elapsed.count();
+    }
+    return best_seconds;
+  };
+
+  auto same_tokens = [](const std::vector<emplex::Token> & a, const std::vector<emplex::Token> & b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const auto & x, const auto & y) {
+      return x.id == y.id && x.start == y.start && x.length == y.length && x.pos == y.pos;
+    });
+  };
+
+  std::vector<emplex::Token> baseline;
+  const double baseline_seconds = time_lexer(false, baseline);
+  const size_t token_count = baseline.size();
+
+#ifdef EMPLEX_REFERENCE_DFA
+  std::cout << "DFA tables: reference (" << emplex::DFA::size() << " states x 128 symbols, int)\n";
+#else
+  std::cout << "DFA tables: compressed (" << emplex::DFA::size() << " states x "
+            << emplex::DFA::NumSymbolClasses() << " classes, int8_t)\n";
+#endif
+  const double megabytes = static_cast<double>(input.size()) / (1024.0 * 1024.0);
+  auto report = [&](const std::string & name, double seconds) {
+    std::cout << "  " << name << ": " << seconds << " s, "
+              << (static_cast<double>(token_count) / seconds / 1e6) << " M tokens/s, "
+              << (megabytes / seconds) << " MB/s" << std::endl;
+  };
+  std::cout << "  input: " << megabytes << " MB, " << token_count << " tokens, best of "
+            << runs << " runs\n";
+  report("per-byte DFA", baseline_seconds);
+
+  bool all_match = true;
+  for (scan::Level level : { scan::Level::SCALAR, scan::Level::SSE2, scan::Level::AVX2 }) {
+    if (scan::SelectLevel(level) != level) continue;  // Not supported here.
+    std::vector<emplex::Token> tokens;
+    const double seconds = time_lexer(true, tokens);
+    report(std::string("fast scan (") + scan::LevelName(level) + ")", seconds);
+    if (!same_tokens(tokens, baseline)) {
+      std::cerr << "ERROR: " << scan::LevelName(level) << " fast scan produced different tokens." << std::endl;
+      all_match = false;
+    }
+  }
+  if (!all_match) exit(1);
+}
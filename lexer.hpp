@@ -4,22 +4,105 @@
 #include <algorithm>
 #include <array>
 #include <cctype>
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "AtomTable.hpp"
+#include "ScanKernels.hpp"
+
 namespace emplex {
-  // Struct to store information about a found Token
+  // Struct to store information about a found Token.
+  // Tokens are compact views into the source text they were lexed from; that text must outlive
+  // them.  Lexemes are only copied into a std::string when a caller explicitly asks for one.
   struct Token {
-    int id;                             // Type ID for token
-    std::string lexeme;                 // Sequence matched by token
-    size_t line_id;                     // Line token started on
-    size_t col_id;                      // Column token started on
+    static constexpr int COL_BITS = 24;
+    static constexpr uint64_t COL_MASK = (uint64_t{1} << COL_BITS) - 1;
+
+    int id = 0;                         // Type ID for token
+    uint32_t length = 0;                // Number of characters in the lexeme
+    const char * start = "";            // First character of the lexeme in the source text
+    uint64_t pos = 0;                   // Line (high bits) and column (low COL_BITS) token started on
+    uint32_t atom = AtomTable::NO_ATOM; // Interned name, for identifiers (see Lexer::AssignAtom)
+
+    Token() { }
+    Token(int id, std::string_view lexeme, size_t line, size_t col)
+      : id(id), length(static_cast<uint32_t>(lexeme.size())), start(lexeme.data())
+      , pos((static_cast<uint64_t>(line) << COL_BITS) | std::min<uint64_t>(col, COL_MASK)) { }
+
+    std::string_view Lexeme() const { return std::string_view(start, length); }
+    size_t Line() const { return static_cast<size_t>(pos >> COL_BITS); }
+    size_t Col() const { return static_cast<size_t>(pos & COL_MASK); }
+
     operator int() const { return id; } // Auto-convert tokens to IDs
   };
   
+  // Helpers to compress a DFA transition table at compile time.
+  // Input symbols whose columns are identical in every state form one equivalence class, so the
+  // packed table needs only one signed byte per (state, class) pair (-1 still means "no state").
+  template <size_t NUM_STATES, size_t NUM_SYMBOLS>
+  using dfa_table_t = std::array<std::array<int, NUM_SYMBOLS>, NUM_STATES>;
+
+  template <size_t NUM_STATES, size_t NUM_SYMBOLS>
+  constexpr std::array<uint8_t, NUM_SYMBOLS>
+  MakeSymbolClasses(const dfa_table_t<NUM_STATES, NUM_SYMBOLS> & table) {
+    std::array<uint8_t, NUM_SYMBOLS> symbol_class{};
+    std::array<size_t, NUM_SYMBOLS> class_rep{};   // First symbol seen in each class.
+    size_t num_classes = 0;
+    for (size_t sym = 0; sym < NUM_SYMBOLS; ++sym) {
+      size_t found = num_classes;
+      for (size_t cls = 0; cls < num_classes && found == num_classes; ++cls) {
+        bool same = true;
+        for (size_t state = 0; state < NUM_STATES && same; ++state) {
+          same = (table[state][sym] == table[state][class_rep[cls]]);
+        }
+        if (same) found = cls;
+      }
+      if (found == num_classes) class_rep[num_classes++] = sym;
+      symbol_class[sym] = static_cast<uint8_t>(found);
+    }
+    return symbol_class;
+  }
+
+  template <size_t NUM_SYMBOLS>
+  constexpr size_t CountSymbolClasses(const std::array<uint8_t, NUM_SYMBOLS> & symbol_class) {
+    size_t num_classes = 0;
+    for (uint8_t cls : symbol_class) num_classes = std::max<size_t>(num_classes, cls + 1u);
+    return num_classes;
+  }
+
+  template <size_t NUM_CLASSES, size_t NUM_STATES, size_t NUM_SYMBOLS>
+  constexpr std::array<std::array<int8_t, NUM_CLASSES>, NUM_STATES>
+  PackTable(const dfa_table_t<NUM_STATES, NUM_SYMBOLS> & table,
+            const std::array<uint8_t, NUM_SYMBOLS> & symbol_class) {
+    static_assert(NUM_STATES <= 128, "DFA has too many states to pack into signed bytes.");
+    std::array<std::array<int8_t, NUM_CLASSES>, NUM_STATES> packed{};
+    for (size_t state = 0; state < NUM_STATES; ++state) {
+      for (size_t sym = 0; sym < NUM_SYMBOLS; ++sym) {
+        packed[state][symbol_class[sym]] = static_cast<int8_t>(table[state][sym]);
+      }
+    }
+    return packed;
+  }
+
+  template <size_t NUM_STATES>
+  constexpr std::array<uint8_t, NUM_STATES> PackStops(const std::array<int, NUM_STATES> & stop_id) {
+    std::array<uint8_t, NUM_STATES> packed{};
+    for (size_t state = 0; state < NUM_STATES; ++state) {
+      packed[state] = static_cast<uint8_t>(stop_id[state]);
+    }
+    return packed;
+  }
+
   // Deterministic Finite Automaton (DFA) for token recognition.
+  //
+  // The full int transition table below is the generator's output and serves as the reference;
+  // lexing runs on a compressed copy (a 128-entry symbol->class map plus an int8_t table with
+  // one column per class) that is built at compile time and fits comfortably in L1.
+  // Define EMPLEX_REFERENCE_DFA to lex with the full table instead (e.g., for benchmarking).
   class DFA {
   private:
     static constexpr int NUM_SYMBOLS=128;
@@ -137,6 +220,12 @@ namespace emplex {
     }};
     // DFA stop states (0 indicates NOT a stop)
     static constexpr std::array<int, NUM_STATES> stop_id = {0,0,255,0,0,0,0,0,0,241,237,0,242,242,242,242,242,242,242,242,242,242,0,234,242,242,242,242,249,249,242,242,242,242,242,242,243,243,242,244,244,242,245,245,242,242,242,242,242,247,247,242,242,246,246,251,242,251,242,242,242,242,242,242,248,248,242,242,250,250,242,242,242,242,242,242,242,242,242,242,242,252,252,242,242,242,242,253,253,236,237,241,0,254,254,0,240,240,0,0,0,238,235,239,0,255};
+
+    // Compressed tables used for lexing.
+    static constexpr auto symbol_class = MakeSymbolClasses(table);
+    static constexpr size_t NUM_CLASSES = CountSymbolClasses(symbol_class);
+    static constexpr auto packed_table = PackTable<NUM_CLASSES>(table, symbol_class);
+    static constexpr auto packed_stop = PackStops(stop_id);
   
   public:
     constexpr static int SYMBOL_START = 2;     ///< Symbol to indicate a start of line.
@@ -144,10 +233,34 @@ namespace emplex {
     constexpr static int SYMBOL_MIN_INPUT = 9; ///< Symbols below this are control symbols.
   
     static constexpr size_t size() { return 106; }
+    static constexpr size_t NumSymbolClasses() { return NUM_CLASSES; }
+
     static constexpr int GetStop(int state) {
-      return (state >= 0) ? stop_id[static_cast<size_t>(state)] : 0;
+#ifdef EMPLEX_REFERENCE_DFA
+      return GetStopReference(state);
+#else
+      return (state >= 0) ? packed_stop[static_cast<size_t>(state)] : 0;
+#endif
     }
     static constexpr int GetNext(int state, int sym) {
+#ifdef EMPLEX_REFERENCE_DFA
+      return GetNextReference(state, sym);
+#else
+      int next_state = -1;
+      if (state >= 0 && sym >= 0) {
+        next_state = packed_table[static_cast<size_t>(state)][symbol_class[static_cast<size_t>(sym)]];
+      }
+      // If sym is a control symbol (line begin/end) and not used, keep old state.
+      if (sym < SYMBOL_MIN_INPUT && next_state == -1) next_state = state;
+      return next_state;
+#endif
+    }
+
+    // Lookups in the full, uncompressed generator tables.
+    static constexpr int GetStopReference(int state) {
+      return (state >= 0) ? stop_id[static_cast<size_t>(state)] : 0;
+    }
+    static constexpr int GetNextReference(int state, int sym) {
       int next_state = -1;
       if (state >= 0 && sym >= 0) {
         next_state = table[static_cast<size_t>(state)][static_cast<size_t>(sym)];
@@ -156,6 +269,8 @@ namespace emplex {
       if (sym < SYMBOL_MIN_INPUT && next_state == -1) next_state = state;
       return next_state;
     }
+    static constexpr bool PackedTablesMatch();
+
     static int GetNext(int state, const std::string & syms) {
       for (char x : syms) state = GetNext(state, x);
       return state;
@@ -167,7 +282,56 @@ namespace emplex {
       return std::max(GetStop(state), GetStop(eol_state));
     }
   };
-  
+
+  // Verify (at compile time) that the compressed tables reproduce the full tables exactly.
+  constexpr bool DFA::PackedTablesMatch() {
+    for (int state = 0; state < NUM_STATES; ++state) {
+      if (packed_stop[static_cast<size_t>(state)] != stop_id[static_cast<size_t>(state)]) return false;
+      for (int sym = 0; sym < NUM_SYMBOLS; ++sym) {
+        const int packed =
+          packed_table[static_cast<size_t>(state)][symbol_class[static_cast<size_t>(sym)]];
+        if (packed != table[static_cast<size_t>(state)][static_cast<size_t>(sym)]) return false;
+      }
+    }
+    return true;
+  }
+  static_assert(DFA::PackedTablesMatch(), "Compressed DFA tables differ from the reference tables.");
+
+  // Find which scan::RunKind (if any) a DFA state can skip with a vector kernel.  The state must
+  // loop back to itself on exactly the bytes of that run set, and where the token may end must not
+  // depend on how far into the run we are: either every position is a stop, or none is (even at
+  // an end of line).
+  constexpr scan::RunKind StateRunKind(int state) {
+    using scan::RunKind;
+    for (RunKind kind : { RunKind::WHITESPACE, RunKind::IDENTIFIER,
+                          RunKind::LINE_COMMENT, RunKind::BLOCK_COMMENT }) {
+      bool match = true;
+      for (int sym = 9; sym < 128 && match; ++sym) {
+        match = (scan::InRun(kind, static_cast<unsigned char>(sym)) == (DFA::GetNext(state, sym) == state));
+      }
+      if (!match) continue;
+      const int eol_stop = DFA::GetStop(DFA::GetNext(state, DFA::SYMBOL_STOP));
+      if (DFA::GetStop(state) > 0 || eol_stop == 0) return kind;
+    }
+    return RunKind::NONE;
+  }
+
+  constexpr std::array<scan::RunKind, DFA::size()> MakeRunKinds() {
+    std::array<scan::RunKind, DFA::size()> run_kind{};
+    for (size_t state = 0; state < DFA::size(); ++state) {
+      run_kind[state] = StateRunKind(static_cast<int>(state));
+    }
+    return run_kind;
+  }
+
+  // The long runs in real programs must all be covered.
+  static_assert(StateRunKind(DFA::GetNext(0, ' ')) == scan::RunKind::WHITESPACE);
+  static_assert(StateRunKind(DFA::GetNext(0, '_')) == scan::RunKind::IDENTIFIER);
+  static_assert(StateRunKind(DFA::GetNext(DFA::GetNext(DFA::GetNext(0, '/'), '/'), 'x'))
+                == scan::RunKind::LINE_COMMENT);
+  static_assert(StateRunKind(DFA::GetNext(DFA::GetNext(DFA::GetNext(0, '/'), '*'), 'x'))
+                == scan::RunKind::BLOCK_COMMENT);
+
   class Lexer {
   private:
     static constexpr int NUM_TOKENS=22;
@@ -177,8 +341,11 @@ namespace emplex {
     size_t cur_line = 1;   // Track LINE we are reading in the input.
     size_t cur_col = 0;    // Track COLUMN we are reading in the input.
     int start_pos = 0;     // Track INDEX for the start of current lexeme.
-    std::string lexeme{};  // Lexeme found for the current token
+    std::string_view lexeme{};  // Lexeme found for the current token
     std::string errors{};  // Description of any errors encountered
+    bool fast_scan = true; // Skip long runs (whitespace, identifiers, comments) with scan kernels?
+
+    static constexpr std::array<scan::RunKind, DFA::size()> run_kind = MakeRunKinds();
   
   public:
     static constexpr int ID__EOF_ = 0;
@@ -256,20 +423,34 @@ namespace emplex {
       };
     }
   
+    // Give identifier tokens their atom.  This is kept out of NextToken(), which may run on
+    // several threads at once; callers apply it as tokens are handed on.
+    static void AssignAtom(Token & token) {
+      if (token.id == ID_ID) token.atom = Atoms().Intern(token.Lexeme());
+    }
+
     // Return the number of token types the lexer recognizes.
     static constexpr int GetNumTokens() { return NUM_TOKENS; }
   
+    // Turn vectorized run skipping on or off (tokens are identical either way).
+    void UseFastScan(bool in=true) { fast_scan = in; }
+    bool UsingFastScan() const { return fast_scan; }
+
     // Generate and return the next token from the input stream.
     Token NextToken(std::string_view in) {
       // If we cannot read in, return an "EOF" token.
       if (start_pos >= std::ssize(in)) return { 0, "", cur_line, cur_col };
-  
+
       int cur_pos = start_pos;   // Position in the input that we are actively analyzing
       int best_pos = start_pos;  // Best look-ahead we've found so far
       int cur_state = 0;         // Next state for the DFA analysis
       int cur_stop = 0;          // Current "stop" state (or 0 if we can't stop here)
       int best_stop = -1;        // Best stop state found so far?
-  
+      size_t newlines = 0;                 // Newlines consumed so far...
+      const char * last_newline = nullptr; // ...and the most recent one.
+      size_t best_newlines = 0;            // Newlines within the best lexeme found so far...
+      const char * best_last_newline = nullptr;  // ...and the last of them.
+
       // If we are at the START OF A LINE, send a DFA::SYMBOL_START
       if (start_pos == 0 || in[start_pos-1] == '\n') {
         cur_state = DFA::GetNext(0, DFA::SYMBOL_START);
@@ -281,55 +462,77 @@ namespace emplex {
       while (cur_stop >= 0 && cur_state >= 0 && cur_pos < std::ssize(in)) {
         const char next_char = in[cur_pos++];
         if (next_char < 0) break; // Ignore invalid chars.
+        if (next_char == '\n') { ++newlines; last_newline = in.data() + cur_pos - 1; }
         cur_state = DFA::GetNext(cur_state, next_char);
         cur_stop = DFA::GetStop(cur_state);
-        if (cur_stop > 0) { best_pos = cur_pos; best_stop = cur_stop; }
+        // If this state loops on a whole run of characters, skip to the end of that run.
+        if (fast_scan && cur_state >= 0 && run_kind[static_cast<size_t>(cur_state)] != scan::RunKind::NONE) {
+          const char * run_end = scan::SkipRun(run_kind[static_cast<size_t>(cur_state)],
+                                               in.data() + cur_pos, in.data() + in.size(),
+                                               newlines, last_newline);
+          cur_pos = static_cast<int>(run_end - in.data());
+        }
+        if (cur_stop > 0) {
+          best_pos = cur_pos; best_stop = cur_stop;
+          best_newlines = newlines; best_last_newline = last_newline;
+        }
         // Look ahead to see if we are at the END OF A LINE that can finish a token.
         if (cur_pos == std::ssize(in) || in[cur_pos] == '\n') {
           int eol_state = DFA::GetNext(cur_state, DFA::SYMBOL_STOP);
           int eol_stop = DFA::GetStop(eol_state);
-          if (eol_stop > 0) { best_pos = cur_pos; best_stop = eol_stop; }
+          if (eol_stop > 0) {
+            best_pos = cur_pos; best_stop = eol_stop;
+            best_newlines = newlines; best_last_newline = last_newline;
+          }
         }
       }
-  
+
       // If we did not find any options, peel off just one character and use it as id.
-      if (best_pos == start_pos) { best_stop=in[start_pos]; best_pos++;}
-  
+      if (best_pos == start_pos) {
+        best_stop=in[start_pos]; best_pos++;
+        if (in[start_pos] == '\n') { best_newlines = 1; best_last_newline = in.data() + start_pos; }
+      }
+
       lexeme = in.substr(start_pos, best_pos-start_pos);
       start_pos += std::ssize(lexeme);
-  
+
       // Update the line number we are on.
       const size_t out_line = cur_line;
       const size_t out_col = cur_col;
-      if ((cur_col = lexeme.rfind('\n')) == std::string::npos) { // No newlines
+      if (best_newlines == 0) {
         cur_col = out_col + lexeme.size();
       } else {
-        cur_col = lexeme.size() - cur_col - 1;
-        cur_line += static_cast<size_t>(std::count(lexeme.begin(),lexeme.end(),'\n'));
+        cur_col = static_cast<size_t>(in.data() + best_pos - best_last_newline - 1);
+        cur_line += best_newlines;
       }
-  
+
       // Return the token we found.
       return { best_stop, lexeme, out_line, out_col };
     }
   
-    // Convert an input string into a vector of tokens.
-    std::vector<Token> Tokenize(std::string_view in) {
-      start_pos = 0; // Start processing at beginning of string.
+    // Prepare to lex a new input (one NextToken call at a time) from its beginning, or from the
+    // start of a later line, which is then counted as line 1.
+    void Restart(size_t line_start=0) {
+      start_pos = static_cast<int>(line_start); // Start processing at the requested position.
       cur_line = 1;  // Start processing at the first line of the input.
       cur_col = 0;   // Start processing at the first position of the input.
+    }
+
+    // Where will the next token start, and on which line?
+    size_t CurPos() const { return static_cast<size_t>(start_pos); }
+    size_t CurLine() const { return cur_line; }
+
+    // Convert an input string into a vector of tokens.
+    std::vector<Token> Tokenize(std::string_view in) {
+      Restart();
       std::vector<Token> out_tokens;
       while (Token token = NextToken(in)) {
-        if (!IgnoreToken(token.id)) out_tokens.push_back(token);
+        if (IgnoreToken(token.id)) continue;
+        AssignAtom(token);
+        out_tokens.push_back(token);
       }
       return out_tokens;
     }
-  
-    // Convert an input stream to a string, then tokenize.
-    std::vector<Token> Tokenize(std::istream & is) {
-      return Tokenize(
-        std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>())
-      );
-    }
   };
 } // End of namespace emplex
 #endif // #ifndef EMPLEX_LEXER_HPP_INCLUDE_
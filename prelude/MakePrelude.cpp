@@ -0,0 +1,159 @@
+// Pre-renders the runtime prelude.
+//
+// The runtime helpers in GenerateHelperWAT.hpp are the same for every program, so rather than
+// formatting them on each compile, this program renders them once, as regular WAT, as compact
+// WAT, and as encoded binary functions, and writes them out as the Prelude.hpp header.  The
+// prelude is versioned by a hash of all of its contents.  The Makefile reruns this program
+// whenever the helpers change.
+//
+// Usage: MakePrelude > Prelude.hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Control.hpp"
+#include "GenerateHelperWAT.hpp"
+#include "WasmEncoder.hpp"
+
+struct Helper {
+  std::string wat;
+  std::string compact_wat;
+};
+
+Helper Render(void (*generate)(Control &)) {
+  Helper out;
+  for (bool compact : {false, true}) {
+    Control control;
+    control.Compact(compact);
+    control.indent = 2;           // Helpers sit inside the module.
+    generate(control);
+    (compact ? out.compact_wat : out.wat) = control.code.Text();
+  }
+  return out;
+}
+
+// Write a string as a C++ literal, one line of text per source line.
+std::string Literal(std::string_view text, bool binary=false) {
+  std::string out = "std::string_view{\"";
+  char buffer[8];
+  for (size_t i = 0; i < text.size(); ++i) {
+    const char c = text[i];
+    if (binary || c < ' ' || c > '~') {
+      if (!binary && c == '\n') out += (i + 1 < text.size()) ? "\\n\"\n    \"" : "\\n";
+      else {
+        std::snprintf(buffer, sizeof(buffer), "\\x%02X", static_cast<uint8_t>(c));
+        out += buffer;
+      }
+      // A hex escape would swallow a following hex digit, so restart the literal.
+      if (!binary && c != '\n') out += "\"\"";
+    }
+    else if (c == '"' || c == '\\') { out += '\\'; out += c; }
+    else out += c;
+  }
+  out += "\", " + std::to_string(text.size()) + "}";
+  return out;
+}
+
+int main()
+{
+  // Helpers in module order.
+  const std::vector<Helper> helpers{
+    Render(GenerateAllocStr), Render(GenerateSizeFunction), Render(GenerateStrCpy),
+    Render(GenerateStrConcat), Render(GenerateCharToString), Render(GenerateI32Swap),
+    Render(GenerateDupeMem)
+  };
+
+  std::string module = "(module (memory 1) (global $free_mem (mut i32) (i32.const 0))\n";
+  for (const Helper & helper : helpers) module += helper.compact_wat;
+  module += ")\n";
+
+  uint64_t hash = 0xcbf29ce484222325;   // FNV-1a over everything written.
+  auto Hash = [&hash](std::string_view text) {
+    for (char c : text) hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+  };
+
+  std::cout << "#pragma once\n\n"
+            << "// The runtime prelude: helper functions called by generated code.  The helpers a program\n"
+            << "// uses (and any helpers those call) are spliced into its module; the rest are left out.\n"
+            << "//\n"
+            << "// GENERATED by prelude/MakePrelude from GenerateHelperWAT.hpp; do not edit.\n\n"
+            << "#include <cstdint>\n"
+            << "#include <string_view>\n\n"
+            << "#include \"WasmEncoder.hpp\"\n\n"
+            << "struct PreludeFunction {\n"
+            << "  std::string_view wat;           // Regular WAT, with comments and indentation.\n"
+            << "  std::string_view compact_wat;   // WAT as output by --compact.\n"
+            << "  WasmFunction binary;\n"
+            << "  uint32_t needs;                 // Bit mask of prelude functions required (itself included).\n"
+            << "};\n\n";
+
+  // Encode the helpers, noting which others each one calls.
+  struct Encoded {
+    std::string name, type, export_name, body;
+    std::vector<WasmCall> calls;       // Targets view into the module text.
+  };
+  std::vector<Encoded> encoded;
+  WasmEncoder::ForEachFunction(module, [&encoded](const WasmFunction & fun) {
+    encoded.push_back(Encoded{std::string(fun.name), std::string(fun.type),
+                              std::string(fun.export_name), std::string(fun.body),
+                              std::vector<WasmCall>(fun.calls.begin(), fun.calls.end())});
+  });
+  if (encoded.size() != helpers.size()) Error("Internal error: prelude helpers did not all encode.");
+
+  // Find every helper that each one requires, directly or indirectly.
+  std::vector<uint32_t> needs(encoded.size());
+  for (size_t id = 0; id < encoded.size(); ++id) needs[id] = 1u << id;
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (size_t id = 0; id < encoded.size(); ++id) {
+      for (const WasmCall & call : encoded[id].calls) {
+        auto it = std::find_if(encoded.begin(), encoded.end(),
+                               [&call](const Encoded & fun) { return fun.name == call.target; });
+        const uint32_t old_needs = needs[id];
+        needs[id] |= needs[static_cast<size_t>(it - encoded.begin())];
+        changed |= (needs[id] != old_needs);
+      }
+    }
+  }
+
+  std::vector<std::string> functions;
+  for (size_t id = 0; id < encoded.size(); ++id) {
+    const Helper & helper = helpers[id];
+    const Encoded & fun = encoded[id];
+    std::string calls = "{}";
+    if (fun.calls.size()) {
+      calls = "PRELUDE_CALLS_" + std::to_string(id);
+      std::cout << "inline constexpr WasmCall " << calls << "[] = {";
+      for (const WasmCall & call : fun.calls) {
+        std::cout << " {" << call.offset << ", " << Literal(call.target) << "},";
+        Hash(std::to_string(call.offset)); Hash(call.target);
+      }
+      std::cout << " };\n";
+    }
+    Hash(helper.wat); Hash(helper.compact_wat);
+    Hash(fun.name); Hash(fun.type); Hash(fun.export_name); Hash(fun.body);
+    functions.push_back(
+      "  { // " + fun.name + "\n"
+      "    " + Literal(helper.wat) + ",\n"
+      "    " + Literal(helper.compact_wat) + ",\n"
+      "    { " + Literal(fun.name) + ", " + Literal(fun.type, true) + ", " + Literal(fun.export_name) + ",\n"
+      "      " + Literal(fun.body, true) + ",\n"
+      "      " + calls + " },\n"
+      "    " + std::to_string(needs[id]) + "\n"
+      "  },\n");
+  }
+
+  std::cout << "\ninline constexpr PreludeFunction PRELUDE_FUNCTIONS[] = {\n";
+  for (const std::string & function : functions) std::cout << function;
+
+  char version[20];
+  std::snprintf(version, sizeof(version), "%016llx", static_cast<unsigned long long>(hash));
+  std::cout << "};\n\n"
+            << "// Changes whenever any part of the prelude does; suitable as a cache key.\n"
+            << "inline constexpr std::string_view PRELUDE_VERSION = \"" << version << "\";\n";
+}
@@ -0,0 +1,77 @@
+// Calls each function of a compiled Tubular program with a few sets of arguments, and prints one
+// line per call with its result (or the trap it raised).  Each call first gets an instance of its
+// own; then every function is called again in a few rounds on one shared instance.  The
+// signatures come from the .tube source.  Used to check that every optimization level computes
+// the same results.
+//
+// Usage: node run_exports.js program.wasm program.tube
+
+const fs = require("fs");
+
+const [wasm_file, tube_file] = process.argv.slice(2);
+const wasm_module = new WebAssembly.Module(fs.readFileSync(wasm_file));
+const source = fs.readFileSync(tube_file, "utf8");
+
+// Argument values by parameter type, one array entry per set of arguments.
+const ARGS = {
+  int:    [1, 2, 7, 12],
+  char:   [97, 66, 122, 48],
+  double: [1.5, 2.0, 10.25, -3.5],
+  string: ["ab", "Hello", "x7", "-1234"],
+};
+
+function ReadString(memory, pos) {
+  const bytes = new Uint8Array(memory.buffer);
+  let end = pos;
+  while (end < bytes.length && bytes[end] != 0) end++;
+  return JSON.stringify(Buffer.from(bytes.subarray(pos, end)).toString("latin1"));
+}
+
+// Place a string near the end of memory, well clear of anything the program allocates.
+function WriteString(memory, text, slot) {
+  const bytes = new Uint8Array(memory.buffer);
+  const pos = memory.buffer.byteLength - 4096 + slot * 256;
+  bytes.set(Buffer.from(text, "latin1"), pos);
+  bytes[pos + text.length] = 0;
+  return pos;
+}
+
+// Call one function with the given set of arguments and describe the result.
+function Call(instance, name, params, return_type, set) {
+  const { memory } = instance.exports;
+  const args = params.map((type, i) =>
+    type == "string" ? WriteString(memory, ARGS.string[(set + i) % 4], i) : ARGS[type][set] + i);
+  const shown = params.map((type, i) =>
+    type == "string" ? JSON.stringify(ARGS.string[(set + i) % 4]) : String(args[i]));
+  let result;
+  try {
+    result = instance.exports[name](...args);
+    if (return_type == "string") result = ReadString(memory, result);
+  } catch (error) {
+    result = "trap (" + error.message + ")";
+  }
+  return `${name}(${shown.join(", ")}) = ${result}`;
+}
+
+const pattern = /^function\s+(\w+)\s*\(([^)]*)\)\s*:\s*(\w+)/gm;
+const functions = [...source.matchAll(pattern)].map(([, name, param_text, return_type]) => ({
+  name, return_type,
+  params: param_text.split(",").map(param => param.trim().split(/\s+/)[0]).filter(type => type),
+}));
+
+// Each call on its own instance...
+for (const { name, params, return_type } of functions) {
+  for (let set = 0; set < ARGS.int.length; set++) {
+    console.log(Call(new WebAssembly.Instance(wasm_module, {}), name, params, return_type, set));
+    if (params.length == 0) break;
+  }
+}
+
+// ...then a few rounds of calls on one instance, where each call sees the memory (such as
+// strings changed by index) that the calls before it left behind.
+const shared = new WebAssembly.Instance(wasm_module, {});
+for (let round = 0; round < 3; round++) {
+  for (const { name, params, return_type } of functions) {
+    console.log("shared: " + Call(shared, name, params, return_type, round % ARGS.int.length));
+  }
+}
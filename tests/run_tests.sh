@@ -172,6 +172,218 @@ for i in $(seq -w 01 $P3_error_test_count); do
     fi
 done
 
+echo ---
+echo PARALLEL LEXING Testing
+
+# Generate a large program (big enough to be split) whose cut candidates include a "function"
+# line inside a block comment, then make sure -j 4 matches a single-threaded compile exactly.
+parallel_pass_count=0
+parallel_test_count=2
+big_file="parallel-big.tube"
+awk 'BEGIN {
+  for (i = 0; i < 12000; i++) {
+    printf "function f%d(int a, string s) : int {\n  // line comment %d \"/*\n", i, i
+    printf "  int x = a * %d + size(s + \"*/\");\n  return x;\n}\n", i
+    if (i % 997 == 0) printf "/* block comment\nfunction hidden%d(int a) : int {\n*/\n", i
+  }
+}' > "$big_file"
+if cmp -s <(../Project4 "$big_file" 2>&1) <(../Project4 -j 4 "$big_file" 2>&1); then
+    echo "Parallel lexing test 1 ... Passed!"
+    ((parallel_pass_count++))
+else
+    echo "Parallel lexing test 1 FAILED (output differs from single-threaded lexing)."
+fi
+echo "function broken() : int { return 1 }" >> "$big_file"   # Error must cite the same line.
+if cmp -s <(../Project4 "$big_file" 2>&1) <(../Project4 -j 4 "$big_file" 2>&1); then
+    echo "Parallel lexing test 2 ... Passed!"
+    ((parallel_pass_count++))
+else
+    echo "Parallel lexing test 2 FAILED (error differs from single-threaded lexing)."
+fi
+rm -f "$big_file"
+
+echo COMPACT OUTPUT Testing
+
+# Compact output must be the regular output with its comments, indentation, and blank lines
+# removed (and nothing else).
+compact_pass_count=0
+compact_test_count=0
+strip_wat() { sed -e 's/;;.*$//' -e 's/^ *//' -e 's/ *$//' | grep -v '^$'; }
+for code_file in test-[0-9]*.tube P3-test-[0-9]*.tube; do
+    ../Project4 "$code_file" > /dev/null 2>&1 || continue   # Only files that compile.
+    ((compact_test_count++))
+    compact_out=$(../Project4 --compact "$code_file")
+    if cmp -s <(../Project4 "$code_file" | strip_wat) <(echo "$compact_out" | strip_wat) \
+       && ! grep -q -e ';;' -e '^ ' -e '^$' <<< "$compact_out"; then
+        ((compact_pass_count++))
+    else
+        echo "Compact output test $code_file FAILED."
+    fi
+done
+
+echo TREE SHAKING Testing
+
+# Only the runtime helpers that a program uses (and those they call) may be in its module.
+shake_pass_count=0
+shake_test_count=2
+helper_funcs() { ../Project4 --compact "$1" | grep -o -E '^\(func \$(_[a-z0-9_]*|size) ' | tr -d '\n'; }
+if [[ -z "$(helper_funcs P3-test-26.tube)" ]]; then    # Numeric only: no helpers at all.
+    echo "Tree shaking test 1 ... Passed!"
+    ((shake_pass_count++))
+else
+    echo "Tree shaking test 1 FAILED (helpers in a numeric program: $(helper_funcs P3-test-26.tube))."
+fi
+# Concatenating a char needs $_char_to_string and $_str_concat, which bring in what they call.
+if [[ "$(helper_funcs test-17.tube)" == '(func $_alloc_str (func $size (func $_strcpy (func $_str_concat (func $_char_to_string (func $_i32swap ' ]]; then
+    echo "Tree shaking test 2 ... Passed!"
+    ((shake_pass_count++))
+else
+    echo "Tree shaking test 2 FAILED (string concatenation helpers: $(helper_funcs test-17.tube))."
+fi
+
+echo BINARY OUTPUT Testing
+
+# Binary output must match the modules in golden/ byte for byte, and every module must be
+# accepted by the WebAssembly engine in node.  Where wat2wasm is installed, each module must also
+# be byte for byte what wat2wasm makes of the WAT output.  The golden modules were made by
+# --wasm itself (wat2wasm was not available) and checked with node, so until they are remade
+# with wat2wasm they only catch changes to the encoder's output.  To remake one:
+#   ../Project4 test-NN.tube > test-NN.wat && wat2wasm test-NN.wat -o golden/test-NN.wasm
+binary_pass_count=0
+binary_test_count=0
+for code_file in test-[0-9]*.tube P3-test-[0-9]*.tube; do
+    ../Project4 "$code_file" > /dev/null 2>&1 || continue   # Only files that compile.
+    ((binary_test_count++))
+    binary_file="${code_file%.tube}.bin.wasm"
+    golden_file="golden/${code_file%.tube}.wasm"
+    ../Project4 --wasm "$code_file" > "$binary_file" &&
+        { [ ! -f "$golden_file" ] || cmp -s "$golden_file" "$binary_file"; } &&
+        node -e 'new WebAssembly.Module(require("fs").readFileSync(process.argv[1]))' "$binary_file"
+    result=$?
+    if [ $result -eq 0 ] && command -v wat2wasm > /dev/null; then
+        ../Project4 "$code_file" > binary-check.wat
+        wat2wasm binary-check.wat -o binary-check.wasm && cmp -s binary-check.wasm "$binary_file"
+        result=$?
+    fi
+    if [ $result -eq 0 ]; then
+        ((binary_pass_count++))
+    else
+        echo "Binary output test $code_file FAILED."
+    fi
+    rm -f "$binary_file"
+done
+rm -f binary-check.wat binary-check.wasm
+
+echo OPTIMIZATION Testing
+
+# Every optimization level must compute the same results as -O0: each function is called with a
+# few sets of arguments, on fresh instances and then repeatedly on one shared instance (see
+# run_exports.js), and the results, traps included, must match.  The
+# --stats report must also be produced, showing the effect of the passes.  (The opt-test files
+# target the optimizations specifically.)
+opt_pass_count=0
+opt_test_count=0
+for code_file in test-[0-9]*.tube P3-test-[0-9]*.tube opt-test-[0-9]*.tube; do
+    ../Project4 "$code_file" > /dev/null 2>&1 || continue   # Only files that compile.
+    ../Project4 -O0 --wasm "$code_file" > opt-check.wasm
+    node run_exports.js opt-check.wasm "$code_file" > opt-expected.txt 2>&1
+    for opt_level in -O1 -O2 -Os; do
+        ((opt_test_count++))
+        ../Project4 $opt_level --wasm "$code_file" > opt-check.wasm &&
+            node run_exports.js opt-check.wasm "$code_file" > opt-actual.txt 2>&1 &&
+            cmp -s opt-expected.txt opt-actual.txt
+        if [ $? -eq 0 ]; then
+            ((opt_pass_count++))
+        else
+            echo "Optimization test $code_file ($opt_level) FAILED."
+        fi
+    done
+done
+((opt_test_count++))
+../Project4 -O2 --stats opt-test-01.tube 2> opt-stats.txt > /dev/null &&
+    grep -q "^Optimization passes (-O2, " opt-stats.txt &&
+    grep -q "^  fold-constants .* constants folded" opt-stats.txt
+if [ $? -eq 0 ]; then
+    ((opt_pass_count++))
+else
+    echo "Optimization statistics test FAILED."
+fi
+# Constant strings are built at compile time; the only call left makes the result a new string.
+((opt_test_count++))
+printf 'function Banner() : string {\n  return "[" + "=" * 20 + \x27]\x27 + ("ab" + \x27c\x27) * size("xyz");\n}\n' > opt-check.tube
+../Project4 -O1 --compact opt-check.tube | sed -n '/(func $Banner/,/^)$/p' > opt-check.wat
+if [ "$(grep -c '(call ' opt-check.wat)" -ne 1 ] || ! grep -q '(call $_dupe_mem)' opt-check.wat; then
+    echo "String folding test FAILED."
+else
+    ((opt_pass_count++))
+fi
+# Dead stores, dead branches, and the locals they used are all gone, leaving only x.
+((opt_test_count++))
+printf 'function Dead(int n) : int {\n  int x = n;\n  int y = n * 2;\n  if (0) { x = y; }\n  y = 7;\n  return x;\n}\n' > opt-check.tube
+if [ "$(../Project4 -O1 opt-check.tube | grep -c '(local ')" -eq 1 ]; then
+    ((opt_pass_count++))
+else
+    echo "Dead code test FAILED."
+fi
+# The peephole rules rewrite the generated instructions (for binary output too) and report how
+# often they fired.
+((opt_test_count++))
+../Project4 -O1 --stats opt-test-04.tube 2> opt-stats.txt > opt-check.wat &&
+    grep -q '(local.tee ' opt-check.wat &&
+    grep -q "^Peephole rules ([1-9][0-9]* fired):" opt-stats.txt &&
+    grep -q "^  negate " opt-stats.txt &&
+    ../Project4 -O1 --wasm --stats opt-test-04.tube 2> opt-stats.txt > opt-check.wasm &&
+    grep -q "^  negate " opt-stats.txt
+if [ $? -eq 0 ]; then
+    ((opt_pass_count++))
+else
+    echo "Peephole test FAILED."
+fi
+# Variables whose live ranges never overlap share local slots at -O2.
+((opt_test_count++))
+count_locals() { ../Project4 "$1" opt-test-05.tube | grep -c '(local \$var'; }
+if [ "$(count_locals -O2)" -lt "$(count_locals -O1)" ]; then
+    ((opt_pass_count++))
+else
+    echo "Local coalescing test FAILED."
+fi
+rm -f opt-check.tube opt-check.wat opt-check.wasm opt-expected.txt opt-actual.txt opt-stats.txt
+
+echo DEEP EXPRESSION Testing
+
+# Machine-generated expressions nested 100000 levels deep must compile without exhausting the
+# call stack: parentheses, long operator chains, right-associative assignments, unary operators,
+# and nested function calls.
+deep_pass_count=0
+deep_test_count=5
+deep_depth=100000
+deep_file="deep-expr.tube"
+for deep_kind in parens chain assign unary calls; do
+    awk -v n=$deep_depth -v kind=$deep_kind 'BEGIN {
+      print "function inc(int x) : int {\n  return x + 1;\n}"
+      printf "function main() : int {\n  int a = 1;\n  int b = 2;\n  return "
+      for (i = 0; i < n; i++) {
+        if (kind == "parens") printf "("
+        else if (kind == "assign") printf (i % 2 ? "b = " : "a = ")
+        else if (kind == "unary") printf (i % 2 ? "- " : "! ")
+        else if (kind == "calls") printf "inc("
+      }
+      printf "a"
+      for (i = 0; i < n; i++) {
+        if (kind == "parens" || kind == "calls") printf ")"
+        else if (kind == "chain") printf " + a"
+      }
+      print ";\n}"
+    }' > "$deep_file"
+    if ../Project4 "$deep_file" > /dev/null 2>&1; then
+        echo "Deep expression test ($deep_kind) ... Passed!"
+        ((deep_pass_count++))
+    else
+        echo "Deep expression test ($deep_kind) FAILED to compile."
+    fi
+done
+rm -f "$deep_file"
+
 # Report the final count of differing files
 echo ---
 echo "Of $test_count regular test files..."
@@ -182,3 +394,9 @@ echo "...generated $P3_wat_count WAT files"
 echo "...converted $P3_wasm_count WAT files to wasm files for testing."
 echo "Passed $error_pass_count of $error_test_count error tests (Failed $error_fail_count)"
 echo "Passed $P3_error_pass_count of $P3_error_test_count Project 3 error tests (Failed $P3_error_fail_count)"
+echo "Passed $parallel_pass_count of $parallel_test_count parallel lexing tests"
+echo "Passed $compact_pass_count of $compact_test_count compact output tests"
+echo "Passed $shake_pass_count of $shake_test_count tree shaking tests"
+echo "Passed $binary_pass_count of $binary_test_count binary output tests"
+echo "Passed $opt_pass_count of $opt_test_count optimization tests"
+echo "Passed $deep_pass_count of $deep_test_count deep expression tests"
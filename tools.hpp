@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <sstream>
 
 #include "lexer.hpp"
@@ -14,13 +15,20 @@ std::string ToString(Ts... message) {
   return ss.str();
 }
 
+// Transparent hash so string-keyed maps can be searched with a std::string_view (such as a
+// token lexeme) without building a temporary std::string.
+struct StringHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view str) const { return std::hash<std::string_view>{}(str); }
+};
+
 // A position in a file specified by line and column.
 struct FilePos {
   size_t line;
   size_t col;
 
   FilePos(size_t line, size_t col) : line(line), col(col) { }
-  FilePos(const emplex::Token & token) : FilePos(token.line_id, token.col_id) { }
+  FilePos(const emplex::Token & token) : FilePos(token.Line(), token.Col()) { }
   FilePos(const FilePos &) = default;
   FilePos & operator=(const FilePos &) = default;
 